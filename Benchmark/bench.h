@@ -0,0 +1,98 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*
+* Minimal timing harness for the benchmark executable.
+* Each benchmark body is run a few times to warm the caches, then timed over a number of repetitions
+* and the fastest repetition is reported, which is the least noisy estimate on a shared machine.
+*
+* Every reported result is also kept so the whole run can be written out as JSON at the end
+* and compared with a run from another commit.
+*/
+
+// Written by doNotOptimize so the compiler cannot prove a benchmarked result is unused
+inline const void* volatile g_benchSink = nullptr;
+
+// Stops the optimizer from throwing away a result that is otherwise never read
+template <typename T>
+inline void doNotOptimize(const T& value) {
+	g_benchSink = &value;
+}
+
+/*
+* Runs fn() repetitions times and returns the fastest run in nanoseconds.
+*/
+template <typename F>
+double timeBest(int repetitions, F&& fn) {
+	for (int i = 0; i < 2; i++)
+		fn();
+	double best = 1e300;
+	for (int i = 0; i < repetitions; i++) {
+		auto start = std::chrono::steady_clock::now();
+		fn();
+		auto end = std::chrono::steady_clock::now();
+		double ns = std::chrono::duration<double, std::nano>(end - start).count();
+		if (ns < best)
+			best = ns;
+	}
+	return best;
+}
+
+// One reported measurement, a single run (op) processed items elements and bytes bytes
+struct BenchResult
+{
+	std::string name;
+	double nsPerOp;
+	double items;
+	double bytes;
+};
+
+inline std::vector<BenchResult> g_benchResults;
+// See selected, empty runs everything
+inline std::string g_benchFilter;
+
+// Whether the benchmark group called name should run, it does when the filter is part of its name
+// or starts with it, so both "load" and "mesh_load/obj" select mesh_load
+inline bool selected(const std::string& name) {
+	return g_benchFilter.empty() || name.find(g_benchFilter) != std::string::npos || g_benchFilter.find(name) == 0;
+}
+
+// Prints one result line and records it, items and bytes are how much a single run processed
+inline void report(const char* name, double ns, double items, double bytes = 0.0) {
+	if (bytes > 0.0) {
+		printf("%-44s %14.1f ns/op %10.3f ns/item %10.2f Mitems/s %10.1f MB/s\n",
+			name, ns, ns / items, items / ns * 1e3, bytes / ns * 1e3);
+	}
+	else {
+		printf("%-44s %14.1f ns/op %10.3f ns/item %10.2f Mitems/s\n", name, ns, ns / items, items / ns * 1e3);
+	}
+	g_benchResults.push_back({ name, ns, items, bytes });
+}
+
+// Writes every recorded result as JSON, context is a list of "key": value pairs describing the machine and build
+inline bool writeResultsJson(const std::string& filename, const std::vector<std::pair<std::string, std::string>>& context) {
+	std::ofstream file(filename, std::ios::trunc);
+	if (!file)
+		return false;
+	file << "{\n  \"context\": {";
+	for (size_t i = 0; i < context.size(); i++)
+		file << (i ? ", " : "") << '"' << context[i].first << "\": " << context[i].second;
+	file << "},\n  \"benchmarks\": [";
+	char line[512];
+	for (size_t i = 0; i < g_benchResults.size(); i++) {
+		const BenchResult& r = g_benchResults[i];
+		snprintf(line, sizeof(line),
+			"%s\n    {\"name\": \"%s\", \"ns_per_op\": %.3f, \"items_per_op\": %.0f, \"ns_per_item\": %.6f, "
+			"\"items_per_second\": %.1f, \"bytes_per_second\": %.1f}",
+			i ? "," : "", r.name.c_str(), r.nsPerOp, r.items, r.nsPerOp / r.items,
+			r.items / r.nsPerOp * 1e9, r.bytes / r.nsPerOp * 1e9);
+		file << line;
+	}
+	file << "\n  ]\n}\n";
+	return !file.fail();
+}
@@ -0,0 +1,1036 @@
+// benchmark.cpp : Standalone benchmarks for the engine's hot paths, run in Release.
+//
+// Benchmark [--filter <text>] [--json <file>] [--max-triangles <n>]
+//   --filter         only run the benchmark groups whose name contains text, e.g. --filter mesh_load
+//   --json           also write every result to file, to compare runs across commits
+//   --max-triangles  largest generated mesh for the mesh load and BVH benchmarks, 1000000 by default, up to 10000000
+//   The bvh group also uses teapot.obj when there is one in the working directory
+//
+// Builds with the Benchmark project in Visual Studio, or anywhere else with a C++17 compiler, for example
+//   g++ -std=c++17 -O2 -mavx -I../GameEngine benchmark.cpp ../GameEngine/{geometry,mappedfile,objloader,transform,
+//       meshcache,clipper,tilerenderer,ansiterminal,framecapture,profiler,bvh,
+//       instancing,lod,framebuffer,supersample,lighting}.cpp -pthread -o benchmark
+
+#include "bench.h"
+#include "engine.h"
+#include "geometry.h"
+#include "transform.h"
+#include "objloader.h"
+#include "meshcache.h"
+#include "raster.h"
+#include "clipper.h"
+#include "tilerenderer.h"
+#include "ansiterminal.h"
+#include "bvh.h"
+#include "instancing.h"
+#include "lod.h"
+#include "lighting.h"
+#include "audiomixer.h"
+#include "simd.h"
+#include "vecmath.h"
+#include <random>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+
+// Random positions in a unit-ish cube in front of the camera, enough to stand in for a large mesh
+static VertexStream makeRandomVertices(size_t count) {
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+	VertexStream v;
+	v.reserve(count);
+	for (size_t i = 0; i < count; i++) {
+		v.push_back({ dist(rng), dist(rng), dist(rng) });
+	}
+	return v;
+}
+
+// The camera and projection used by MainGame at 960x520
+static void makeMatrices(mat4x4& matView, mat4x4& matProj) {
+	vec3 pos = { 0.0f, 0.0f, 3.0f };
+	vec3 forward = { 0.0f, 0.0f, -1.0f };
+	vec3 up = { 0.0f, 1.0f, 0.0f };
+	vec3 right = cross_product(up, forward);
+	matView.initViewMatrix(pos, forward, up, right);
+	matProj.initProjectionMatrix(0.1f, 1000.0f, 90.0f, 520.0f / 960.0f);
+}
+
+static void benchVertexTransform() {
+	if (!selected("transform"))
+		return;
+	const float width = 960.0f, height = 520.0f;
+	mat4x4 matView, matProj;
+	makeMatrices(matView, matProj);
+	mat4x4 matViewProj = matProj * matView;
+
+	for (size_t count : { size_t(1) << 10, size_t(1) << 16, size_t(1) << 20 }) {
+		VertexStream in = makeRandomVertices(count);
+		VertexStream out;
+		out.resize(count);
+
+		// The path updateFrame used before: view then projection through matrixMultiplyVector,
+		// then the viewport scale, one vertex at a time
+		double perVertex = timeBest(10, [&]() {
+			for (size_t i = 0; i < count; i++) {
+				vec3 p = in.get(i), view, proj;
+				matView.matrixMultiplyVector(p, view);
+				matProj.matrixMultiplyVector(view, proj);
+				out.x[i] = (proj.x + 1.0f) * 0.5f * width;
+				out.y[i] = (proj.y + 1.0f) * 0.5f * height;
+				out.z[i] = proj.z;
+			}
+			doNotOptimize(out.x[count - 1]);
+		});
+
+		double batched = timeBest(10, [&]() {
+			transformVertices(matViewProj, in, out, width, height);
+			doNotOptimize(out.x[count - 1]);
+		});
+
+		char name[64];
+		snprintf(name, sizeof(name), "transform/per_vertex/%zu", count);
+		report(name, perVertex, (double)count);
+		snprintf(name, sizeof(name), "transform/batched_w%d/%zu", SIMD_WIDTH, count);
+		report(name, batched, (double)count);
+		printf("%-44s %14.2fx\n", "  speedup", perVertex / batched);
+	}
+}
+
+/*
+* Writes a UV sphere with roughly the requested number of triangles as an OBJ file, using quads so
+* the loader's fan triangulation is exercised too. Returns the file size in bytes.
+*/
+static size_t writeSphereObj(const std::string& filename, size_t triangles) {
+	// A rings x segments grid of quads gives 2 * rings * segments triangles
+	size_t segments = static_cast<size_t>(sqrt(triangles / 2.0)) + 3;
+	size_t rings = triangles / (2 * segments) + 2;
+	FILE* f = fopen(filename.c_str(), "wb");
+	if (!f)
+		return 0;
+	for (size_t r = 0; r <= rings; r++) {
+		float theta = 3.14159265f * r / rings;
+		for (size_t s = 0; s < segments; s++) {
+			float phi = 2.0f * 3.14159265f * s / segments;
+			fprintf(f, "v %f %f %f\n", sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi));
+		}
+	}
+	for (size_t r = 0; r < rings; r++) {
+		for (size_t s = 0; s < segments; s++) {
+			size_t a = r * segments + s + 1;
+			size_t b = r * segments + (s + 1) % segments + 1;
+			fprintf(f, "f %zu %zu %zu %zu\n", a, b, b + segments, a + segments);
+		}
+	}
+	long size = ftell(f);
+	fclose(f);
+	return static_cast<size_t>(size);
+}
+
+// The loader Mesh::loadFromObjectFile used before the mapped parser, an istringstream per line
+static bool legacyLoadObj(const std::string& filename, Mesh& mesh) {
+	std::ifstream f(filename);
+	if (!f.is_open())
+		return false;
+	std::string line;
+	while (std::getline(f, line)) {
+		std::istringstream s(line);
+		char junk;
+		if (line[0] == 'v') {
+			vec3 v;
+			s >> junk >> v.x >> v.y >> v.z;
+			mesh.positions.push_back(v);
+		}
+		else if (line[0] == 'f') {
+			int f[3];
+			s >> junk >> f[0] >> f[1] >> f[2];
+			mesh.indices.push_back(f[0] - 1);
+			mesh.indices.push_back(f[1] - 1);
+			mesh.indices.push_back(f[2] - 1);
+		}
+	}
+	return true;
+}
+
+static void benchObjLoad() {
+	if (!selected("objload"))
+		return;
+	for (size_t triangles : { size_t(10000), size_t(1000000) }) {
+		std::string filename = "bench_sphere_" + std::to_string(triangles) + ".obj";
+		size_t bytes = writeSphereObj(filename, triangles);
+		if (bytes == 0) {
+			printf("could not write %s\n", filename.c_str());
+			continue;
+		}
+
+		double legacy = timeBest(3, [&]() {
+			Mesh m;
+			legacyLoadObj(filename, m);
+			doNotOptimize(m.positions.x.back());
+		});
+		double single = timeBest(3, [&]() {
+			ObjData d;
+			parseObjFile(filename, d, 1);
+			doNotOptimize(d.positions.x.back());
+		});
+		double threaded = timeBest(3, [&]() {
+			ObjData d;
+			parseObjFile(filename, d);
+			doNotOptimize(d.positions.x.back());
+		});
+
+		const char* names[] = { "legacy", "mapped_1_thread", "mapped_all_threads" };
+		double times[] = { legacy, single, threaded };
+		for (int i = 0; i < 3; i++) {
+			char name[64];
+			snprintf(name, sizeof(name), "objload/%s/%zu", names[i], triangles);
+			report(name, times[i], (double)triangles, (double)bytes);
+		}
+		remove(filename.c_str());
+	}
+}
+
+// Same shape as a console CHAR_INFO cell, so the fill writes the same number of bytes as console::fillTriangle
+struct Cell
+{
+	char16_t glyph;
+	unsigned short attributes;
+};
+
+static void benchFillTriangle() {
+	if (!selected("fill_triangle"))
+		return;
+	const int width = 960, height = 520;
+	std::vector<Cell> screen(width * height);
+	std::vector<float> depth(width * height);
+
+	for (float size : { 4.0f, 16.0f, 64.0f, 256.0f }) {
+		// Random triangles with legs of roughly size cells, at random depths so some fail the depth test
+		const size_t count = 4096;
+		std::mt19937 rng(42);
+		std::uniform_real_distribution<float> px(0.0f, width - size), py(0.0f, height - size), pd(0.0f, size), pz(0.0f, 1.0f);
+		std::vector<float> tris(count * 9);
+		for (size_t i = 0; i < count; i++) {
+			float x = px(rng), y = py(rng), z = pz(rng);
+			float* t = &tris[i * 9];
+			t[0] = x;			t[1] = x + pd(rng);	t[2] = x + pd(rng);
+			t[3] = y + pd(rng);	t[4] = y;			t[5] = y + pd(rng);
+			t[6] = z;			t[7] = z;			t[8] = z;
+		}
+
+		long long plotted = 0;
+		double ns = timeBest(5, [&]() {
+			std::fill(depth.begin(), depth.end(), FLT_MAX);
+			plotted = 0;
+			Cell* cells = screen.data();
+			for (size_t i = 0; i < count; i++) {
+				const float* t = &tris[i * 9];
+				plotted += raster::fillTriangle(t, t + 3, t + 6, 0, 0, width, height, depth.data(), width,
+					[cells, width](int x, int y) {
+						cells[y * width + x].glyph = 0x2588;
+						cells[y * width + x].attributes = 0x000F;
+					});
+			}
+			doNotOptimize(plotted);
+		});
+		char name[64];
+		snprintf(name, sizeof(name), "fill_triangle/960x520/size_%d", (int)size);
+		report(name, ns, (double)count);
+		printf("%-44s %14.1f Mtris/s %8.1f cells drawn/tri\n", "", count / ns * 1e3, plotted / (double)count);
+	}
+}
+
+// A UV sphere of radius 1 built directly in memory, roughly the requested number of triangles
+static Mesh makeSphereMesh(size_t triangles) {
+	size_t segments = static_cast<size_t>(sqrt(triangles / 2.0)) + 3;
+	size_t rings = triangles / (2 * segments) + 2;
+	Mesh mesh;
+	for (size_t r = 0; r <= rings; r++) {
+		float theta = 3.14159265f * r / rings;
+		for (size_t s = 0; s < segments; s++) {
+			float phi = 2.0f * 3.14159265f * s / segments;
+			mesh.positions.push_back({ sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi) });
+		}
+	}
+	for (size_t r = 0; r < rings; r++) {
+		for (size_t s = 0; s < segments; s++) {
+			uint32_t a = static_cast<uint32_t>(r * segments + s);
+			uint32_t b = static_cast<uint32_t>(r * segments + (s + 1) % segments);
+			uint32_t c = b + static_cast<uint32_t>(segments);
+			uint32_t d = a + static_cast<uint32_t>(segments);
+			mesh.indices.insert(mesh.indices.end(), { a, b, c, a, c, d });
+		}
+	}
+	mesh.updateNormals();
+	return mesh;
+}
+
+// Runs a mesh through the transform and clip stages the way MainGame does, with the camera at cameraPos
+static std::vector<ScreenTriangle> projectMesh(const Mesh& mesh, const vec3& cameraPos, float width, float height) {
+	vec3 target = { 0.0f, 0.0f, 0.0f };
+	vec3 forward = vec3_sub(target, cameraPos);
+	normalize(forward);
+	vec3 worldUp = { 0.0f, 1.0f, 0.0f };
+	vec3 right = cross_product(worldUp, forward);
+	normalize(right);
+	vec3 up = cross_product(forward, right);
+
+	mat4x4 matWorld, matView, matProj;
+	matWorld.initTranslationMatrix(0.0f, 0.0f, 0.0f);
+	matView.initViewMatrix(cameraPos, forward, up, right);
+	matProj.initProjectionMatrix(0.1f, 1000.0f, 90.0f, height / width);
+
+	VertexStream worldNormals, screen;
+	std::vector<float> planeOffsets;
+	std::vector<uint32_t> visible;
+	ClipSpaceStream clip;
+	ClipStats stats;
+	std::vector<ScreenTriangle> triangles;
+	transformNormals(matWorld, mesh.normals, worldNormals);
+	computePlaneOffsets(matWorld, mesh, worldNormals, planeOffsets);
+	cullBackfaces(worldNormals, planeOffsets, cameraPos, visible, stats);
+	transformVertices(matProj * matView * matWorld, mesh.positions, clip, screen, width, height);
+	clipTriangles(mesh, visible, clip, screen, width, height, triangles, stats);
+	return triangles;
+}
+
+static void benchTileRaster() {
+	if (!selected("tile_raster"))
+		return;
+	const int width = 960, height = 520;
+	Mesh mesh = makeSphereMesh(2000000);
+	// Close enough that the sphere covers most of the screen
+	std::vector<ScreenTriangle> triangles = projectMesh(mesh, { 0.0f, 0.0f, 1.6f }, (float)width, (float)height);
+
+	TileRenderer tiles(width, height);
+	std::vector<Cell> reference(width * height), screen(width * height);
+	std::vector<float> depth(width * height);
+
+	// The serial render every threaded run has to reproduce exactly
+	std::fill(depth.begin(), depth.end(), FLT_MAX);
+	tiles.bin(triangles);
+	Cell* ref = reference.data();
+	tiles.rasterizeSerial(triangles, depth.data(), [ref, width](int x, int y, uint32_t i) {
+		ref[y * width + x] = { 0x2588, static_cast<unsigned short>(i & 0xFFFF) };
+	});
+
+	printf("tile_raster/%zu triangles after clipping\n", triangles.size());
+	for (unsigned int threads : { 1u, 2u, 4u, 8u, 16u }) {
+		ThreadPool pool(threads);
+		Cell* cells = screen.data();
+		double ns = timeBest(5, [&]() {
+			std::fill(depth.begin(), depth.end(), FLT_MAX);
+			tiles.bin(triangles);
+			tiles.rasterize(triangles, depth.data(), pool, [cells, width](int x, int y, uint32_t i) {
+				cells[y * width + x] = { 0x2588, static_cast<unsigned short>(i & 0xFFFF) };
+			});
+		});
+		bool identical = memcmp(reference.data(), screen.data(), reference.size() * sizeof(Cell)) == 0;
+		char name[64];
+		snprintf(name, sizeof(name), "tile_raster/threads_%u", threads);
+		report(name, ns, (double)triangles.size(), (double)(reference.size() * sizeof(Cell)));
+		printf("%-44s %s\n", "", identical ? "identical to serial" : "MISMATCH with serial");
+	}
+}
+
+// Encoding cost and output size of the ANSI terminal backend for frames that change by different amounts
+static void benchAnsiPresent() {
+	if (!selected("ansi_present"))
+		return;
+	const int width = 240, height = 80;
+	const size_t cells = static_cast<size_t>(width) * height;
+	std::vector<CHAR_INFO> frames[2] = { std::vector<CHAR_INFO>(cells), std::vector<CHAR_INFO>(cells) };
+	for (CHAR_INFO& c : frames[0]) {
+		c.Char.UnicodeChar = ' ';
+		c.Attributes = 0x000F;
+	}
+
+	for (double fraction : { 0.0, 0.01, 0.1, 1.0 }) {
+		// The second frame differs from the first in about fraction of its cells, presenting the two in turn
+		// changes that many cells every frame
+		std::mt19937 rng(42);
+		std::uniform_real_distribution<double> pick(0.0, 1.0);
+		frames[1] = frames[0];
+		for (CHAR_INFO& c : frames[1]) {
+			if (pick(rng) < fraction) {
+				c.Char.UnicodeChar = 0x2588;
+				c.Attributes = static_cast<WORD>(rng() & 0xFF);
+			}
+		}
+
+		AnsiTerminal terminal;
+		terminal.encode(frames[0].data(), width, height);
+		int frame = 1;
+		size_t bytes = 0;
+		double ns = timeBest(20, [&]() {
+			bytes = terminal.encode(frames[frame].data(), width, height);
+			frame ^= 1;
+		});
+		char name[64];
+		snprintf(name, sizeof(name), "ansi_present/240x80/changed_%g%%", fraction * 100.0);
+		report(name, ns, (double)cells);
+		printf("%-44s %14zu bytes/frame %8u cells changed\n", "", bytes, terminal.lastStats().changedCells);
+	}
+}
+
+// vec3 helpers over a batch of packed vectors, the way the pre-SoA code called them one at a time
+static void benchVectorMath() {
+	if (!selected("vec3"))
+		return;
+	const size_t count = 4096;
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> dist(-10.0f, 10.0f);
+	std::vector<vec3> a(count), b(count), out(count);
+	for (size_t i = 0; i < count; i++) {
+		a[i] = { dist(rng), dist(rng), dist(rng) };
+		b[i] = { dist(rng), dist(rng), dist(rng) };
+	}
+	const double bytes = 3.0 * count * sizeof(vec3);
+
+	double ns = timeBest(50, [&]() {
+		for (size_t i = 0; i < count; i++)
+			out[i] = vec3_add(a[i], b[i]);
+		doNotOptimize(out[count - 1]);
+	});
+	report("vec3/add", ns, (double)count, bytes);
+	ns = timeBest(50, [&]() {
+		for (size_t i = 0; i < count; i++)
+			out[i] = vec3_sub(a[i], b[i]);
+		doNotOptimize(out[count - 1]);
+	});
+	report("vec3/sub", ns, (double)count, bytes);
+	ns = timeBest(50, [&]() {
+		for (size_t i = 0; i < count; i++)
+			out[i] = vec3_mul(a[i], 0.5f);
+		doNotOptimize(out[count - 1]);
+	});
+	report("vec3/mul", ns, (double)count, 2.0 * count * sizeof(vec3));
+	ns = timeBest(50, [&]() {
+		float sum = 0.0f;
+		for (size_t i = 0; i < count; i++)
+			sum += dot_product(a[i], b[i]);
+		doNotOptimize(sum);
+	});
+	report("vec3/dot_product", ns, (double)count, 2.0 * count * sizeof(vec3));
+	ns = timeBest(50, [&]() {
+		for (size_t i = 0; i < count; i++)
+			out[i] = cross_product(a[i], b[i]);
+		doNotOptimize(out[count - 1]);
+	});
+	report("vec3/cross_product", ns, (double)count, bytes);
+	ns = timeBest(50, [&]() {
+		for (size_t i = 0; i < count; i++) {
+			out[i] = a[i];
+			normalize(out[i]);
+		}
+		doNotOptimize(out[count - 1]);
+	});
+	report("vec3/normalize", ns, (double)count, 2.0 * count * sizeof(vec3));
+
+	// The same through vec4, one SSE register per vector
+	std::vector<vec4> a4(count), b4(count), out4(count);
+	for (size_t i = 0; i < count; i++) {
+		a4[i] = vec4(a[i], 0.0f);
+		b4[i] = vec4(b[i], 0.0f);
+	}
+	ns = timeBest(50, [&]() {
+		for (size_t i = 0; i < count; i++)
+			out4[i] = vec4_add(a4[i], b4[i]);
+		doNotOptimize(out4[count - 1]);
+	});
+	report("vec4/add", ns, (double)count, 3.0 * count * sizeof(vec4));
+	ns = timeBest(50, [&]() {
+		float sum = 0.0f;
+		for (size_t i = 0; i < count; i++)
+			sum += dot_product(a4[i], b4[i]);
+		doNotOptimize(sum);
+	});
+	report("vec4/dot_product", ns, (double)count, 2.0 * count * sizeof(vec4));
+	ns = timeBest(50, [&]() {
+		for (size_t i = 0; i < count; i++)
+			out4[i] = cross_product(a4[i], b4[i]);
+		doNotOptimize(out4[count - 1]);
+	});
+	report("vec4/cross_product", ns, (double)count, 3.0 * count * sizeof(vec4));
+	ns = timeBest(50, [&]() {
+		for (size_t i = 0; i < count; i++) {
+			out4[i] = a4[i];
+			normalize(out4[i]);
+		}
+		doNotOptimize(out4[count - 1]);
+	});
+	report("vec4/normalize", ns, (double)count, 2.0 * count * sizeof(vec4));
+
+	// A whole SoA stream at once, SIMD_WIDTH vectors per reciprocal square root
+	VertexStream stream, normalized;
+	for (size_t i = 0; i < count; i++)
+		stream.push_back(a[i]);
+	ns = timeBest(50, [&]() {
+		normalized = stream;
+		normalizeVectors(normalized);
+		doNotOptimize(normalized.x[count - 1]);
+	});
+	report("vec3/normalize_batched", ns, (double)count, 2.0 * count * sizeof(vec3));
+}
+
+static void benchMatrix() {
+	if (!selected("mat4x4"))
+		return;
+	const size_t count = 4096;
+	mat4x4 matView, matProj;
+	makeMatrices(matView, matProj);
+	std::vector<mat4x4> lhs(count, matProj), rhs(count, matView), out(count);
+
+	double ns = timeBest(20, [&]() {
+		for (size_t i = 0; i < count; i++)
+			out[i] = lhs[i] * rhs[i];
+		doNotOptimize(out[count - 1].m[3][3]);
+	});
+	report("mat4x4/multiply", ns, (double)count, 3.0 * count * sizeof(mat4x4));
+
+	std::vector<vec3> in(count), res(count);
+	std::mt19937 rng(3);
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+	for (vec3& v : in)
+		v = { dist(rng), dist(rng), dist(rng) };
+	ns = timeBest(50, [&]() {
+		for (size_t i = 0; i < count; i++)
+			matProj.matrixMultiplyVector(in[i], res[i]);
+		doNotOptimize(res[count - 1]);
+	});
+	report("mat4x4/multiply_vector", ns, (double)count, 2.0 * count * sizeof(vec3));
+}
+
+static void benchComputeNormal() {
+	if (!selected("triangle"))
+		return;
+	const size_t count = 4096;
+	std::mt19937 rng(5);
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+	std::vector<Triangle> triangles(count);
+	for (Triangle& t : triangles) {
+		for (vec3& p : t.p)
+			p = { dist(rng), dist(rng), dist(rng) };
+	}
+	double ns = timeBest(50, [&]() {
+		for (Triangle& t : triangles)
+			t.computeNormal();
+		doNotOptimize(triangles[count - 1].normal);
+	});
+	report("triangle/compute_normal", ns, (double)count, (double)(count * sizeof(Triangle)));
+}
+
+// Mesh::loadFromObjectFile end to end, parsing, normals and edges, then again from the cache it wrote
+static void benchMeshLoad(size_t maxTriangles) {
+	if (!selected("mesh_load"))
+		return;
+	for (size_t triangles : { size_t(1000), size_t(10000), size_t(100000), size_t(1000000), size_t(10000000) }) {
+		if (triangles > maxTriangles)
+			break;
+		std::string filename = "bench_mesh_" + std::to_string(triangles) + ".obj";
+		size_t bytes = writeSphereObj(filename, triangles);
+		if (bytes == 0) {
+			printf("could not write %s\n", filename.c_str());
+			continue;
+		}
+		// The big files take seconds per load, a couple of runs is plenty there
+		int repetitions = triangles >= 1000000 ? 2 : 5;
+		double parsed = timeBest(repetitions, [&]() {
+			Mesh m;
+			m.loadFromObjectFile(filename, false);
+			doNotOptimize(m.normals.x.back());
+		});
+		Mesh cached;
+		cached.loadFromObjectFile(filename);
+		double fromCache = timeBest(repetitions, [&]() {
+			Mesh m;
+			m.loadFromObjectFile(filename);
+			doNotOptimize(m.normals.x.back());
+		});
+		char name[64];
+		snprintf(name, sizeof(name), "mesh_load/obj/%zu", triangles);
+		report(name, parsed, (double)cached.triangleCount(), (double)bytes);
+		snprintf(name, sizeof(name), "mesh_load/cache/%zu", triangles);
+		report(name, fromCache, (double)cached.triangleCount(), (double)cached.memoryUsage());
+		remove(filename.c_str());
+		remove(meshCachePath(filename).c_str());
+	}
+}
+
+// The console's drawing primitives on a headless console, nothing is presented
+static void benchConsoleDraw() {
+	if (!selected("console"))
+		return;
+	const int width = 960, height = 520;
+	console screen(width, height, 1, 1, ConsoleTarget::Headless);
+	const double frameBytes = (double)width * height * sizeof(ConsoleCell);
+
+	double ns = timeBest(20, [&]() {
+		screen.fill(0, 0, width - 1, height - 1, PIXEL_SOLID, BG_BLACK);
+		doNotOptimize(screen.getBuffer()[0]);
+	});
+	report("console/fill/960x520", ns, (double)width * height, frameBytes);
+
+	const size_t count = 4096;
+	std::mt19937 rng(11);
+	// Half of the endpoints off screen so clipping is part of the cost
+	std::uniform_int_distribution<int> px(-width / 2, width + width / 2), py(-height / 2, height + height / 2);
+	std::vector<int> coords(count * 6);
+	for (int& c : coords)
+		c = (&c - coords.data()) % 2 == 0 ? px(rng) : py(rng);
+
+	ns = timeBest(20, [&]() {
+		for (size_t i = 0; i < count; i++) {
+			const int* c = &coords[i * 6];
+			screen.drawLine(c[0], c[1], c[2], c[3], PIXEL_SOLID, FG_WHITE);
+		}
+		doNotOptimize(screen.getBuffer()[0]);
+	});
+	report("console/draw_line", ns, (double)count);
+
+	ns = timeBest(20, [&]() {
+		for (size_t i = 0; i < count; i++) {
+			const int* c = &coords[i * 6];
+			screen.drawTriangle(c[0], c[1], c[2], c[3], c[4], c[5], PIXEL_SOLID, FG_WHITE);
+		}
+		doNotOptimize(screen.getBuffer()[0]);
+	});
+	report("console/draw_triangle", ns, (double)count);
+
+	// What present adds per frame to turn the cells into CHAR_INFO, and what a fill of CHAR_INFO cells costs
+	std::vector<CHAR_INFO> expanded;
+	ns = timeBest(20, [&]() {
+		screen.copyBuffer(expanded);
+		doNotOptimize(expanded[0]);
+	});
+	report("console/expand/960x520", ns, (double)width * height, (double)width * height * (sizeof(ConsoleCell) + sizeof(CHAR_INFO)));
+	Framebuffer<WideCell> wide(width, height);
+	ns = timeBest(20, [&]() {
+		wide.fill(0, 0, width - 1, height - 1, WideCell::make(PIXEL_SOLID, BG_BLACK));
+		doNotOptimize(wide.data()[0]);
+	});
+	report("console/fill_wide/960x520", ns, (double)width * height, (double)wide.bytes());
+
+	// Solid triangles covering most of the screen, at one sample per cell and supersampled, and what the resolve adds
+	ThreadPool pool;
+	std::vector<ScreenTriangle> triangles = projectMesh(makeSphereMesh(100000), { 0.0f, 0.0f, 1.6f }, (float)width, (float)height);
+	ns = timeBest(20, [&]() {
+		screen.clearDepth();
+		screen.fillTriangles(triangles, pool);
+		doNotOptimize(screen.getBuffer()[0]);
+	});
+	report("console/fill_triangles/960x520", ns, (double)triangles.size());
+	for (int factor : { 2, 4 }) {
+		screen.setSupersampling(factor);
+		double raster = timeBest(10, [&]() {
+			screen.clearDepth();
+			screen.fillTriangles(triangles, pool);
+		});
+		double resolved = timeBest(10, [&]() {
+			screen.clearDepth();
+			screen.fillTriangles(triangles, pool);
+			screen.resolveSamples();
+			doNotOptimize(screen.getBuffer()[0]);
+		});
+		char name[64];
+		snprintf(name, sizeof(name), "console/fill_triangles_%dx%d/960x520", factor, factor);
+		report(name, resolved, (double)triangles.size());
+		snprintf(name, sizeof(name), "console/resolve_%dx%d/960x520", factor, factor);
+		report(name, resolved - raster, (double)width * height, (double)width * height * factor * factor);
+		printf("%-44s resolve is %.0f%% of the supersampled frame\n", "", 100.0 * (resolved - raster) / resolved);
+	}
+	screen.setSupersampling(1);
+}
+
+// Rays from a sphere of radius 3 around the mesh towards random points near its centre, so most of them hit
+static std::vector<Ray> makeRays(const BVH& bvh, size_t count) {
+	vec3 lo = bvh.boundsMin(), hi = bvh.boundsMax();
+	vec3 centre = vec3_mul(vec3_add(lo, hi), 0.5f);
+	float radius = vec3_length(vec3_sub(hi, lo)) * 0.5f;
+	std::mt19937 rng(21);
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+	std::vector<Ray> rays(count);
+	for (Ray& ray : rays) {
+		vec3 dir = { dist(rng), dist(rng), dist(rng) };
+		normalize(dir);
+		vec3 target = { dist(rng) * radius * 0.25f, dist(rng) * radius * 0.25f, dist(rng) * radius * 0.25f };
+		ray.origin = vec3_add(centre, vec3_mul(dir, radius * 3.0f));
+		ray.direction = vec3_sub(vec3_add(centre, target), ray.origin);
+	}
+	return rays;
+}
+
+// Build time and closest and any hit rays per second for one mesh
+static void benchBVHMesh(const char* label, const Mesh& mesh, ThreadPool& pool) {
+	const double triangles = (double)mesh.triangleCount();
+	int repetitions = triangles >= 1000000 ? 2 : 5;
+	char name[64];
+	BVH bvh;
+	double ns = timeBest(repetitions, [&]() {
+		bvh.build(mesh);
+		doNotOptimize(bvh.nodeCount());
+	});
+	snprintf(name, sizeof(name), "bvh/build/%s", label);
+	report(name, ns, triangles);
+	ns = timeBest(repetitions, [&]() {
+		bvh.build(mesh, &pool);
+		doNotOptimize(bvh.nodeCount());
+	});
+	snprintf(name, sizeof(name), "bvh/build_threads_%u/%s", pool.size(), label);
+	report(name, ns, triangles);
+	ns = timeBest(repetitions, [&]() {
+		bvh.refit(mesh);
+		doNotOptimize(bvh.nodeCount());
+	});
+	snprintf(name, sizeof(name), "bvh/refit/%s", label);
+	report(name, ns, triangles);
+
+	const size_t count = 100000;
+	std::vector<Ray> rays = makeRays(bvh, count);
+	size_t hits = 0;
+	ns = timeBest(5, [&]() {
+		hits = 0;
+		RayHit hit;
+		for (const Ray& ray : rays)
+			hits += bvh.intersect(ray, hit);
+		doNotOptimize(hits);
+	});
+	snprintf(name, sizeof(name), "bvh/closest_hit/%s", label);
+	report(name, ns, (double)count);
+	size_t occluded = 0;
+	ns = timeBest(5, [&]() {
+		occluded = 0;
+		for (const Ray& ray : rays)
+			occluded += bvh.occluded(ray);
+		doNotOptimize(occluded);
+	});
+	snprintf(name, sizeof(name), "bvh/any_hit/%s", label);
+	report(name, ns, (double)count);
+	printf("%-44s %zu nodes, %.1f MB, %zu of %zu rays hit%s\n", "", bvh.nodeCount(), bvh.memoryUsage() / 1e6,
+		hits, count, hits == occluded ? "" : ", MISMATCH with any hit");
+}
+
+static void benchBVH(size_t maxTriangles) {
+	if (!selected("bvh"))
+		return;
+	ThreadPool pool;
+	Mesh teapot;
+	if (teapot.loadFromObjectFile("teapot.obj"))
+		benchBVHMesh("teapot", teapot, pool);
+	else
+		printf("bvh/teapot skipped, no teapot.obj in the working directory\n");
+
+	for (size_t triangles : { size_t(100000), size_t(1000000), size_t(4000000), size_t(10000000) }) {
+		if (triangles > maxTriangles)
+			break;
+		Mesh mesh = makeSphereMesh(triangles);
+		benchBVHMesh(std::to_string(triangles).c_str(), mesh, pool);
+		if (triangles == 100000) {
+			// What every query cost before, a scan over all the triangles
+			BVH bvh;
+			bvh.build(mesh);
+			const size_t count = 64;
+			std::vector<Ray> rays = makeRays(bvh, count);
+			size_t hits = 0;
+			double ns = timeBest(3, [&]() {
+				hits = 0;
+				for (const Ray& ray : rays) {
+					float best = ray.tMax;
+					for (size_t t = 0; t < mesh.triangleCount(); t++) {
+						vec3 a = mesh.positions.get(mesh.indices[t * 3]);
+						vec3 e1 = vec3_sub(mesh.positions.get(mesh.indices[t * 3 + 1]), a);
+						vec3 e2 = vec3_sub(mesh.positions.get(mesh.indices[t * 3 + 2]), a);
+						vec3 p = cross_product(ray.direction, e2);
+						float inv = 1.0f / dot_product(e1, p);
+						vec3 s = vec3_sub(ray.origin, a);
+						float u = dot_product(s, p) * inv;
+						vec3 q = cross_product(s, e1);
+						float v = dot_product(ray.direction, q) * inv;
+						float d = dot_product(e2, q) * inv;
+						if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && d >= ray.tMin && d < best)
+							best = d;
+					}
+					hits += best < ray.tMax;
+				}
+				doNotOptimize(hits);
+			});
+			report("bvh/linear_scan/100000", ns, (double)count);
+		}
+	}
+}
+
+// Cost per instance of a small prop drawn many times, all of it in view, against clipping a merged copy of it
+static void benchInstancing() {
+	if (!selected("instancing"))
+		return;
+	const float width = 960.0f, height = 520.0f;
+	Mesh prop = makeSphereMesh(1000);
+	mat4x4 matView, matProj;
+	makeMatrices(matView, matProj);
+	const mat4x4 viewProj = matProj * matView;
+	const vec3 cameraPos = { 0.0f, 0.0f, 3.0f };
+	std::vector<ScreenTriangle> out;
+	ClipStats stats;
+
+	for (size_t count : { size_t(1), size_t(100), size_t(1000), size_t(10000) }) {
+		// A square grid of small props in front of the camera, each turned differently
+		InstancedMesh instanced(prop);
+		size_t side = static_cast<size_t>(ceil(sqrt((double)count)));
+		for (size_t i = 0; i < count; i++) {
+			Instance instance;
+			instance.position = { ((float)(i % side) / side - 0.5f) * 4.0f, ((float)(i / side) / side - 0.5f) * 2.0f, -2.0f };
+			instance.scale = 1.0f / side;
+			instance.rotation = { 0.1f * i, 0.2f * i, 0.0f };
+			instanced.instances.push_back(instance);
+		}
+		double ns = timeBest(count >= 1000 ? 3 : 10, [&]() {
+			out.clear();
+			stats.reset();
+			instanced.clipTriangles(viewProj, cameraPos, width, height, out, stats);
+			doNotOptimize(out.size());
+		});
+		char name[64];
+		snprintf(name, sizeof(name), "instancing/clip/%zu", count);
+		report(name, ns, (double)count);
+		printf("%-44s %zu triangles out, %zu bytes of instances for %zu bytes of mesh\n", "", out.size(),
+			count * sizeof(Instance), prop.memoryUsage());
+	}
+
+	// The same 1000 props merged into one mesh, what drawing them used to take, for time and memory
+	const size_t count = 1000;
+	InstancedMesh layout(prop);
+	Mesh merged;
+	for (size_t i = 0; i < count; i++) {
+		Instance instance;
+		instance.position = { ((float)(i % 32) / 32 - 0.5f) * 4.0f, ((float)(i / 32) / 32 - 0.5f) * 2.0f, -2.0f };
+		instance.scale = 1.0f / 32;
+		instance.rotation = { 0.1f * i, 0.2f * i, 0.0f };
+		mat4x4 world = instance.worldMatrix();
+		uint32_t base = static_cast<uint32_t>(merged.positions.size());
+		for (size_t v = 0; v < prop.vertexCount(); v++) {
+			vec3 p = prop.positions.get(v), q;
+			world.matrixMultiplyVector(p, q);
+			merged.positions.push_back(q);
+		}
+		for (uint32_t index : prop.indices)
+			merged.indices.push_back(base + index);
+	}
+	merged.updateNormals();
+	mat4x4 identity;
+	identity.initTranslationMatrix(0.0f, 0.0f, 0.0f);
+	VertexStream worldNormals, screen;
+	std::vector<float> planeOffsets;
+	std::vector<uint32_t> visible;
+	ClipSpaceStream clip;
+	computePlaneOffsets(identity, merged, merged.normals, planeOffsets);
+	double ns = timeBest(3, [&]() {
+		out.clear();
+		stats.reset();
+		cullBackfaces(merged.normals, planeOffsets, cameraPos, visible, stats);
+		transformVertices(viewProj, merged.positions, clip, screen, width, height);
+		clipTriangles(merged, visible, clip, screen, width, height, out, stats);
+		doNotOptimize(out.size());
+	});
+	report("instancing/merged_mesh/1000", ns, (double)count);
+	printf("%-44s %zu triangles out, %zu bytes of mesh\n", "", out.size(), merged.memoryUsage());
+}
+
+// Simplifying a mesh at load, and what drawing each level of it costs per frame
+static void benchLod() {
+	if (!selected("lod"))
+		return;
+	const float width = 960.0f, height = 520.0f;
+	Mesh mesh = makeSphereMesh(100000);
+	const double triangles = (double)mesh.triangleCount();
+	for (float fraction : { 0.5f, 0.1f }) {
+		Mesh simplified;
+		double ns = timeBest(3, [&]() {
+			simplifyMesh(mesh, static_cast<size_t>(triangles * fraction), simplified);
+			doNotOptimize(simplified.triangleCount());
+		});
+		char name[64];
+		snprintf(name, sizeof(name), "lod/simplify_%d%%/100000", (int)(fraction * 100.0f + 0.5f));
+		report(name, ns, triangles);
+	}
+
+	LodMesh lods;
+	lods.build(mesh);
+	const vec3 cameraPos = { 0.0f, 0.0f, 3.0f };
+	for (size_t i = 0; i < lods.levelCount(); i++) {
+		const Mesh& level = lods.level(i);
+		size_t out = 0;
+		double ns = timeBest(5, [&]() {
+			out = projectMesh(level, cameraPos, width, height).size();
+			doNotOptimize(out);
+		});
+		char name[64];
+		snprintf(name, sizeof(name), "lod/project/level_%zu", i);
+		report(name, ns, 1.0);
+		printf("%-44s %zu triangles, %zu triangles out\n", "", level.triangleCount(), out);
+	}
+}
+
+static void benchLighting() {
+	if (!selected("lighting"))
+		return;
+	Lighting lighting;
+	lighting.directional.push_back({ { 0.5f, -1.0f, -0.7f }, 0.7f });
+	lighting.points.push_back({ { 2.0f, 1.0f, 3.0f }, 0.6f, 0.05f });
+	const mat4x4 world = mat4x4::identity();
+	const vec3 cameraPos = { 0.0f, 0.0f, 3.0f };
+	LightingStage stage;
+	for (size_t triangles : { size_t(100000), size_t(1000000) }) {
+		Mesh mesh = makeSphereMesh(triangles);
+		VertexStream worldNormals;
+		std::vector<float> planeOffsets;
+		std::vector<uint32_t> visible;
+		ClipStats stats;
+		transformNormals(world, mesh.normals, worldNormals);
+		computePlaneOffsets(world, mesh, worldNormals, planeOffsets);
+		cullBackfaces(worldNormals, planeOffsets, cameraPos, visible, stats);
+		stage.updateVertexNormals(mesh, worldNormals);
+
+		double flat = timeBest(5, [&]() {
+			stage.shadeFlat(lighting, world, mesh, worldNormals, visible);
+			doNotOptimize(stage.faceLight(visible[0]));
+		});
+		double gouraud = timeBest(5, [&]() {
+			stage.shadeVertices(lighting, world, mesh, visible);
+			doNotOptimize(stage.vertexLight()[0]);
+		});
+		char name[64];
+		snprintf(name, sizeof(name), "lighting/flat/%zu", triangles);
+		report(name, flat, (double)visible.size());
+		snprintf(name, sizeof(name), "lighting/gouraud/%zu", triangles);
+		report(name, gouraud, (double)visible.size());
+		printf("%-44s %zu of %zu triangles visible\n", "", visible.size(), mesh.triangleCount());
+	}
+
+	// The lit rasterizer next to the plain one, the corners at random levels so every pixel interpolates
+	const int width = 960, height = 520;
+	console screen(width, height, 1, 1, ConsoleTarget::Headless);
+	ThreadPool pool;
+	std::vector<ScreenTriangle> triangles = projectMesh(makeSphereMesh(100000), cameraPos, (float)width, (float)height);
+	std::mt19937 rng(5);
+	std::uniform_real_distribution<float> level(0.0f, 1.0f);
+	for (ScreenTriangle& t : triangles) {
+		for (float& s : t.shade)
+			s = level(rng);
+	}
+	LightRamp<ConsoleCell> ramp;
+	ramp.build(FG_WHITE);
+	double ns = timeBest(20, [&]() {
+		screen.clearDepth();
+		screen.fillTriangles(triangles, pool);
+		doNotOptimize(screen.getBuffer()[0]);
+	});
+	report("lighting/raster_unlit/960x520", ns, (double)triangles.size());
+	for (bool dither : { false, true }) {
+		ns = timeBest(20, [&]() {
+			screen.clearDepth();
+			screen.fillTrianglesLit(triangles, pool, ramp, dither);
+			doNotOptimize(screen.getBuffer()[0]);
+		});
+		report(dither ? "lighting/raster_dithered/960x520" : "lighting/raster_lit/960x520", ns, (double)triangles.size());
+	}
+}
+
+static void benchAudioMix() {
+	if (!selected("audio"))
+		return;
+	// Clips of a few seconds of noise at 44100 Hz, long enough that no voice ends while being timed
+	const unsigned int rate = 44100, blockFrames = 512;
+	std::mt19937 rng(9);
+	std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+	std::vector<float> mono(rate * 4), stereo(rate * 8);
+	for (float& s : mono)
+		s = noise(rng);
+	for (float& s : stereo)
+		s = noise(rng);
+	for (unsigned int channels : { 1u, 2u }) {
+		for (unsigned int voices : { 64u, 256u, 1024u }) {
+			AudioMixer mixer;
+			for (unsigned int v = 0; v < voices; v++) {
+				AudioClip clip = { channels == 1 ? mono.data() : stereo.data(), rate * 4, channels };
+				mixer.play(clip, 1.0f / voices, true);
+			}
+			std::vector<float> block(blockFrames * channels);
+			std::vector<int16_t> pcm(block.size());
+			double ns = timeBest(20, [&]() {
+				mixer.mix(block.data(), blockFrames, channels);
+				clipToPcm16(block.data(), pcm.data(), pcm.size());
+				doNotOptimize(pcm[0]);
+			});
+			char name[64];
+			snprintf(name, sizeof(name), "audio/mix/%s/%u_voices", channels == 1 ? "mono" : "stereo", voices);
+			report(name, ns, (double)voices * blockFrames);
+			// A block lasts blockFrames / rate seconds of playback, the share of one core spent mixing it
+			printf("%-44s %.2f%% of one core\n", "", ns * 1e-9 / (blockFrames / (double)rate) * 100.0);
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	std::string jsonFile;
+	size_t maxTriangles = 1000000;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+			g_benchFilter = argv[++i];
+		}
+		else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+			jsonFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "--max-triangles") == 0 && i + 1 < argc) {
+			maxTriangles = static_cast<size_t>(strtoull(argv[++i], nullptr, 10));
+		}
+		else {
+			fprintf(stderr, "Unknown argument %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	benchVectorMath();
+	benchMatrix();
+	benchComputeNormal();
+	benchVertexTransform();
+	benchObjLoad();
+	benchMeshLoad(maxTriangles);
+	benchFillTriangle();
+	benchTileRaster();
+	benchConsoleDraw();
+	benchAnsiPresent();
+	benchBVH(maxTriangles);
+	benchInstancing();
+	benchLod();
+	benchLighting();
+	benchAudioMix();
+
+	if (!jsonFile.empty()) {
+#if defined(_MSC_VER)
+		std::string compiler = "\"msvc " + std::to_string(_MSC_VER) + "\"";
+#elif defined(__clang__)
+		std::string compiler = "\"clang " __clang_version__ "\"";
+#elif defined(__GNUC__)
+		std::string compiler = "\"gcc " __VERSION__ "\"";
+#else
+		std::string compiler = "\"unknown\"";
+#endif
+		std::vector<std::pair<std::string, std::string>> context = {
+			{ "compiler", compiler },
+			{ "simd_width", std::to_string(SIMD_WIDTH) },
+			{ "hardware_threads", std::to_string(std::thread::hardware_concurrency()) },
+		};
+		if (!writeResultsJson(jsonFile, context)) {
+			fprintf(stderr, "Could not write %s\n", jsonFile.c_str());
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -1,109 +1,418 @@
-// GameEngine.cpp : This file contains the 'main' function. Program execution begins and ends there.
+﻿// GameEngine.cpp : This file contains the 'main' function. Program execution begins and ends there.
 //
 
 #include "engine.h"
+#include "assets.h"
+#include "transform.h"
+#include "clipper.h"
+#include "instancing.h"
+#include "lighting.h"
+#include "lod.h"
+#include "profiler.h"
 #include <sstream>
 #include <chrono>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
 
 #define SCREEN_WIDTH 960.0f
 #define SCREEN_HEIGHT 520.0f
 
+#ifdef _WIN32
 #define DBOUT( s )            \
 {                             \
    std::wostringstream os_;    \
    os_ << s;                   \
    OutputDebugString( os_.str().c_str() );  \
 }
+#else
+#include <unistd.h>
+// The terminal shows the frame, so debug output goes to stderr, and only when stderr is redirected away from it
+// or --verbose asks for it. Text written to the terminal would land in the middle of a frame and move the cursor
+bool debugOutput = false;
+#define DBOUT( s )            \
+{                             \
+   if (debugOutput)            \
+      std::clog << s;          \
+}
+#endif
 
-std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
 const float radius = 20.0f;
 
-float getElapsedTime() {
-	auto now = std::chrono::high_resolution_clock::now();
-	std::chrono::duration<float> elapsed = now - startTime;  // Time elapsed in seconds
-	return elapsed.count();
-}
+// A mesh with the simplified copies of it, the one drawn depends on how much of the screen it covers
+struct Model
+{
+	Mesh mesh;
+	LodMesh lods;
+};
 
 class MainGame : public engine {
 private:
-	Mesh mesh;
+	// Models are parsed and simplified on the loader's threads, the first frames draw the placeholder meanwhile
+	AssetLoader loader;
+	AssetCache<Model> models = AssetCache<Model>(loader,
+		[](const std::string& path, Model& model) {
+			if (!model.mesh.loadFromObjectFile(path))
+				return false;
+			model.lods.build(model.mesh);
+			return true;
+		},
+		[](const Model& model) {
+			size_t bytes = model.mesh.memoryUsage();
+			for (size_t i = 1; i < model.lods.levelCount(); i++)
+				bytes += model.lods.level(i).memoryUsage();
+			return bytes;
+		});
+	Model placeholder;
+	AssetHandle<Model> teapot;
+	// What is drawn, the placeholder until the load callback switches it on the game thread together with
+	// worldChanged, so worldNormals and the lighting's vertex normals always belong to it. Never the handle's
+	// get(), which switches as soon as the worker finishes, frames before the callback has run
+	const Model* drawnModel = &placeholder;
+	size_t lodLevel = 0;
 	Cube cube = Cube(0, 0, 0, 1);
+	// Copies of the cube laid out as a floor under the mesh, drawn from one set of cube vertices
+	InstancedMesh props = InstancedMesh(cube);
+	// Post-transform cache, the clip space and screen space position of every unique vertex of the mesh
+	// Reused every frame so the transform never allocates
+	ClipSpaceStream clipSpace;
+	VertexStream projected;
+	// The projection never changes, so it is built once rather than with a tanf every frame
+	const mat4x4 matProj = mat4x4::perspective(0.1f, 1000.0f, 90.0f, SCREEN_HEIGHT / SCREEN_WIDTH);
+	// Model transform of the mesh, set through setWorldMatrix so we know when it moved
+	mat4x4 matWorld = mat4x4::identity();
+	// The drawn level's normals rotated into world space, only recomputed when the mesh moves, is edited or changes level
+	VertexStream worldNormals;
+	// The offset of every triangle's plane along its world normal, updated together with worldNormals
+	std::vector<float> planeOffsets;
+	bool worldChanged = true;
+	// Per frame output of the clip stage
+	std::vector<uint32_t> visible;
+	std::vector<ScreenTriangle> triangles;
+	std::vector<ScreenLine> lines;
+	// Scratch for clipEdges
+	std::vector<uint8_t> facing;
+	ClipStats clipStats;
+	// Solid, depth tested triangles instead of wireframe, toggled with F
+	bool filled = false;
+	bool fillKeyWasDown = false;
+	// Supersampling off, 2x2 or 4x4 in turn with G, see console::setSupersampling
+	bool sampleKeyWasDown = false;
+	// How filled triangles are lit, in turn with L, and whether the light levels are dithered, toggled with K
+	enum class Shading { Flat, Gouraud, Unlit };
+	Shading shading = Shading::Flat;
+	bool shadingKeyWasDown = false;
+	bool dither = true;
+	bool ditherKeyWasDown = false;
+	Lighting lighting;
+	LightingStage lightingStage;
+	// Light level to cell, in the colour the mesh used to be drawn in
+	LightRamp<ConsoleCell> ramp;
+	// Where the camera was before the last fixedUpdate, the frame is drawn between it and the current position
+	vec3 previousCameraPos;
+	bool movedLastStep = false;
 public:
-	MainGame() : engine(SCREEN_WIDTH, SCREEN_HEIGHT, 1, 1) {
-		DBOUT("Loading File");
-		if (!mesh.loadFromObjectFile("teapot.obj")) {
-			DBOUT("Failed to load object file" << std::endl);
+	MainGame(ConsoleTarget target = ConsoleTarget::Screen) : engine(SCREEN_WIDTH, SCREEN_HEIGHT, 1, 1, target) {
+		DBOUT("Loading File" << std::endl);
+		placeholder.mesh = Cube(-0.5f, -0.5f, -0.5f, 1.0f);
+		placeholder.lods.build(placeholder.mesh, {});
+		models.setPlaceholder(&placeholder);
+		teapot = models.load("teapot.obj", [this](const AssetHandle<Model>& model) {
+			if (model.failed()) {
+				DBOUT("Failed to load object file" << std::endl);
+				return;
+			}
+			// Another mesh, its normals have to be rotated into world space again
+			drawnModel = model.get();
+			lodLevel = 0;
+			worldChanged = true;
+			requestRedraw();
+		});
+		// A key light from above, left and in front of the teapot and a weaker point light to the right of the camera
+		lighting.ambient = 0.1f;
+		lighting.directional.push_back({ { 0.5f, -1.0f, -0.7f }, 0.7f });
+		lighting.points.push_back({ { 2.0f, 1.0f, 3.0f }, 0.6f, 0.05f });
+		ramp.build(FG_WHITE);
+		for (int z = -3; z <= 3; z++) {
+			for (int x = -3; x <= 3; x++) {
+				Instance tile;
+				tile.position = { x * 2.0f - 0.25f, -2.0f, z * 2.0f - 0.25f };
+				tile.scale = 0.5f;
+				tile.rotation = { 0.0f, 0.3f * (x + z), 0.0f };
+				props.instances.push_back(tile);
+			}
 		}
+		previousCameraPos = m_camera.m_pos;
+		// Nothing moves on its own, so only draw when the camera moves or the mode changes
+		m_scheduler.setTargetFrameRate(60.0);
+		m_scheduler.setIdleMode(true);
 	}
-	void updateFrame() override {
-		m_console.fill(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, PIXEL_SOLID, BG_BLACK);
+	// Block until the models have loaded, so headless runs draw the same frames every time
+	void waitForAssets() {
+		teapot.wait();
+	}
+	void setWorldMatrix(const mat4x4& m) {
+		matWorld = m;
+		worldChanged = true;
+		requestRedraw();
+	}
+	void fixedUpdate(float dt) override {
+		previousCameraPos = m_camera.m_pos;
+		models.update();
 
-		if (GetAsyncKeyState((unsigned short)'A') & 0x8000) {
-			m_camera.updateCameraLeft();
+		bool moved = false;
+		if (m_console.keyDown('A')) {
+			m_camera.updateCameraLeft(dt);
+			moved = true;
 		}
 
-		if (GetAsyncKeyState((unsigned short)'D') & 0x8000) {
-			m_camera.updateCameraRight();
+		if (m_console.keyDown('D')) {
+			m_camera.updateCameraRight(dt);
+			moved = true;
 		}
 
-		if (GetAsyncKeyState((unsigned short)'W') & 0x8000) {
-			m_camera.updateCameraForward();
+		if (m_console.keyDown('W')) {
+			m_camera.updateCameraForward(dt);
+			moved = true;
 		}
 
-		if (GetAsyncKeyState((unsigned short)'S') & 0x8000) {
-			m_camera.updateCameraBackward();
+		if (m_console.keyDown('S')) {
+			m_camera.updateCameraBackward(dt);
+			moved = true;
 		}
-		
-		// Print camera position to terminal
-		DBOUT("Camera Position: " << m_camera.m_pos.x << " " << m_camera.m_pos.y << " " << m_camera.m_pos.z << std::endl);
-		
-		mat4x4 matProj;
-		matProj.initProjectionMatrix(0.1f, 1000.0f, 90.0f, SCREEN_HEIGHT / SCREEN_WIDTH);
 
-		// Get elapsed time since start
-		float time = getElapsedTime();
+		// Only toggle on the step the key goes down, not every step it is held
+		bool fillKeyDown = m_console.keyDown('F');
+		if (fillKeyDown && !fillKeyWasDown) {
+			filled = !filled;
+			moved = true;
+		}
+		fillKeyWasDown = fillKeyDown;
+
+		bool sampleKeyDown = m_console.keyDown('G');
+		if (sampleKeyDown && !sampleKeyWasDown) {
+			int factor = m_console.supersampling();
+			m_console.setSupersampling(factor == 1 ? 2 : factor == 2 ? 4 : 1);
+			moved = true;
+		}
+		sampleKeyWasDown = sampleKeyDown;
 
-		deltaTime = time - lastFrame;
-		lastFrame = time;
+		bool shadingKeyDown = m_console.keyDown('L');
+		if (shadingKeyDown && !shadingKeyWasDown) {
+			shading = shading == Shading::Flat ? Shading::Gouraud : shading == Shading::Gouraud ? Shading::Unlit : Shading::Flat;
+			moved = true;
+		}
+		shadingKeyWasDown = shadingKeyDown;
 
-		mat4x4 matView;
-		matView.initViewMatrix(m_camera.m_pos, m_camera.m_forward, m_camera.m_up, m_camera.m_right);
+		bool ditherKeyDown = m_console.keyDown('K');
+		if (ditherKeyDown && !ditherKeyWasDown) {
+			dither = !dither;
+			moved = true;
+		}
+		ditherKeyWasDown = ditherKeyDown;
 
-		for (auto& tri : mesh.triangles) {
-			tri.computeNormal();
+		// Also draw the step after the camera stops, so the last frame shows where it stopped rather than in between
+		if (moved || movedLastStep) {
+			requestRedraw();
+		}
+		movedLastStep = moved;
+	}
+	void updateFrame() override {
+		{
+			PROFILE_ZONE("clear");
+			m_console.fill(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, PIXEL_SOLID, BG_BLACK);
+		}
 
-			// We need to hide the triangles which are away from the camera, this can be done by
-			// getting the dot product of the normal of the triangle and the vector from the camera to the triangle
-			// If the dot product is negative, then the triangle is facing towards the camera, else it is facing away
+		// Draw from between the last two simulated positions so the motion is smooth at any frame rate
+		camera view = m_camera;
+		view.m_pos = vec3_add(previousCameraPos, vec3_mul(vec3_sub(m_camera.m_pos, previousCameraPos), alpha));
+		view.updateCameraFields();
 
-			Triangle triProjected, triView;
+		const mat4x4 matView = mat4x4::view(view.m_pos, view.m_forward, view.m_up, view.m_right);
 
-			for (int i = 0; i < 3; i++) {
-				matView.matrixMultiplyVector(tri.p[i], triView.p[i]);
-			}
+		// A far away mesh covering a few cells is drawn from one of its simplified levels
+		const LodMesh& lods = drawnModel->lods;
+		size_t level = lods.select(lods.coveredCells(matWorld, view.m_pos, matProj.m[1][1], SCREEN_HEIGHT), lodLevel);
+		const bool levelChanged = level != lodLevel;
+		if (levelChanged) {
+			lodLevel = level;
+			worldChanged = true;
+		}
+		const Mesh& drawn = lods.level(lodLevel);
 
-			for (int i = 0; i < 3; i++) {
-				matProj.matrixMultiplyVector(triView.p[i], triProjected.p[i]);
+		// The normals were computed at load and loaded models are not edited,
+		// they only need rotating into world space when the mesh moved or another level is drawn
+		if (worldChanged) {
+			PROFILE_ZONE("normals");
+			transformNormals(matWorld, drawn.normals, worldNormals);
+			computePlaneOffsets(matWorld, drawn, worldNormals, planeOffsets);
+			lightingStage.updateVertexNormals(drawn, worldNormals);
+			worldChanged = false;
+		}
+
+		// We need to hide the triangles which are away from the camera, this can be done by
+		// getting the dot product of the normal of the triangle and the vector from the camera to the triangle
+		// If the dot product is negative, then the triangle is facing towards the camera, else it is facing away
+		// This is done before projection so back faces never reach the clipper
+		clipStats.reset();
+		{
+			PROFILE_ZONE("cull");
+			cullBackfaces(worldNormals, planeOffsets, view.m_pos, visible, clipStats);
+		}
+
+		// World, view and projection folded into one matrix so each vertex is multiplied once
+		mat4x4 matViewProj = matProj * matView;
+		mat4x4 matWorldViewProj = matViewProj * matWorld;
+		{
+			PROFILE_ZONE("transform");
+			transformVertices(matWorldViewProj, drawn.positions, clipSpace, projected, SCREEN_WIDTH, SCREEN_HEIGHT);
+		}
+
+		if (filled) {
+			// Light only what survived culling, per triangle for flat shading or per vertex for Gouraud
+			if (shading == Shading::Flat)
+				lightingStage.shadeFlat(lighting, matWorld, drawn, worldNormals, visible);
+			else if (shading == Shading::Gouraud)
+				lightingStage.shadeVertices(lighting, matWorld, drawn, visible);
+
+			// Assemble the front facing triangles from the post-transform cache, cutting the ones that cross the near plane
+			{
+				PROFILE_ZONE("clip");
+				triangles.clear();
+				clipTriangles(drawn, visible, clipSpace, projected, SCREEN_WIDTH, SCREEN_HEIGHT, triangles, clipStats,
+					shading == Shading::Gouraud ? lightingStage.vertexLight() : nullptr);
+				if (shading == Shading::Flat)
+					lightingStage.applyFlat(triangles, 0, triangles.size());
+				// The props are not lit, they keep the full level
+				props.clipTriangles(matViewProj, view.m_pos, SCREEN_WIDTH, SCREEN_HEIGHT, triangles, clipStats);
 			}
-	
-			// Scale into the view
-			for (int i = 0; i < 3; i++) {
-				// Normalize from [-1,1] to [0,2]
-				triProjected.p[i].x += 1.0f;
-				triProjected.p[i].y += 1.0f;
-				// Convert from [0,2] to [0,screenWidth] and [0,screenHeight]
-				triProjected.p[i].x *= 0.5f * SCREEN_WIDTH;
-				triProjected.p[i].y *= 0.5f * SCREEN_HEIGHT;
+			{
+				PROFILE_ZONE("clear");
+				m_console.clearDepth();
 			}
-			m_console.drawTriangle(triProjected.p[0].x, triProjected.p[0].y, triProjected.p[1].x, triProjected.p[1].y, triProjected.p[2].x, triProjected.p[2].y, PIXEL_SOLID, FG_WHITE);
+			PROFILE_ZONE("raster");
+			if (shading == Shading::Unlit)
+				m_console.fillTriangles(triangles, m_pool, PIXEL_SOLID, FG_WHITE);
+			else
+				m_console.fillTrianglesLit(triangles, m_pool, ramp, dither);
+			m_console.resolveSamples();
 		}
+		else {
+			// Wireframe, every edge of a front facing triangle once, an edge shared by two triangles is not drawn twice
+			{
+				PROFILE_ZONE("clip");
+				lines.clear();
+				clipEdges(drawn, visible, clipSpace, projected, SCREEN_WIDTH, SCREEN_HEIGHT, lines, clipStats, facing);
+				props.clipEdges(matViewProj, view.m_pos, SCREEN_WIDTH, SCREEN_HEIGHT, lines, clipStats);
+			}
+			PROFILE_ZONE("raster");
+			m_console.drawLines(lines, PIXEL_SOLID, FG_WHITE);
+			m_console.resolveSamples();
+		}
+
+		// Logged when the level changes rather than every frame
+		if (levelChanged)
+			DBOUT("Level: " << lodLevel << " triangles: " << clipStats.input << " backface culled: " << clipStats.backfaceCulled << " frustum culled: " << clipStats.frustumCulled
+			<< " clipped: " << clipStats.clipped << " emitted: " << clipStats.emitted << " lines: " << clipStats.lines << " props culled: " << props.culledInstances() << std::endl);
 	}
 };
 
-int main()
+/*
+* GameEngine [--fps <n>] [--no-idle] [--supersample <2|4>] [--verbose]
+*                                     opens the console and runs until closed, drawing at most n frames a second
+*                                     (60 by default, 0 for as fast as possible) and only when something changed
+*                                     unless --no-idle is given, --supersample starts with anti-aliased
+*                                     geometry (G cycles off, 2x2 and 4x4), debug output goes to stderr when
+*                                     it is redirected or with --verbose
+* GameEngine --headless <frames> [--supersample <2|4>] [--capture <frame,frame,...>] [--out <path>] [--profile <path>] [--verbose]
+*                                     renders frames into memory as fast as possible, prints the frame rate
+*                                     and the hash of every captured frame, and with --out saves them as
+*                                     <path>_<frame>.txt and <path>_<frame>.ppm
+*                                     --profile prints the frame and stage percentiles and saves the zones
+*                                     as <path>.csv and <path>.json (Chrome trace)
+*/
+int main(int argc, char** argv)
 {
+	int headlessFrames = 0;
+	std::vector<int> captureFrames;
+	std::string capturePath;
+	std::string profilePath;
+	bool verbose = false;
+	double fps = 60.0;
+	bool idle = true;
+	int supersample = 1;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc) {
+			headlessFrames = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+			for (const char* p = argv[++i]; *p; ) {
+				char* end;
+				captureFrames.push_back(static_cast<int>(strtol(p, &end, 10)));
+				p = *end == ',' ? end + 1 : end + strlen(end);
+			}
+		}
+		else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+			capturePath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+			profilePath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+			fps = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--supersample") == 0 && i + 1 < argc) {
+			supersample = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--no-idle") == 0) {
+			idle = false;
+		}
+		else if (strcmp(argv[i], "--verbose") == 0) {
+			verbose = true;
+		}
+		else {
+			fprintf(stderr, "Unknown argument %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (headlessFrames > 0) {
+#ifndef _WIN32
+		debugOutput = verbose;
+#else
+		(void)verbose;
+#endif
+		MainGame game(ConsoleTarget::Headless);
+		game.waitForAssets();
+		game.m_console.setSupersampling(supersample);
+		engine::FrameRun run = game.runFrames(headlessFrames, captureFrames, capturePath);
+		printf("frames %d seconds %.6f fps %.1f\n", run.frames, run.seconds, run.seconds > 0.0 ? run.frames / run.seconds : 0.0);
+		for (const auto& capture : run.captures)
+			printf("frame %d hash %016llx\n", capture.first, static_cast<unsigned long long>(capture.second));
+		if (!profilePath.empty()) {
+			Profiler& profiler = Profiler::instance();
+			auto print = [](const char* name, const ProfileStats& s) {
+				printf("%-12s p50 %9.3f ms  p95 %9.3f ms  p99 %9.3f ms  max %9.3f ms\n", name, s.p50 * 1e-6, s.p95 * 1e-6, s.p99 * 1e-6, s.max * 1e-6);
+			};
+			print("frame", profiler.frameStats());
+			for (const std::string& name : profiler.zoneNames())
+				print(name.c_str(), profiler.zoneStats(name));
+			profiler.writeCSV(profilePath + ".csv");
+			profiler.writeChromeTrace(profilePath + ".json");
+		}
+		return 0;
+	}
+
+#ifndef _WIN32
+	debugOutput = verbose || !isatty(STDERR_FILENO);
+#endif
 	MainGame game;
+	game.m_console.setSupersampling(supersample);
+	game.m_scheduler.setTargetFrameRate(fps);
+	game.m_scheduler.setIdleMode(idle);
 	game.start();
 	return 0;
 }
@@ -0,0 +1,442 @@
+#include "ansiterminal.h"
+#include <chrono>
+#include <cstring>
+
+#include <csignal>
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Enter the alternate screen so the shell's scrollback is left alone, hide the cursor and clear
+const char enterSequence[] = "\x1b[?1049h\x1b[?25l\x1b[0m\x1b[2J";
+// Reset the colours, show the cursor and go back to the normal screen
+const char leaveSequence[] = "\x1b[0m\x1b[?25h\x1b[?1049l";
+
+// The longest cursor jump "\x1b[row;colH" and colour change "\x1b[bg;fgm" plus a 3 byte glyph, rounded up
+const size_t worstBytesPerCell = 32;
+// Gaps of unchanged cells longer than this are always skipped with a cursor move instead of being reprinted
+const int maxReprint = 8;
+
+int digits(int n) {
+	int d = 1;
+	while (n >= 10) {
+		n /= 10;
+		d++;
+	}
+	return d;
+}
+
+char* putNumber(char* out, int n) {
+	char tmp[12];
+	int len = 0;
+	do {
+		tmp[len++] = static_cast<char>('0' + n % 10);
+		n /= 10;
+	} while (n > 0);
+	while (len > 0)
+		*out++ = tmp[--len];
+	return out;
+}
+
+// Bytes of the UTF-8 encoding of the glyph, see putGlyph
+int glyphBytes(WCHAR c) {
+	if (c < 0x80)
+		return 1;
+	if (c < 0x800)
+		return 2;
+	return 3;
+}
+
+// Cells only hold one UTF-16 unit, an empty cell or a control character is drawn as a space and
+// a lone surrogate as a question mark
+char* putGlyph(char* out, WCHAR c) {
+	if (c < 0x20 || c == 0x7F) {
+		*out++ = ' ';
+	}
+	else if (c < 0x80) {
+		*out++ = static_cast<char>(c);
+	}
+	else if (c < 0x800) {
+		*out++ = static_cast<char>(0xC0 | (c >> 6));
+		*out++ = static_cast<char>(0x80 | (c & 0x3F));
+	}
+	else if (c >= 0xD800 && c <= 0xDFFF) {
+		*out++ = '?';
+	}
+	else {
+		*out++ = static_cast<char>(0xE0 | (c >> 12));
+		*out++ = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+		*out++ = static_cast<char>(0x80 | (c & 0x3F));
+	}
+	return out;
+}
+
+// Console colours are blue, green, red, intensity from bit 0 up, ANSI orders them red, green, blue
+int ansiColour(int consoleColour) {
+	return ((consoleColour & 1) << 2) | (consoleColour & 2) | ((consoleColour & 4) >> 2);
+}
+
+int foregroundCode(int attributes) {
+	int c = attributes & 0xF;
+	return (c & 8 ? 90 : 30) + ansiColour(c);
+}
+
+int backgroundCode(int attributes) {
+	int c = (attributes >> 4) & 0xF;
+	return (c & 8 ? 100 : 40) + ansiColour(c);
+}
+
+bool sameCell(const CHAR_INFO& a, const CHAR_INFO& b) {
+	return a.Char.UnicodeChar == b.Char.UnicodeChar && a.Attributes == b.Attributes;
+}
+
+/*
+* What it takes to give the terminal back when close never runs: the process is ended by Ctrl-C or SIGTERM, or
+* exits without destroying the engine. Copied from the terminal that is open, there is only ever one.
+* restoreTerminal runs inside a signal handler, so it only uses async signal safe calls.
+*/
+volatile sig_atomic_t restorePending = 0;
+#ifdef _WIN32
+DWORD restoreMode = 0;
+bool restoreModeChanged = false;
+#else
+termios restoreTermios = {};
+bool restoreRawInput = false;
+struct sigaction previousInterrupt;
+struct sigaction previousTerminate;
+bool handlersInstalled = false;
+#endif
+
+void restoreTerminal() {
+	if (!restorePending)
+		return;
+	restorePending = 0;
+#ifdef _WIN32
+	DWORD written = 0;
+	WriteFile(GetStdHandle(STD_OUTPUT_HANDLE), leaveSequence, sizeof(leaveSequence) - 1, &written, nullptr);
+	if (restoreModeChanged)
+		SetConsoleMode(GetStdHandle(STD_OUTPUT_HANDLE), restoreMode);
+#else
+	ssize_t written = ::write(STDOUT_FILENO, leaveSequence, sizeof(leaveSequence) - 1);
+	(void)written;
+	if (restoreRawInput)
+		tcsetattr(STDIN_FILENO, TCSANOW, &restoreTermios);
+#endif
+}
+
+#ifdef _WIN32
+// Runs on its own thread, returning FALSE lets the default handler end the process afterwards
+BOOL WINAPI onConsoleControl(DWORD) {
+	restoreTerminal();
+	return FALSE;
+}
+#else
+void onTerminate(int signal) {
+	restoreTerminal();
+	// Then whatever the signal would have done without us, usually ending the process
+	sigaction(signal, signal == SIGINT ? &previousInterrupt : &previousTerminate, nullptr);
+	raise(signal);
+}
+#endif
+
+// Set up once per process, the hooks do nothing while no terminal is open
+void installRestoreHooks() {
+	static bool installed = false;
+	if (installed)
+		return;
+	installed = true;
+	std::atexit(restoreTerminal);
+#ifdef _WIN32
+	SetConsoleCtrlHandler(onConsoleControl, TRUE);
+#endif
+}
+
+#ifndef _WIN32
+// Catch SIGINT and SIGTERM while a terminal is open, unless the program ignores them
+void installSignalHandlers() {
+	if (handlersInstalled)
+		return;
+	struct sigaction action = {};
+	action.sa_handler = onTerminate;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, nullptr, &previousInterrupt);
+	sigaction(SIGTERM, nullptr, &previousTerminate);
+	if (previousInterrupt.sa_handler != SIG_IGN)
+		sigaction(SIGINT, &action, nullptr);
+	if (previousTerminate.sa_handler != SIG_IGN)
+		sigaction(SIGTERM, &action, nullptr);
+	handlersInstalled = true;
+}
+
+void removeSignalHandlers() {
+	if (!handlersInstalled)
+		return;
+	sigaction(SIGINT, &previousInterrupt, nullptr);
+	sigaction(SIGTERM, &previousTerminate, nullptr);
+	handlersInstalled = false;
+}
+#endif
+
+}
+
+bool AnsiTerminal::open(int width, int height) {
+	close();
+	invalidate();
+	m_width = width;
+	m_height = height;
+	m_previous.assign(static_cast<size_t>(width) * height, CHAR_INFO());
+	m_out.resize(static_cast<size_t>(width) * height * worstBytesPerCell + sizeof(enterSequence) + sizeof(leaveSequence));
+	bool ok = true;
+
+#ifdef _WIN32
+	// The Windows 10 console understands the same escape sequences once this mode is switched on
+	HANDLE out = GetStdHandle(STD_OUTPUT_HANDLE);
+	if (GetConsoleMode(out, &m_savedMode)) {
+		m_modeChanged = SetConsoleMode(out, m_savedMode | ENABLE_VIRTUAL_TERMINAL_PROCESSING) != 0;
+		ok = m_modeChanged;
+	}
+	else {
+		ok = false;
+	}
+#else
+	// Raw, non-blocking input so keys arrive one at a time without echo and reading never waits
+	if (isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &m_savedTermios) == 0) {
+		termios raw = m_savedTermios;
+		raw.c_lflag &= ~(ICANON | ECHO);
+		raw.c_cc[VMIN] = 0;
+		raw.c_cc[VTIME] = 0;
+		m_rawInput = tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0;
+	}
+	ok = isatty(STDOUT_FILENO) != 0;
+#endif
+
+	// Armed before the screen is switched, so from here on a kill cannot leave the shell on the alternate screen
+	installRestoreHooks();
+#ifdef _WIN32
+	restoreMode = m_savedMode;
+	restoreModeChanged = m_modeChanged;
+#else
+	restoreTermios = m_savedTermios;
+	restoreRawInput = m_rawInput;
+	installSignalHandlers();
+#endif
+	restorePending = 1;
+
+	writeAll(enterSequence, sizeof(enterSequence) - 1);
+	m_open = true;
+	return ok;
+}
+
+void AnsiTerminal::close() {
+	if (!m_open)
+		return;
+	writeAll(leaveSequence, sizeof(leaveSequence) - 1);
+#ifdef _WIN32
+	if (m_modeChanged)
+		SetConsoleMode(GetStdHandle(STD_OUTPUT_HANDLE), m_savedMode);
+	m_modeChanged = false;
+#else
+	if (m_rawInput)
+		tcsetattr(STDIN_FILENO, TCSANOW, &m_savedTermios);
+	m_rawInput = false;
+	removeSignalHandlers();
+#endif
+	restorePending = 0;
+	m_open = false;
+}
+
+void AnsiTerminal::invalidate() {
+	m_previousValid = false;
+	m_cursorRow = -1;
+	m_cursorCol = -1;
+	m_attributes = -1;
+}
+
+char* AnsiTerminal::moveCursor(char* out, const CHAR_INFO* row, int rowIndex, int col) {
+	if (rowIndex == m_cursorRow && col == m_cursorCol)
+		return out;
+
+	// An absolute jump always works, "\x1b[row;colH"
+	int best = 4 + digits(rowIndex + 1) + digits(col + 1);
+	enum { JUMP, FORWARD, REPRINT, NEWLINE } method = JUMP;
+	int gap = 0;
+	if (rowIndex == m_cursorRow && m_cursorCol >= 0 && col > m_cursorCol) {
+		gap = col - m_cursorCol;
+		// "\x1b[nC", the count can be left out when it is 1
+		int forward = gap == 1 ? 3 : 3 + digits(gap);
+		if (forward < best) {
+			best = forward;
+			method = FORWARD;
+		}
+		// Writing the unchanged cells again moves the cursor too, and is shorter for small gaps
+		// as long as they are in the colour that is already set
+		if (gap <= maxReprint) {
+			int reprint = 0;
+			for (int c = m_cursorCol; c < col && reprint >= 0; c++) {
+				if ((row[c].Attributes & 0xFF) != m_attributes)
+					reprint = -1;
+				else
+					reprint += glyphBytes(row[c].Char.UnicodeChar);
+			}
+			if (reprint >= 0 && reprint <= best) {
+				best = reprint;
+				method = REPRINT;
+			}
+		}
+	}
+	else if (col == 0 && rowIndex == m_cursorRow + 1 && m_cursorRow >= 0) {
+		// Carriage return and line feed, also fine when the cursor is waiting to wrap at the end of the row
+		best = 2;
+		method = NEWLINE;
+	}
+
+	switch (method) {
+	case FORWARD:
+		*out++ = '\x1b';
+		*out++ = '[';
+		if (gap > 1)
+			out = putNumber(out, gap);
+		*out++ = 'C';
+		break;
+	case REPRINT:
+		for (int c = m_cursorCol; c < col; c++)
+			out = putGlyph(out, row[c].Char.UnicodeChar);
+		break;
+	case NEWLINE:
+		*out++ = '\r';
+		*out++ = '\n';
+		break;
+	default:
+		*out++ = '\x1b';
+		*out++ = '[';
+		out = putNumber(out, rowIndex + 1);
+		*out++ = ';';
+		out = putNumber(out, col + 1);
+		*out++ = 'H';
+		break;
+	}
+	m_cursorRow = rowIndex;
+	m_cursorCol = col;
+	return out;
+}
+
+char* AnsiTerminal::setAttributes(char* out, WORD attributes) {
+	if (attributes == m_attributes)
+		return out;
+	bool foreground = m_attributes < 0 || ((attributes ^ m_attributes) & 0x0F) != 0;
+	bool background = m_attributes < 0 || ((attributes ^ m_attributes) & 0xF0) != 0;
+	*out++ = '\x1b';
+	*out++ = '[';
+	if (foreground)
+		out = putNumber(out, foregroundCode(attributes));
+	if (foreground && background)
+		*out++ = ';';
+	if (background)
+		out = putNumber(out, backgroundCode(attributes));
+	*out++ = 'm';
+	// Only the colour bits are sent, the others are ignored like the console does
+	m_attributes = attributes & 0xFF;
+	return out;
+}
+
+size_t AnsiTerminal::encode(const CHAR_INFO* cells, int width, int height) {
+	if (width != m_width || height != m_height || m_out.empty()) {
+		m_width = width;
+		m_height = height;
+		m_previous.assign(static_cast<size_t>(width) * height, CHAR_INFO());
+		m_out.resize(static_cast<size_t>(width) * height * worstBytesPerCell + sizeof(enterSequence) + sizeof(leaveSequence));
+		invalidate();
+	}
+
+	char* out = m_out.data();
+	uint32_t changed = 0;
+	for (int y = 0; y < height; y++) {
+		const CHAR_INFO* row = cells + static_cast<size_t>(y) * width;
+		CHAR_INFO* previous = m_previous.data() + static_cast<size_t>(y) * width;
+		// Most rows of a mostly static scene are untouched, skip those with one compare
+		if (m_previousValid && memcmp(row, previous, sizeof(CHAR_INFO) * width) == 0)
+			continue;
+		for (int x = 0; x < width; x++) {
+			if (m_previousValid && sameCell(row[x], previous[x]))
+				continue;
+			out = moveCursor(out, row, y, x);
+			out = setAttributes(out, row[x].Attributes & 0xFF);
+			out = putGlyph(out, row[x].Char.UnicodeChar);
+			// After the last column the cursor waits to wrap, only a jump or a new line moves it from there
+			m_cursorCol = x + 1;
+			previous[x] = row[x];
+			changed++;
+		}
+	}
+	m_previousValid = true;
+	m_stats.changedCells = changed;
+	m_stats.bytes = static_cast<size_t>(out - m_out.data());
+	return m_stats.bytes;
+}
+
+void AnsiTerminal::present(const CHAR_INFO* cells, int width, int height) {
+	auto start = std::chrono::steady_clock::now();
+	size_t size = encode(cells, width, height);
+	if (size > 0 && !writeAll(m_out.data(), size)) {
+		// The terminal may have shown part of the frame, draw all of it again next time
+		invalidate();
+	}
+	m_stats.nanoseconds = static_cast<uint64_t>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+bool AnsiTerminal::writeAll(const char* bytes, size_t size) {
+#ifdef _WIN32
+	HANDLE out = GetStdHandle(STD_OUTPUT_HANDLE);
+	while (size > 0) {
+		DWORD written = 0;
+		if (!WriteFile(out, bytes, static_cast<DWORD>(size), &written, nullptr) || written == 0)
+			return false;
+		bytes += written;
+		size -= written;
+	}
+#else
+	// One write for the whole frame, the loop only continues after a partial write or a signal
+	while (size > 0) {
+		ssize_t written = ::write(STDOUT_FILENO, bytes, size);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return false;
+		bytes += written;
+		size -= static_cast<size_t>(written);
+	}
+#endif
+	return true;
+}
+
+void AnsiTerminal::pollInput() {
+	memset(m_keys, 0, sizeof(m_keys));
+#ifndef _WIN32
+	if (!m_rawInput)
+		return;
+	unsigned char buffer[64];
+	ssize_t count;
+	while ((count = ::read(STDIN_FILENO, buffer, sizeof(buffer))) > 0) {
+		for (ssize_t i = 0; i < count; i++) {
+			unsigned char key = buffer[i];
+			if (key >= 'a' && key <= 'z')
+				key = static_cast<unsigned char>(key - 'a' + 'A');
+			m_keys[key] = true;
+		}
+	}
+#endif
+}
+
+bool AnsiTerminal::keyDown(int key) const {
+#ifdef _WIN32
+	return (GetAsyncKeyState(key) & 0x8000) != 0;
+#else
+	return key >= 0 && key < 256 && m_keys[key];
+#endif
+}
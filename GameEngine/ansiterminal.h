@@ -0,0 +1,108 @@
+#pragma once
+
+#include "platform.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#ifndef _WIN32
+#include <termios.h>
+#endif
+
+/*
+* Presents the console's cell buffer to a terminal with ANSI escape sequences.
+*
+* The terminal already shows the last frame, so only the cells that changed since then are sent. The last
+* presented frame is kept and compared cell by cell, a static scene produces no output at all.
+*
+* For every changed cell the encoder picks the cheapest way to get the cursor there: nothing if it is already
+* there after the previous cell, reprinting a short run of unchanged cells, a relative move to the right,
+* a new line, or an absolute jump. Colours are only sent when they differ from the colour of the cell
+* written before, and then only the half (foreground or background) that changed.
+*
+* The whole frame is encoded into one buffer allocated for the worst case up front and written to the
+* terminal with a single write call.
+*/
+
+// What presenting one frame cost
+struct PresentStats
+{
+	// Bytes written to the terminal
+	size_t bytes = 0;
+	// Cells that differed from the previous frame
+	uint32_t changedCells = 0;
+	// Time spent encoding and writing the frame
+	uint64_t nanoseconds = 0;
+};
+
+class AnsiTerminal
+{
+public:
+	AnsiTerminal() = default;
+	~AnsiTerminal() { close(); }
+	AnsiTerminal(const AnsiTerminal&) = delete;
+	AnsiTerminal& operator=(const AnsiTerminal&) = delete;
+
+	/*
+	* Take over the terminal for a width x height cell buffer: switch to the alternate screen, hide the cursor
+	* and, if the input is a terminal, put it in non-blocking raw mode so keys can be polled.
+	* Returns false if the terminal could not be set up, present still works but writes to whatever stdout is.
+	*/
+	bool open(int width, int height);
+	// Give the terminal back in the state open found it
+	void close();
+	bool isOpen() const { return m_open; }
+
+	/*
+	* Encode the escape sequences that turn the last presented frame into cells and remember cells as
+	* the presented frame. Nothing is written, the result is in data() and the return value is its size.
+	*/
+	size_t encode(const CHAR_INFO* cells, int width, int height);
+	const char* data() const { return m_out.data(); }
+
+	// Encode and write one frame
+	void present(const CHAR_INFO* cells, int width, int height);
+
+	// Forget the presented frame, the next present redraws every cell
+	void invalidate();
+
+	const PresentStats& lastStats() const { return m_stats; }
+
+	// Read the keys pressed since the last poll, call once per frame
+	void pollInput();
+	/*
+	* Whether key (an upper case letter or any other character) was pressed since the last poll.
+	* A terminal only reports key presses, holding a key down shows up as the terminal's key repeat.
+	*/
+	bool keyDown(int key) const;
+
+private:
+	// Append the cheapest cursor movement from the tracked cursor position to (col, row)
+	char* moveCursor(char* out, const CHAR_INFO* row, int rowIndex, int col);
+	// Append the colour change from the current attributes to attributes
+	char* setAttributes(char* out, WORD attributes);
+	bool writeAll(const char* bytes, size_t size);
+
+	int m_width = 0;
+	int m_height = 0;
+	// The frame the terminal is showing
+	std::vector<CHAR_INFO> m_previous;
+	bool m_previousValid = false;
+	// Where the terminal's cursor is and which attributes it writes with, -1 when unknown
+	int m_cursorRow = -1;
+	int m_cursorCol = -1;
+	int m_attributes = -1;
+	// Sized for the worst case so encoding never allocates
+	std::vector<char> m_out;
+	PresentStats m_stats;
+	bool m_open = false;
+	bool m_keys[256] = {};
+#ifdef _WIN32
+	// The console mode to restore on close
+	DWORD m_savedMode = 0;
+	bool m_modeChanged = false;
+#else
+	// The terminal settings to restore on close
+	termios m_savedTermios = {};
+	bool m_rawInput = false;
+#endif
+};
@@ -0,0 +1,50 @@
+#include "assets.h"
+
+AssetLoader::AssetLoader(unsigned int threads) {
+	if (threads == 0)
+		threads = 1;
+	for (unsigned int i = 0; i < threads; i++)
+		m_workers.emplace_back(&AssetLoader::workerThread, this);
+}
+
+AssetLoader::~AssetLoader() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_wake.notify_all();
+	for (auto& w : m_workers)
+		w.join();
+}
+
+void AssetLoader::enqueue(std::function<void()> job) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_jobs.push_back(std::move(job));
+	}
+	m_wake.notify_one();
+}
+
+size_t AssetLoader::pending() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_jobs.size() + m_running;
+}
+
+void AssetLoader::workerThread() {
+	while (true) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [this]() { return m_quit || !m_jobs.empty(); });
+			// Quitting waits for the queue to drain, a cache may be waiting on a job in it
+			if (m_jobs.empty())
+				return;
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+			m_running++;
+		}
+		job();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_running--;
+	}
+}
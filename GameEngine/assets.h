@@ -0,0 +1,302 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/*
+* Background asset loading.
+*
+* An AssetCache<T> owns every T loaded from a path, loaded once however many times it is asked for. load returns
+* an AssetHandle straight away and the file is read on an AssetLoader worker thread, so the game thread never
+* waits for a disk or a parser. Until the asset is ready a handle gives the cache's placeholder, and callbacks
+* passed to load run on the game thread from AssetCache::update once it is.
+*
+* Handles count references. An asset nobody holds a handle to stays in memory so loading it again is free, until
+* the cache's memory budget is exceeded: update then evicts unreferenced assets, least recently released first.
+* Referenced assets are never evicted, the budget can be exceeded while they are in use.
+*
+* Loads run on the worker threads only, everything else (load, update, handles) is meant for the game thread.
+*/
+
+/*
+* Worker threads running load jobs in the order they were queued. Unlike ThreadPool, which splits one loop
+* across threads and returns when it is done, jobs here run while the caller gets on with its frames.
+*/
+class AssetLoader
+{
+public:
+	explicit AssetLoader(unsigned int threads = 2);
+	// Jobs still queued are run before the workers exit
+	~AssetLoader();
+
+	AssetLoader(const AssetLoader&) = delete;
+	AssetLoader& operator=(const AssetLoader&) = delete;
+
+	void enqueue(std::function<void()> job);
+	// Jobs queued or running
+	size_t pending() const;
+
+private:
+	void workerThread();
+
+	std::vector<std::thread> m_workers;
+	mutable std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::deque<std::function<void()>> m_jobs;
+	size_t m_running = 0;
+	bool m_quit = false;
+};
+
+enum class AssetState
+{
+	Loading,
+	Ready,
+	Failed,
+};
+
+template <typename T>
+class AssetCache;
+
+// One asset of a cache, never moved while the cache holds it
+template <typename T>
+struct AssetEntry
+{
+	std::string path;
+	T value{};
+	std::atomic<AssetState> state{ AssetState::Loading };
+	std::atomic<int> refs{ 0 };
+	// What value holds in memory, set when it is ready
+	size_t bytes = 0;
+	// The cache's clock when the last handle went away, for eviction
+	std::atomic<uint64_t> lastUsed{ 0 };
+};
+
+template <typename T>
+class AssetHandle
+{
+public:
+	AssetHandle() = default;
+	AssetHandle(const AssetHandle& other) : m_cache(other.m_cache), m_entry(other.m_entry) {
+		if (m_entry)
+			m_entry->refs++;
+	}
+	AssetHandle(AssetHandle&& other) noexcept : m_cache(other.m_cache), m_entry(other.m_entry) {
+		other.m_entry = nullptr;
+	}
+	AssetHandle& operator=(AssetHandle other) noexcept {
+		std::swap(m_cache, other.m_cache);
+		std::swap(m_entry, other.m_entry);
+		return *this;
+	}
+	~AssetHandle() { reset(); }
+
+	void reset() {
+		if (m_entry && --m_entry->refs == 0)
+			m_entry->lastUsed = m_cache->tick();
+		m_entry = nullptr;
+	}
+
+	bool valid() const { return m_entry != nullptr; }
+	bool ready() const { return m_entry && m_entry->state == AssetState::Ready; }
+	bool failed() const { return m_entry && m_entry->state == AssetState::Failed; }
+	const std::string& path() const { return m_entry->path; }
+
+	// The asset once it is ready, until then (or if it failed) the cache's placeholder, which may be nullptr
+	const T* get() const { return ready() ? &m_entry->value : m_cache ? m_cache->placeholder() : nullptr; }
+	const T& operator*() const { return *get(); }
+	const T* operator->() const { return get(); }
+
+	// Block until the asset is ready or failed, for when it is needed before anything can be drawn
+	void wait() const {
+		if (m_entry)
+			m_cache->wait(*m_entry);
+	}
+
+private:
+	friend class AssetCache<T>;
+	AssetHandle(AssetCache<T>* cache, AssetEntry<T>* entry) : m_cache(cache), m_entry(entry) {
+		m_entry->refs++;
+	}
+
+	AssetCache<T>* m_cache = nullptr;
+	AssetEntry<T>* m_entry = nullptr;
+};
+
+/*
+* The assets of one type. A handle must not outlive the cache it came from, and the cache waits for its own loads
+* to finish when it is destroyed.
+*/
+template <typename T>
+class AssetCache
+{
+public:
+	// Fill the T with the asset at path, returns false if it could not be loaded. Runs on a worker thread
+	using LoadFunction = std::function<bool(const std::string& path, T& out)>;
+	// Bytes a loaded T holds, counted against the budget
+	using SizeFunction = std::function<size_t(const T& value)>;
+	using Callback = std::function<void(const AssetHandle<T>& handle)>;
+
+	AssetCache(AssetLoader& loader, LoadFunction load, SizeFunction size) : m_loader(loader), m_load(std::move(load)), m_size(std::move(size)) {
+	}
+	~AssetCache() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait(lock, [this]() { return m_loading == 0; });
+		// Their handles tick the clock as they go, let them go while the rest of the cache is still here
+		m_callbacks.clear();
+	}
+
+	AssetCache(const AssetCache&) = delete;
+	AssetCache& operator=(const AssetCache&) = delete;
+
+	/*
+	* The asset at path, queued for loading unless the cache already has it. onReady is called once it is ready or
+	* failed, from update, or right away if it already is. A callback still waiting holds the asset like a handle,
+	* so it is not evicted before the callback has run even if the returned handle is dropped.
+	*/
+	AssetHandle<T> load(const std::string& path, Callback onReady = nullptr) {
+		AssetHandle<T> handle;
+		bool queue = false;
+		bool callNow = false;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			std::unique_ptr<AssetEntry<T>>& slot = m_entries[path];
+			if (!slot) {
+				slot.reset(new AssetEntry<T>());
+				slot->path = path;
+				m_loading++;
+				queue = true;
+			}
+			handle = AssetHandle<T>(this, slot.get());
+			if (onReady && slot->state == AssetState::Loading)
+				m_callbacks.push_back({ handle, onReady });
+			else
+				callNow = static_cast<bool>(onReady);
+		}
+		if (callNow)
+			onReady(handle);
+		if (queue) {
+			AssetEntry<T>* entry = handle.m_entry;
+			m_loader.enqueue([this, entry]() { run(*entry); });
+		}
+		return handle;
+	}
+
+	// Given by handles whose asset is not ready yet, the cache does not own it
+	void setPlaceholder(const T* placeholder) { m_placeholder = placeholder; }
+	const T* placeholder() const { return m_placeholder; }
+
+	// Bytes of unreferenced assets kept beyond this are evicted by update
+	void setBudget(size_t bytes) { m_budget = bytes; }
+	size_t budget() const { return m_budget; }
+	// Bytes held by the assets that are ready
+	size_t residentBytes() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_resident;
+	}
+	// Assets loading, ready or failed
+	size_t size() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_entries.size();
+	}
+
+	/*
+	* Call once a frame on the game thread: runs the callbacks of the loads that finished, forgets the failed
+	* loads nobody holds so they are tried again, and evicts to the budget.
+	*/
+	void update() {
+		std::vector<std::pair<AssetHandle<T>, Callback>> finished;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto done = std::stable_partition(m_callbacks.begin(), m_callbacks.end(), [](const std::pair<AssetHandle<T>, Callback>& c) {
+				return c.first.m_entry->state == AssetState::Loading;
+			});
+			finished.assign(std::make_move_iterator(done), std::make_move_iterator(m_callbacks.end()));
+			m_callbacks.erase(done, m_callbacks.end());
+		}
+		for (auto& c : finished)
+			c.second(c.first);
+		finished.clear();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::vector<AssetEntry<T>*> unused;
+		for (auto it = m_entries.begin(); it != m_entries.end(); ) {
+			AssetEntry<T>* entry = it->second.get();
+			if (entry->refs == 0 && entry->state == AssetState::Failed) {
+				it = m_entries.erase(it);
+				continue;
+			}
+			if (entry->refs == 0 && entry->state == AssetState::Ready)
+				unused.push_back(entry);
+			++it;
+		}
+		if (m_resident <= m_budget)
+			return;
+		std::sort(unused.begin(), unused.end(), [](const AssetEntry<T>* a, const AssetEntry<T>* b) {
+			return a->lastUsed < b->lastUsed;
+		});
+		for (AssetEntry<T>* entry : unused) {
+			if (m_resident <= m_budget)
+				break;
+			m_resident -= entry->bytes;
+			m_entries.erase(entry->path);
+		}
+	}
+
+private:
+	friend class AssetHandle<T>;
+
+	uint64_t tick() { return ++m_clock; }
+
+	void wait(const AssetEntry<T>& entry) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait(lock, [&entry]() { return entry.state != AssetState::Loading; });
+	}
+
+	// On a worker thread, the entry cannot be evicted while it is loading
+	void run(AssetEntry<T>& entry) {
+		bool loaded = false;
+		size_t bytes = 0;
+		// A throwing loader fails the asset, it must not take the worker down or leave the entry loading forever
+		try {
+			loaded = m_load(entry.path, entry.value);
+			bytes = loaded ? m_size(entry.value) : 0;
+		}
+		catch (...) {
+			loaded = false;
+			bytes = 0;
+		}
+		// Notified under the lock, once m_loading drops the destructor may go ahead and destroy m_done
+		std::lock_guard<std::mutex> lock(m_mutex);
+		entry.bytes = bytes;
+		m_resident += bytes;
+		entry.state = loaded ? AssetState::Ready : AssetState::Failed;
+		m_loading--;
+		m_done.notify_all();
+	}
+
+	AssetLoader& m_loader;
+	LoadFunction m_load;
+	SizeFunction m_size;
+	const T* m_placeholder = nullptr;
+	size_t m_budget = SIZE_MAX;
+
+	mutable std::mutex m_mutex;
+	// Signalled whenever a load finishes
+	std::condition_variable m_done;
+	std::unordered_map<std::string, std::unique_ptr<AssetEntry<T>>> m_entries;
+	// Callbacks waiting for their asset to stop loading, each holds a handle so the entry outlives it
+	std::vector<std::pair<AssetHandle<T>, Callback>> m_callbacks;
+	size_t m_resident = 0;
+	size_t m_loading = 0;
+	std::atomic<uint64_t> m_clock{ 0 };
+};
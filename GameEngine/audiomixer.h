@@ -0,0 +1,413 @@
+#pragma once
+
+#include "simd.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(SIMD_AVX) || defined(SIMD_SSE)
+#include <emmintrin.h>
+#define AUDIOMIXER_SSE 1
+#endif
+
+/*
+* Audio mixing.
+*
+* AudioMixer renders a whole block of frames at a time: every playing voice adds its clip, times its gain, into
+* the block with SIMD multiply-adds over contiguous runs of samples, and clipToPcm16 clamps and converts the block
+* for the device in one pass. Per block the work is one tight loop per voice, so hundreds of voices cost a few
+* percent of a core.
+*
+* Voices live in a fixed array owned by the audio thread, packed at the front so only playing voices are visited.
+* The game thread never touches them: play, stop and setGain push commands onto a lock-free single producer,
+* single consumer queue that the audio thread drains at the start of every block.
+*
+* The mixer knows nothing about the sound card. Anything that takes 16 bit PCM can be an AudioDevice, e.g. the
+* null and WAV file devices below, which let the mixer run (and be checked) without one.*
+* Everything is defined inline here, there is no source file to build, so the single header test.h engine can use
+* the mixer and stay a single header. std::min and std::max are called as (std::min)(...) because test.h includes
+* <windows.h> without NOMINMAX, whose min and max macros would otherwise replace them.
+*/
+
+/*
+* A ring of N items, N a power of two, safe for one thread pushing and one other thread popping at the same time
+* without locks. Each side only writes its own index, the other side's index tells it how far it may go.
+*/
+template <typename T, size_t N>
+class SpscQueue
+{
+public:
+	static_assert((N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+	// Producer side, false when the queue is full
+	bool push(const T& item) {
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_head.load(std::memory_order_acquire) == N)
+			return false;
+		m_items[tail & (N - 1)] = item;
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side, false when the queue is empty
+	bool pop(T& item) {
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load(std::memory_order_acquire))
+			return false;
+		item = m_items[head & (N - 1)];
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	T m_items[N];
+	// On their own cache lines, each is written by one thread and read by the other
+	alignas(64) std::atomic<size_t> m_head{ 0 };
+	alignas(64) std::atomic<size_t> m_tail{ 0 };
+};
+
+// Decoded samples owned elsewhere, which must stay in place while any voice plays them
+struct AudioClip
+{
+	// Interleaved, frames * channels of them, in [-1, 1]
+	const float* samples = nullptr;
+	uint32_t frames = 0;
+	uint32_t channels = 0;
+};
+
+class AudioMixer
+{
+public:
+	// Voices playing at once, a play beyond this is dropped
+	static const unsigned int maxVoices = 1024;
+
+	/*
+	* Game thread. Start clip and return the voice's id for stop and setGain, or 0 if the command queue is full.
+	* The clip plays at the mixer's rate, a frame per output frame.
+	*/
+	uint32_t play(const AudioClip& clip, float gain = 1.0f, bool loop = false);
+	// Game thread. These return false if the command queue is full, ids of voices that already finished are ignored
+	bool stop(uint32_t voice);
+	bool setGain(uint32_t voice, float gain);
+	bool stopAll();
+
+	/*
+	* Audio thread. Apply the commands sent since the last block and write the sum of the voices for frames
+	* frames of channels interleaved channels to out, unclipped. A mono clip plays on every channel, a clip with
+	* more channels than the output only gives its first ones.
+	*/
+	void mix(float* out, unsigned int frames, unsigned int channels);
+
+	// Voices playing at the end of the last block, may be read from any thread
+	unsigned int activeVoices() const { return m_active.load(std::memory_order_relaxed); }
+
+private:
+	struct Command
+	{
+		enum Type { Play, Stop, Gain, StopAll } type;
+		uint32_t voice;
+		AudioClip clip;
+		float gain;
+		bool loop;
+	};
+
+	struct Voice
+	{
+		uint32_t id;
+		AudioClip clip;
+		uint32_t position;
+		float gain;
+		bool loop;
+	};
+
+	void applyCommands();
+	// The voice with id, or nullptr if it is not playing
+	Voice* find(uint32_t id);
+
+	SpscQueue<Command, 1024> m_commands;
+	// Game thread, 0 is never handed out
+	uint32_t m_nextId = 1;
+	// Audio thread, the first m_voiceCount are playing
+	Voice m_voices[maxVoices];
+	unsigned int m_voiceCount = 0;
+	std::atomic<unsigned int> m_active{ 0 };
+};
+
+// Clamp count samples to [-1, 1] and scale them to 16 bit PCM
+void clipToPcm16(const float* in, int16_t* out, size_t count);
+
+// Where mixed audio goes, 16 bit PCM frames of interleaved channels
+class AudioDevice
+{
+public:
+	virtual ~AudioDevice() = default;
+	virtual bool write(const int16_t* samples, size_t frames) = 0;
+};
+
+// Throws the audio away, for running the mixer without a sound card
+class NullAudioDevice : public AudioDevice
+{
+public:
+	bool write(const int16_t* samples, size_t frames) override;
+	size_t framesWritten() const { return m_frames; }
+
+private:
+	size_t m_frames = 0;
+};
+
+// Writes a 16 bit PCM WAV file, its sizes are filled in by close
+class WaveFileAudioDevice : public AudioDevice
+{
+public:
+	~WaveFileAudioDevice();
+	bool open(const std::string& filename, unsigned int sampleRate, unsigned int channels);
+	bool write(const int16_t* samples, size_t frames) override;
+	bool close();
+
+private:
+	FILE* m_file = nullptr;
+	unsigned int m_channels = 0;
+	uint32_t m_dataBytes = 0;
+	// A block in file byte order
+	std::vector<unsigned char> m_bytes;
+};
+
+// Mix frames frames into device a block of blockFrames at a time, on the calling thread
+bool renderAudio(AudioMixer& mixer, AudioDevice& device, size_t frames, unsigned int channels, unsigned int blockFrames = 512);
+
+// Helpers of the definitions below
+namespace audiomixer {
+
+// WAV files are little endian whatever the machine is
+inline void writeU32(FILE* f, uint32_t v) {
+	unsigned char b[4] = { static_cast<unsigned char>(v), static_cast<unsigned char>(v >> 8), static_cast<unsigned char>(v >> 16), static_cast<unsigned char>(v >> 24) };
+	fwrite(b, 1, 4, f);
+}
+
+inline void writeU16(FILE* f, uint16_t v) {
+	unsigned char b[2] = { static_cast<unsigned char>(v), static_cast<unsigned char>(v >> 8) };
+	fwrite(b, 1, 2, f);
+}
+
+// out[i] += src[i] * gain for count samples
+inline void accumulate(float* out, const float* src, size_t count, float gain) {
+	const simd_float g = simd_set1(gain);
+	size_t i = 0;
+	for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH)
+		simd_store(out + i, simd_madd(simd_load(src + i), g, simd_load(out + i)));
+	for (; i < count; i++)
+		out[i] += src[i] * gain;
+}
+
+// frames frames of a clip with sourceChannels channels into an output with channels channels
+inline void accumulateFrames(float* out, unsigned int channels, const float* src, unsigned int sourceChannels, size_t frames, float gain) {
+	// Same layout, one contiguous run, which is every clip when the channel counts match
+	if (sourceChannels == channels) {
+		accumulate(out, src, frames * channels, gain);
+		return;
+	}
+	if (sourceChannels == 1) {
+		for (size_t f = 0; f < frames; f++) {
+			float s = src[f] * gain;
+			for (unsigned int c = 0; c < channels; c++)
+				out[f * channels + c] += s;
+		}
+		return;
+	}
+	const unsigned int used = (std::min)(channels, sourceChannels);
+	for (size_t f = 0; f < frames; f++) {
+		for (unsigned int c = 0; c < used; c++)
+			out[f * channels + c] += src[f * sourceChannels + c] * gain;
+	}
+}
+
+}
+
+inline uint32_t AudioMixer::play(const AudioClip& clip, float gain, bool loop) {
+	Command command = { Command::Play, m_nextId, clip, gain, loop };
+	if (!m_commands.push(command))
+		return 0;
+	// Skip 0 when the ids wrap around
+	if (++m_nextId == 0)
+		m_nextId = 1;
+	return command.voice;
+}
+
+inline bool AudioMixer::stop(uint32_t voice) {
+	return m_commands.push({ Command::Stop, voice, AudioClip(), 0.0f, false });
+}
+
+inline bool AudioMixer::setGain(uint32_t voice, float gain) {
+	return m_commands.push({ Command::Gain, voice, AudioClip(), gain, false });
+}
+
+inline bool AudioMixer::stopAll() {
+	return m_commands.push({ Command::StopAll, 0, AudioClip(), 0.0f, false });
+}
+
+inline AudioMixer::Voice* AudioMixer::find(uint32_t id) {
+	for (unsigned int i = 0; i < m_voiceCount; i++) {
+		if (m_voices[i].id == id)
+			return &m_voices[i];
+	}
+	return nullptr;
+}
+
+inline void AudioMixer::applyCommands() {
+	Command command;
+	while (m_commands.pop(command)) {
+		switch (command.type) {
+		case Command::Play:
+			if (m_voiceCount < maxVoices && command.clip.samples && command.clip.frames > 0 && command.clip.channels > 0)
+				m_voices[m_voiceCount++] = { command.voice, command.clip, 0, command.gain, command.loop };
+			break;
+		case Command::Stop:
+			if (Voice* v = find(command.voice))
+				*v = m_voices[--m_voiceCount];
+			break;
+		case Command::Gain:
+			if (Voice* v = find(command.voice))
+				v->gain = command.gain;
+			break;
+		case Command::StopAll:
+			m_voiceCount = 0;
+			break;
+		}
+	}
+}
+
+inline void AudioMixer::mix(float* out, unsigned int frames, unsigned int channels) {
+	applyCommands();
+	memset(out, 0, sizeof(float) * frames * channels);
+	for (unsigned int i = 0; i < m_voiceCount; ) {
+		Voice& v = m_voices[i];
+		const unsigned int sourceChannels = v.clip.channels;
+		bool finished = false;
+		// A looping voice may wrap around inside the block, it then takes more than one run
+		for (unsigned int done = 0; done < frames; ) {
+			unsigned int run = (std::min)(frames - done, v.clip.frames - v.position);
+			audiomixer::accumulateFrames(out + static_cast<size_t>(done) * channels, channels,
+				v.clip.samples + static_cast<size_t>(v.position) * sourceChannels, sourceChannels, run, v.gain);
+			done += run;
+			v.position += run;
+			if (v.position == v.clip.frames) {
+				if (!v.loop) {
+					finished = true;
+					break;
+				}
+				v.position = 0;
+			}
+		}
+		// The last voice takes the finished one's place, the voices stay packed
+		if (finished)
+			v = m_voices[--m_voiceCount];
+		else
+			i++;
+	}
+	m_active.store(m_voiceCount, std::memory_order_relaxed);
+}
+
+inline void clipToPcm16(const float* in, int16_t* out, size_t count) {
+	const float scale = 32767.0f;
+	size_t i = 0;
+#ifdef AUDIOMIXER_SSE
+	const __m128 lo = _mm_set1_ps(-1.0f);
+	const __m128 hi = _mm_set1_ps(1.0f);
+	const __m128 s = _mm_set1_ps(scale);
+	// 8 samples a step, converted with truncation like the scalar cast and packed to 16 bits
+	for (; i + 8 <= count; i += 8) {
+		__m128 a = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), lo), hi), s);
+		__m128 b = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), lo), hi), s);
+		__m128i packed = _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+	}
+#endif
+	for (; i < count; i++)
+		out[i] = static_cast<int16_t>((std::min)((std::max)(in[i], -1.0f), 1.0f) * scale);
+}
+
+inline bool NullAudioDevice::write(const int16_t* samples, size_t frames) {
+	(void)samples;
+	m_frames += frames;
+	return true;
+}
+
+inline WaveFileAudioDevice::~WaveFileAudioDevice() {
+	close();
+}
+
+inline bool WaveFileAudioDevice::open(const std::string& filename, unsigned int sampleRate, unsigned int channels) {
+	close();
+#ifdef _MSC_VER
+	// fopen is an error under the SDL checks the projects build with
+	if (fopen_s(&m_file, filename.c_str(), "wb") != 0)
+		m_file = nullptr;
+#else
+	m_file = fopen(filename.c_str(), "wb");
+#endif
+	if (!m_file)
+		return false;
+	m_channels = channels;
+	m_dataBytes = 0;
+	// The RIFF and data sizes are written as 0 and patched by close
+	fwrite("RIFF", 1, 4, m_file);
+	audiomixer::writeU32(m_file, 0);
+	fwrite("WAVEfmt ", 1, 8, m_file);
+	audiomixer::writeU32(m_file, 16);
+	audiomixer::writeU16(m_file, 1);
+	audiomixer::writeU16(m_file, static_cast<uint16_t>(channels));
+	audiomixer::writeU32(m_file, sampleRate);
+	audiomixer::writeU32(m_file, sampleRate * channels * 2);
+	audiomixer::writeU16(m_file, static_cast<uint16_t>(channels * 2));
+	audiomixer::writeU16(m_file, 16);
+	fwrite("data", 1, 4, m_file);
+	audiomixer::writeU32(m_file, 0);
+	return !ferror(m_file);
+}
+
+inline bool WaveFileAudioDevice::write(const int16_t* samples, size_t frames) {
+	if (!m_file)
+		return false;
+	const size_t count = frames * m_channels;
+	m_bytes.resize(count * 2);
+	for (size_t i = 0; i < count; i++) {
+		uint16_t v = static_cast<uint16_t>(samples[i]);
+		m_bytes[i * 2] = static_cast<unsigned char>(v);
+		m_bytes[i * 2 + 1] = static_cast<unsigned char>(v >> 8);
+	}
+	fwrite(m_bytes.data(), 1, m_bytes.size(), m_file);
+	m_dataBytes += static_cast<uint32_t>(m_bytes.size());
+	return !ferror(m_file);
+}
+
+inline bool WaveFileAudioDevice::close() {
+	if (!m_file)
+		return true;
+	fseek(m_file, 4, SEEK_SET);
+	audiomixer::writeU32(m_file, 36 + m_dataBytes);
+	fseek(m_file, 40, SEEK_SET);
+	audiomixer::writeU32(m_file, m_dataBytes);
+	bool ok = !ferror(m_file);
+	ok = fclose(m_file) == 0 && ok;
+	m_file = nullptr;
+	return ok;
+}
+
+inline bool renderAudio(AudioMixer& mixer, AudioDevice& device, size_t frames, unsigned int channels, unsigned int blockFrames) {
+	std::vector<float> mixed(static_cast<size_t>(blockFrames) * channels);
+	std::vector<int16_t> pcm(mixed.size());
+	for (size_t done = 0; done < frames; ) {
+		unsigned int block = static_cast<unsigned int>((std::min<size_t>)(blockFrames, frames - done));
+		mixer.mix(mixed.data(), block, channels);
+		clipToPcm16(mixed.data(), pcm.data(), static_cast<size_t>(block) * channels);
+		if (!device.write(pcm.data(), block))
+			return false;
+		done += block;
+	}
+	return true;
+}
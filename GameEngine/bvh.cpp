@@ -0,0 +1,545 @@
+#include "bvh.h"
+#include "simd.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+struct Box
+{
+	float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	void grow(const Box& b) {
+		for (int a = 0; a < 3; a++) {
+			lo[a] = std::min(lo[a], b.lo[a]);
+			hi[a] = std::max(hi[a], b.hi[a]);
+		}
+	}
+	void grow(const float p[3]) {
+		for (int a = 0; a < 3; a++) {
+			lo[a] = std::min(lo[a], p[a]);
+			hi[a] = std::max(hi[a], p[a]);
+		}
+	}
+	// Half the surface area, the constant factor cancels out of every cost compared
+	float area() const {
+		float dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+		if (dx < 0.0f || dy < 0.0f || dz < 0.0f)
+			return 0.0f;
+		return dx * dy + dy * dz + dz * dx;
+	}
+};
+
+// Cost of testing a ray against one node relative to testing it against one batch of SIMD_WIDTH triangles
+const float traversalCost = 1.0f;
+
+// Leaves are tested SIMD_WIDTH triangles at a time, so that is what the cost counts
+float batches(uint32_t triangles) {
+	return static_cast<float>((triangles + SIMD_WIDTH - 1) / SIMD_WIDTH);
+}
+// Ranges of at least this many triangles bin their centroids in parallel
+const uint32_t parallelBinSize = 1 << 18;
+// Meshes of at least this many triangles build their subtrees in parallel
+const uint32_t parallelBuildSize = 1 << 15;
+// Beyond this depth ranges are split in half instead, which bounds the depth (and the traversal stack) on meshes
+// where the heuristic keeps peeling off a few triangles at a time
+const int maxHeuristicDepth = 64;
+const int maxDepth = maxHeuristicDepth + 32;
+
+}
+
+struct BVH::Builder
+{
+	// Where to split a range of triangles
+	struct Split
+	{
+		int axis = 0;
+		// Triangles in bins [0, bin] go to the first child, -1 splits the range in half by position instead
+		int bin = -1;
+		float cost = FLT_MAX;
+		float centroidLo = 0.0f;
+		float binScale = 0.0f;
+	};
+
+	// A subtree left to build once the top of the tree is done
+	struct Task
+	{
+		uint32_t parent;
+		int slot;
+		uint32_t begin;
+		uint32_t end;
+		int depth;
+		std::vector<Node> nodes;
+	};
+
+	std::vector<Box> boxes;
+	std::vector<float> centroids;
+	std::vector<uint32_t>& order;
+	ThreadPool* pool;
+	// Ranges below this size become tasks instead of being built in place, 0 builds everything in place
+	uint32_t taskSize = 0;
+	std::vector<Task> tasks;
+
+	Builder(std::vector<uint32_t>& order, ThreadPool* pool) : order(order), pool(pool) {}
+
+	int binOf(uint32_t tri, const Split& s) const {
+		int b = static_cast<int>((centroids[tri * 3 + s.axis] - s.centroidLo) * s.binScale);
+		return std::min(std::max(b, 0), binCount - 1);
+	}
+
+	Box rangeBox(uint32_t begin, uint32_t end) const {
+		Box box;
+		for (uint32_t i = begin; i < end; i++)
+			box.grow(boxes[order[i]]);
+		return box;
+	}
+
+	// Count and bound the triangles of [begin, end) per bin
+	void binRange(uint32_t begin, uint32_t end, const Split& s, Box* binBoxes, uint32_t* binCounts) const {
+		for (uint32_t i = begin; i < end; i++) {
+			uint32_t tri = order[i];
+			int b = binOf(tri, s);
+			binBoxes[b].grow(boxes[tri]);
+			binCounts[b]++;
+		}
+	}
+
+	/*
+	* Find the cheapest split of [begin, end) by the surface area heuristic, the cost is the sum of each
+	* side's area times the triangle batches in it.
+	*/
+	Split findSplit(uint32_t begin, uint32_t end, int depth) const {
+		Split best;
+		if (depth >= maxHeuristicDepth)
+			return best;
+		Box centroidBox;
+		for (uint32_t i = begin; i < end; i++)
+			centroidBox.grow(&centroids[order[i] * 3]);
+		float extent = -1.0f;
+		for (int a = 0; a < 3; a++) {
+			if (centroidBox.hi[a] - centroidBox.lo[a] > extent) {
+				extent = centroidBox.hi[a] - centroidBox.lo[a];
+				best.axis = a;
+			}
+		}
+		// Every centroid in the same place, no bin can tell them apart
+		if (!(extent > 0.0f))
+			return best;
+		best.centroidLo = centroidBox.lo[best.axis];
+		best.binScale = binCount / extent;
+
+		Box binBoxes[binCount];
+		uint32_t binCounts[binCount] = {};
+		const uint32_t count = end - begin;
+		if (pool && pool->size() > 1 && count >= parallelBinSize) {
+			// Each chunk bins on its own and the chunks are merged, the result is the same as binning in one go
+			const size_t chunks = pool->size() * 4;
+			std::vector<Box> chunkBoxes(chunks * binCount);
+			std::vector<uint32_t> chunkCounts(chunks * binCount, 0);
+			pool->parallelFor(chunks, [&](size_t c) {
+				uint32_t first = begin + static_cast<uint32_t>(count * c / chunks);
+				uint32_t last = begin + static_cast<uint32_t>(count * (c + 1) / chunks);
+				binRange(first, last, best, &chunkBoxes[c * binCount], &chunkCounts[c * binCount]);
+			});
+			for (size_t c = 0; c < chunks; c++) {
+				for (int b = 0; b < binCount; b++) {
+					binBoxes[b].grow(chunkBoxes[c * binCount + b]);
+					binCounts[b] += chunkCounts[c * binCount + b];
+				}
+			}
+		}
+		else {
+			binRange(begin, end, best, binBoxes, binCounts);
+		}
+
+		// Sweep from the right to get the cost of everything right of each plane, then from the left to pick the plane
+		float rightCost[binCount];
+		Box right;
+		uint32_t rightCount = 0;
+		for (int b = binCount - 1; b > 0; b--) {
+			right.grow(binBoxes[b]);
+			rightCount += binCounts[b];
+			rightCost[b - 1] = right.area() * batches(rightCount);
+		}
+		Box left;
+		uint32_t leftCount = 0;
+		for (int b = 0; b < binCount - 1; b++) {
+			left.grow(binBoxes[b]);
+			leftCount += binCounts[b];
+			if (leftCount == 0 || leftCount == count)
+				continue;
+			float cost = left.area() * batches(leftCount) + rightCost[b];
+			if (cost < best.cost) {
+				best.cost = cost;
+				best.bin = b;
+			}
+		}
+		return best;
+	}
+
+	// Reorder [begin, end) so the first child's triangles come first, returns where the second child starts
+	uint32_t partition(uint32_t begin, uint32_t end, const Split& s) {
+		if (s.bin < 0)
+			return begin + (end - begin) / 2;
+		uint32_t* mid = std::partition(order.data() + begin, order.data() + end,
+			[this, &s](uint32_t tri) { return binOf(tri, s) <= s.bin; });
+		return static_cast<uint32_t>(mid - order.data());
+	}
+
+	// Whether splitting [begin, end) by s is cheaper for a ray than testing its triangles as a leaf
+	bool worthSplitting(uint32_t begin, uint32_t end, const Split& s, const Box& box) const {
+		uint32_t count = end - begin;
+		if (count > maxLeafSize)
+			return true;
+		if (count <= 1 || s.bin < 0)
+			return false;
+		float area = box.area();
+		if (!(area > 0.0f))
+			return false;
+		return traversalCost + s.cost / area < batches(count);
+	}
+
+	/*
+	* Add a node splitting [begin, end) by s to nodes and build everything below it, returns its index.
+	* The node is added before its children, so every child index is larger than its parent's.
+	*/
+	uint32_t buildNode(uint32_t begin, uint32_t end, const Split& s, int depth, std::vector<Node>& nodes, bool makeTasks) {
+		uint32_t index = static_cast<uint32_t>(nodes.size());
+		nodes.push_back(Node());
+		uint32_t mid = partition(begin, end, s);
+		const uint32_t ranges[2][2] = { { begin, mid }, { mid, end } };
+		for (int c = 0; c < 2; c++) {
+			uint32_t first = ranges[c][0], last = ranges[c][1];
+			Box box = rangeBox(first, last);
+			for (int a = 0; a < 3; a++) {
+				nodes[index].bounds[a][c] = box.lo[a];
+				nodes[index].bounds[a][c + 2] = box.hi[a];
+			}
+			if (first == last) {
+				nodes[index].child[c] = noChild;
+				nodes[index].count[c] = 0;
+				continue;
+			}
+			if (makeTasks && last - first < taskSize && last - first > maxLeafSize) {
+				// Built later in parallel, the child index is filled in when the task's nodes are appended
+				tasks.push_back({ index, c, first, last, depth + 1, {} });
+				nodes[index].child[c] = noChild;
+				nodes[index].count[c] = 0;
+				continue;
+			}
+			Split childSplit = findSplit(first, last, depth + 1);
+			if (worthSplitting(first, last, childSplit, box)) {
+				uint32_t child = buildNode(first, last, childSplit, depth + 1, nodes, makeTasks);
+				nodes[index].child[c] = child;
+				nodes[index].count[c] = 0;
+			}
+			else {
+				nodes[index].child[c] = first;
+				nodes[index].count[c] = last - first;
+			}
+		}
+		return index;
+	}
+};
+
+void BVH::build(const Mesh& mesh, ThreadPool* pool) {
+	const uint32_t count = static_cast<uint32_t>(mesh.triangleCount());
+	m_nodes.clear();
+	m_order.resize(count);
+	for (uint32_t t = 0; t < count; t++)
+		m_order[t] = t;
+	if (count == 0) {
+		gatherTriangles(mesh);
+		m_boundsMin = m_boundsMax = { 0.0f, 0.0f, 0.0f };
+		return;
+	}
+
+	Builder builder(m_order, pool);
+	builder.boxes.resize(count);
+	builder.centroids.resize(static_cast<size_t>(count) * 3);
+	auto bound = [&](size_t t) {
+		Box& box = builder.boxes[t];
+		for (int k = 0; k < 3; k++) {
+			uint32_t i = mesh.indices[t * 3 + k];
+			const float p[3] = { mesh.positions.x[i], mesh.positions.y[i], mesh.positions.z[i] };
+			box.grow(p);
+		}
+		for (int a = 0; a < 3; a++)
+			builder.centroids[t * 3 + a] = (box.lo[a] + box.hi[a]) * 0.5f;
+	};
+	const bool parallel = pool && pool->size() > 1 && count >= parallelBuildSize;
+	if (parallel) {
+		const size_t chunkSize = 4096;
+		pool->parallelFor((count + chunkSize - 1) / chunkSize, [&](size_t c) {
+			size_t last = std::min<size_t>(count, (c + 1) * chunkSize);
+			for (size_t t = c * chunkSize; t < last; t++)
+				bound(t);
+		});
+		// Enough subtrees that the threads stay busy even when the sizes are uneven
+		builder.taskSize = std::max<uint32_t>(count / (pool->size() * 8), maxLeafSize + 1);
+	}
+	else {
+		for (size_t t = 0; t < count; t++)
+			bound(t);
+	}
+
+	// The root is always a node, with a single triangle its second child is empty
+	builder.buildNode(0, count, builder.findSplit(0, count, 0), 0, m_nodes, parallel);
+
+	if (!builder.tasks.empty()) {
+		pool->parallelFor(builder.tasks.size(), [&builder](size_t i) {
+			Builder::Task& task = builder.tasks[i];
+			Builder::Split split = builder.findSplit(task.begin, task.end, task.depth);
+			builder.buildNode(task.begin, task.end, split, task.depth, task.nodes, false);
+		});
+		// Append every subtree after the top of the tree, which keeps children after their parents
+		for (Builder::Task& task : builder.tasks) {
+			uint32_t offset = static_cast<uint32_t>(m_nodes.size());
+			for (Node& node : task.nodes) {
+				for (int c = 0; c < 2; c++) {
+					if (node.count[c] == 0 && node.child[c] != noChild)
+						node.child[c] += offset;
+				}
+			}
+			m_nodes.insert(m_nodes.end(), task.nodes.begin(), task.nodes.end());
+			m_nodes[task.parent].child[task.slot] = offset;
+		}
+	}
+
+	// The boxes are recomputed from the leaf triangles as they are tested, so no hit can fall outside its box
+	refit(mesh);
+}
+
+void BVH::gatherTriangles(const Mesh& mesh) {
+	const size_t count = m_order.size();
+	// Padded so the last leaf can be loaded a whole SIMD register at a time
+	const size_t padded = count + SIMD_WIDTH;
+	m_v0.resize(padded);
+	m_e1.resize(padded);
+	m_e2.resize(padded);
+	for (size_t i = count; i < padded; i++) {
+		m_v0.x[i] = m_v0.y[i] = m_v0.z[i] = 0.0f;
+		m_e1.x[i] = m_e1.y[i] = m_e1.z[i] = 0.0f;
+		m_e2.x[i] = m_e2.y[i] = m_e2.z[i] = 0.0f;
+	}
+	for (size_t i = 0; i < count; i++) {
+		size_t t = m_order[i];
+		vec3 a = mesh.positions.get(mesh.indices[t * 3]);
+		vec3 b = mesh.positions.get(mesh.indices[t * 3 + 1]);
+		vec3 c = mesh.positions.get(mesh.indices[t * 3 + 2]);
+		m_v0.x[i] = a.x; m_v0.y[i] = a.y; m_v0.z[i] = a.z;
+		m_e1.x[i] = b.x - a.x; m_e1.y[i] = b.y - a.y; m_e1.z[i] = b.z - a.z;
+		m_e2.x[i] = c.x - a.x; m_e2.y[i] = c.y - a.y; m_e2.z[i] = c.z - a.z;
+	}
+}
+
+void BVH::leafBounds(uint32_t first, uint32_t count, float lo[3], float hi[3]) const {
+	const VertexStream* edges[2] = { &m_e1, &m_e2 };
+	for (int a = 0; a < 3; a++) {
+		lo[a] = FLT_MAX;
+		hi[a] = -FLT_MAX;
+	}
+	for (uint32_t i = first; i < first + count; i++) {
+		const float v0[3] = { m_v0.x[i], m_v0.y[i], m_v0.z[i] };
+		for (int a = 0; a < 3; a++) {
+			lo[a] = std::min(lo[a], v0[a]);
+			hi[a] = std::max(hi[a], v0[a]);
+		}
+		// The corners exactly as the ray test rebuilds them from the edges
+		for (const VertexStream* e : edges) {
+			const float p[3] = { v0[0] + e->x[i], v0[1] + e->y[i], v0[2] + e->z[i] };
+			for (int a = 0; a < 3; a++) {
+				lo[a] = std::min(lo[a], p[a]);
+				hi[a] = std::max(hi[a], p[a]);
+			}
+		}
+	}
+}
+
+void BVH::refit(const Mesh& mesh) {
+	gatherTriangles(mesh);
+	if (m_nodes.empty())
+		return;
+	// Children always come after their parent, so walking backwards finishes every child before its parent
+	for (size_t n = m_nodes.size(); n-- > 0; ) {
+		Node& node = m_nodes[n];
+		for (int c = 0; c < 2; c++) {
+			float lo[3], hi[3];
+			if (node.count[c] > 0) {
+				leafBounds(node.child[c], node.count[c], lo, hi);
+			}
+			else if (node.child[c] != noChild) {
+				const Node& child = m_nodes[node.child[c]];
+				for (int a = 0; a < 3; a++) {
+					lo[a] = std::min(child.bounds[a][0], child.bounds[a][1]);
+					hi[a] = std::max(child.bounds[a][2], child.bounds[a][3]);
+				}
+			}
+			else {
+				// Never hit, an empty child is also skipped by index
+				for (int a = 0; a < 3; a++) {
+					lo[a] = FLT_MAX;
+					hi[a] = -FLT_MAX;
+				}
+			}
+			for (int a = 0; a < 3; a++) {
+				node.bounds[a][c] = lo[a];
+				node.bounds[a][c + 2] = hi[a];
+			}
+		}
+	}
+	const Node& root = m_nodes[0];
+	m_boundsMin = { std::min(root.bounds[0][0], root.bounds[0][1]), std::min(root.bounds[1][0], root.bounds[1][1]),
+		std::min(root.bounds[2][0], root.bounds[2][1]) };
+	m_boundsMax = { std::max(root.bounds[0][2], root.bounds[0][3]), std::max(root.bounds[1][2], root.bounds[1][3]),
+		std::max(root.bounds[2][2], root.bounds[2][3]) };
+}
+
+size_t BVH::memoryUsage() const {
+	return m_nodes.size() * sizeof(Node) + m_order.size() * sizeof(uint32_t)
+		+ (m_v0.size() + m_e1.size() + m_e2.size()) * 3 * sizeof(float);
+}
+
+template <bool anyHit>
+bool BVH::traverse(const Ray& ray, RayHit& hit) const {
+	if (m_nodes.empty())
+		return false;
+	const float o[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+	const float d[3] = { ray.direction.x, ray.direction.y, ray.direction.z };
+	// A zero direction component would turn a slab test into 0 * infinity, a tiny one gives the same answer without NaNs
+	float inv[3];
+	for (int a = 0; a < 3; a++)
+		inv[a] = 1.0f / (std::fabs(d[a]) > 1e-30f ? d[a] : std::copysign(1e-30f, d[a]));
+
+	const simd_float ox = simd_set1(o[0]), oy = simd_set1(o[1]), oz = simd_set1(o[2]);
+	const simd_float dx = simd_set1(d[0]), dy = simd_set1(d[1]), dz = simd_set1(d[2]);
+	const simd_float zero = simd_set1(0.0f), one = simd_set1(1.0f);
+	const simd_float tMin = simd_set1(ray.tMin);
+	float tMax = anyHit ? ray.tMax : std::min(ray.tMax, hit.t);
+	bool found = false;
+
+	// Moller-Trumbore against SIMD_WIDTH triangles at once, either winding counts
+	auto intersectLeaf = [&](uint32_t first, uint32_t count) {
+		for (uint32_t i = first; i < first + count; i += SIMD_WIDTH) {
+			uint32_t lanes = std::min<uint32_t>(SIMD_WIDTH, first + count - i);
+			simd_float e1x = simd_load(&m_e1.x[i]), e1y = simd_load(&m_e1.y[i]), e1z = simd_load(&m_e1.z[i]);
+			simd_float e2x = simd_load(&m_e2.x[i]), e2y = simd_load(&m_e2.y[i]), e2z = simd_load(&m_e2.z[i]);
+			// p = d x e2
+			simd_float px = simd_sub(simd_mul(dy, e2z), simd_mul(dz, e2y));
+			simd_float py = simd_sub(simd_mul(dz, e2x), simd_mul(dx, e2z));
+			simd_float pz = simd_sub(simd_mul(dx, e2y), simd_mul(dy, e2x));
+			simd_float det = simd_madd(e1x, px, simd_madd(e1y, py, simd_mul(e1z, pz)));
+			simd_float invDet = simd_div(one, det);
+			simd_float sx = simd_sub(ox, simd_load(&m_v0.x[i]));
+			simd_float sy = simd_sub(oy, simd_load(&m_v0.y[i]));
+			simd_float sz = simd_sub(oz, simd_load(&m_v0.z[i]));
+			simd_float u = simd_mul(simd_madd(sx, px, simd_madd(sy, py, simd_mul(sz, pz))), invDet);
+			// q = s x e1
+			simd_float qx = simd_sub(simd_mul(sy, e1z), simd_mul(sz, e1y));
+			simd_float qy = simd_sub(simd_mul(sz, e1x), simd_mul(sx, e1z));
+			simd_float qz = simd_sub(simd_mul(sx, e1y), simd_mul(sy, e1x));
+			simd_float v = simd_mul(simd_madd(dx, qx, simd_madd(dy, qy, simd_mul(dz, qz))), invDet);
+			simd_float t = simd_mul(simd_madd(e2x, qx, simd_madd(e2y, qy, simd_mul(e2z, qz))), invDet);
+			// A parallel ray divides by zero, the NaNs and infinities that gives fail these ordered compares
+			int mask = simd_movemask(simd_cmpge(u, zero)) & simd_movemask(simd_cmpge(v, zero))
+				& simd_movemask(simd_cmple(simd_add(u, v), one)) & simd_movemask(simd_cmpge(t, tMin))
+				& simd_movemask(simd_cmple(t, simd_set1(tMax))) & ((1 << lanes) - 1);
+			if (!mask)
+				continue;
+			if (anyHit)
+				return true;
+			float ts[SIMD_WIDTH], us[SIMD_WIDTH], vs[SIMD_WIDTH];
+			simd_store(ts, t);
+			simd_store(us, u);
+			simd_store(vs, v);
+			for (uint32_t lane = 0; lane < lanes; lane++) {
+				if ((mask >> lane) & 1 && ts[lane] <= tMax) {
+					tMax = ts[lane];
+					hit.triangle = m_order[i + lane];
+					hit.t = ts[lane];
+					hit.u = us[lane];
+					hit.v = vs[lane];
+					found = true;
+				}
+			}
+		}
+		return false;
+	};
+
+	uint32_t stack[maxDepth];
+	int depth = 0;
+	uint32_t index = 0;
+	while (true) {
+		const Node& node = m_nodes[index];
+		// Entry and exit distance of the ray through each child's box, both children in one go
+		float tNear[4];
+		int hits;
+#if defined(SIMD_AVX) || defined(SIMD_SSE)
+		// Lanes are low bound of child 0 and 1, high bound of child 0 and 1, swapping the halves pairs each with the other
+		__m128 nearT = _mm_set1_ps(ray.tMin), farT = _mm_set1_ps(tMax);
+		for (int a = 0; a < 3; a++) {
+			__m128 t = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.bounds[a]), _mm_set1_ps(o[a])), _mm_set1_ps(inv[a]));
+			__m128 swapped = _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 0, 3, 2));
+			nearT = _mm_max_ps(nearT, _mm_min_ps(t, swapped));
+			farT = _mm_min_ps(farT, _mm_max_ps(t, swapped));
+		}
+		hits = _mm_movemask_ps(_mm_cmple_ps(nearT, farT)) & 3;
+		_mm_storeu_ps(tNear, nearT);
+#else
+		hits = 0;
+		for (int c = 0; c < 2; c++) {
+			float nearT = ray.tMin, farT = tMax;
+			for (int a = 0; a < 3; a++) {
+				float t0 = (node.bounds[a][c] - o[a]) * inv[a];
+				float t1 = (node.bounds[a][c + 2] - o[a]) * inv[a];
+				nearT = std::max(nearT, std::min(t0, t1));
+				farT = std::min(farT, std::max(t0, t1));
+			}
+			tNear[c] = nearT;
+			if (nearT <= farT)
+				hits |= 1 << c;
+		}
+#endif
+		// Nearest child first, so the closest hit found early culls more of the other one
+		int first = tNear[1] < tNear[0] ? 1 : 0;
+		uint32_t descend[2];
+		int descendCount = 0;
+		for (int k = 0; k < 2; k++) {
+			int c = k == 0 ? first : 1 - first;
+			if (!((hits >> c) & 1) || node.child[c] == noChild)
+				continue;
+			if (node.count[c] > 0) {
+				if (intersectLeaf(node.child[c], node.count[c]))
+					return true;
+			}
+			else {
+				descend[descendCount++] = node.child[c];
+			}
+		}
+		if (descendCount == 2) {
+			stack[depth++] = descend[1];
+			index = descend[0];
+		}
+		else if (descendCount == 1) {
+			index = descend[0];
+		}
+		else if (depth > 0) {
+			index = stack[--depth];
+		}
+		else {
+			break;
+		}
+	}
+	return found;
+}
+
+bool BVH::intersect(const Ray& ray, RayHit& hit) const {
+	hit = RayHit();
+	return traverse<false>(ray, hit);
+}
+
+bool BVH::occluded(const Ray& ray) const {
+	RayHit hit;
+	return traverse<true>(ray, hit);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "geometry.h"
+#include "threadpool.h"
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+// A ray origin + t * direction, only hits with tMin <= t <= tMax count
+struct Ray
+{
+	vec3 origin;
+	vec3 direction;
+	float tMin = 0.0f;
+	float tMax = FLT_MAX;
+};
+
+// The closest hit of a ray, triangle is noHit if there was none
+struct RayHit
+{
+	static const uint32_t noHit = 0xFFFFFFFFu;
+	uint32_t triangle = noHit;
+	float t = FLT_MAX;
+	// Barycentric coordinates of the hit, weights of the triangle's second and third vertex
+	float u = 0.0f;
+	float v = 0.0f;
+	bool hit() const { return triangle != noHit; }
+};
+
+/*
+* Bounding volume hierarchy over the triangles of a Mesh, for ray picking, line of sight and collision queries.
+*
+* The tree is built top down. Each range of triangles is split where the surface area heuristic says a ray is
+* cheapest to trace, evaluated over a fixed number of bins along the longest axis of the triangle centroids
+* rather than at every triangle. Large meshes build the top of the tree on the calling thread and then the
+* subtrees below it in parallel.
+*
+* The nodes live in one array in depth first order. Every node holds the boxes of both of its children, so a
+* traversal step tests the two children against the ray together (four lanes: low and high bound of each child
+* per axis) and only loads the child it descends into. A child is either another node or a leaf, a run of up to
+* maxLeafSize triangles. The leaf triangles are copied into structure-of-arrays form in leaf order, so a leaf is
+* intersected SIMD_WIDTH triangles at a time.
+*
+* The tree keeps no reference to the mesh. After moving vertices without changing the indices, refit updates
+* the boxes and triangle copies in place, which is much cheaper than a rebuild but lets the tree degrade if the
+* mesh deforms a lot.
+*/
+class BVH
+{
+public:
+	// Most triangles a leaf holds
+	static const uint32_t maxLeafSize = 8;
+	// Centroid bins the surface area heuristic is evaluated over
+	static const int binCount = 16;
+
+	/*
+	* Build the tree over every triangle of mesh, replacing any previous tree.
+	* With a pool, meshes of more than a few tens of thousands of triangles build their subtrees in parallel.
+	*/
+	void build(const Mesh& mesh, ThreadPool* pool = nullptr);
+
+	// Update the bounds after mesh's vertices moved, the indices must be the ones the tree was built from
+	void refit(const Mesh& mesh);
+
+	// Find the closest triangle the ray hits, returns whether there was one
+	bool intersect(const Ray& ray, RayHit& hit) const;
+
+	// Whether the ray hits any triangle at all, stops at the first one found, for shadow and line of sight rays
+	bool occluded(const Ray& ray) const;
+
+	bool empty() const { return m_nodes.empty(); }
+	size_t nodeCount() const { return m_nodes.size(); }
+	size_t triangleCount() const { return m_order.size(); }
+	// Bounds of the whole mesh
+	vec3 boundsMin() const { return m_boundsMin; }
+	vec3 boundsMax() const { return m_boundsMax; }
+	// Bytes held by the nodes and the leaf triangle copies
+	size_t memoryUsage() const;
+
+private:
+	struct Node
+	{
+		// Per axis, the low bound of child 0 and 1 then the high bound of child 0 and 1
+		float bounds[3][4];
+		// Index of the child node, or for a leaf child the first of its triangles in leaf order
+		uint32_t child[2];
+		// Triangles in a leaf child, 0 if the child is a node
+		uint32_t count[2];
+	};
+	static const uint32_t noChild = 0xFFFFFFFFu;
+
+	struct Builder;
+	template <bool anyHit>
+	bool traverse(const Ray& ray, RayHit& hit) const;
+	// Copy the triangles in m_order into the leaf arrays
+	void gatherTriangles(const Mesh& mesh);
+	void leafBounds(uint32_t first, uint32_t count, float lo[3], float hi[3]) const;
+
+	std::vector<Node> m_nodes;
+	// Mesh triangle index of every triangle in leaf order
+	std::vector<uint32_t> m_order;
+	// Leaf triangles in leaf order as first vertex and the two edges from it, padded by SIMD_WIDTH
+	VertexStream m_v0;
+	VertexStream m_e1;
+	VertexStream m_e2;
+	vec3 m_boundsMin = { 0.0f, 0.0f, 0.0f };
+	vec3 m_boundsMax = { 0.0f, 0.0f, 0.0f };
+};
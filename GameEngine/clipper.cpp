@@ -0,0 +1,291 @@
+#include "clipper.h"
+#include "raster.h"
+#include "simd.h"
+#include <algorithm>
+
+namespace {
+
+struct ClipVertex
+{
+	float x, y, z, w;
+	// The light level, carried along for Gouraud shading
+	float s;
+};
+
+// Outcode bits, one per plane a vertex is outside of
+enum : unsigned
+{
+	OUT_LEFT = 1,
+	OUT_RIGHT = 2,
+	OUT_BOTTOM = 4,
+	OUT_TOP = 8,
+	OUT_NEAR = 16,
+	OUT_FAR = 32,
+	// Outside the guard band, only used to decide whether a triangle needs cutting
+	OUT_GUARD = 64,
+};
+
+// The guard band as a multiple of w, past this the screen coordinates leave raster::guardBand
+float guardBandScale(float viewportWidth, float viewportHeight) {
+	float half = 0.5f * (viewportWidth > viewportHeight ? viewportWidth : viewportHeight);
+	return 0.5f * raster::guardBand / half;
+}
+
+unsigned outcode(const ClipVertex& v, float guard) {
+	unsigned code = 0;
+	if (v.x < -v.w) code |= OUT_LEFT;
+	if (v.x > v.w) code |= OUT_RIGHT;
+	if (v.y < -v.w) code |= OUT_BOTTOM;
+	if (v.y > v.w) code |= OUT_TOP;
+	if (v.z < 0.0f) code |= OUT_NEAR;
+	if (v.z > v.w) code |= OUT_FAR;
+	float g = guard * v.w;
+	if (v.x < -g || v.x > g || v.y < -g || v.y > g) code |= OUT_GUARD;
+	return code;
+}
+
+// Signed distance to one of the clip planes, positive is inside
+// Plane 0 is the near plane, 1 to 4 are the guard band sides
+float planeDistance(const ClipVertex& v, int plane, float guard) {
+	switch (plane) {
+	case 0: return v.z;
+	case 1: return guard * v.w + v.x;
+	case 2: return guard * v.w - v.x;
+	case 3: return guard * v.w + v.y;
+	default: return guard * v.w - v.y;
+	}
+}
+
+/*
+* Sutherland-Hodgman, keeps the part of the polygon on the positive side of the plane.
+* A triangle cut by the near plane and four guard band planes has at most 3 + 5 = 8 corners.
+*/
+const int maxPolygon = 8;
+
+int clipPolygon(const ClipVertex* in, int count, ClipVertex* out, int plane, float guard) {
+	int n = 0;
+	for (int i = 0; i < count; i++) {
+		const ClipVertex& a = in[i];
+		const ClipVertex& b = in[(i + 1) % count];
+		float da = planeDistance(a, plane, guard);
+		float db = planeDistance(b, plane, guard);
+		if (da >= 0.0f)
+			out[n++] = a;
+		// The edge crosses the plane, add the crossing point
+		if ((da >= 0.0f) != (db >= 0.0f)) {
+			float t = da / (da - db);
+			out[n++] = {
+				a.x + (b.x - a.x) * t,
+				a.y + (b.y - a.y) * t,
+				a.z + (b.z - a.z) * t,
+				a.w + (b.w - a.w) * t,
+				a.s + (b.s - a.s) * t
+			};
+		}
+	}
+	return n;
+}
+
+// The perspective divide and viewport scale, the same maths as transformVertices
+void project(const ClipVertex& v, float halfWidth, float halfHeight, float& x, float& y, float& z) {
+	x = (v.x / v.w) * halfWidth + halfWidth;
+	y = (v.y / v.w) * halfHeight + halfHeight;
+	z = v.z / v.w;
+}
+
+}
+
+void computePlaneOffsets(const mat4x4& world, const Mesh& mesh, const VertexStream& worldNormals, std::vector<float>& planeOffsets) {
+	size_t count = mesh.triangleCount();
+	planeOffsets.resize(count);
+	for (size_t t = 0; t < count; t++) {
+		vec3 p = mesh.positions.get(mesh.indices[t * 3]);
+		vec3 pw;
+		world.matrixMultiplyVector(p, pw);
+		planeOffsets[t] = worldNormals.x[t] * pw.x + worldNormals.y[t] * pw.y + worldNormals.z[t] * pw.z;
+	}
+}
+
+void cullBackfaces(const VertexStream& worldNormals, const std::vector<float>& planeOffsets, const vec3& cameraPos,
+	std::vector<uint32_t>& visible, ClipStats& stats) {
+	const size_t count = planeOffsets.size();
+	visible.clear();
+	visible.reserve(count);
+	const float* nx = worldNormals.x.data();
+	const float* ny = worldNormals.y.data();
+	const float* nz = worldNormals.z.data();
+	const float* d = planeOffsets.data();
+
+	size_t t = 0;
+#if SIMD_WIDTH > 1
+	const simd_float cx = simd_set1(cameraPos.x);
+	const simd_float cy = simd_set1(cameraPos.y);
+	const simd_float cz = simd_set1(cameraPos.z);
+	for (; t + SIMD_WIDTH <= count; t += SIMD_WIDTH) {
+		simd_float side = simd_madd(simd_load(nz + t), cz, simd_madd(simd_load(ny + t), cy, simd_mul(simd_load(nx + t), cx)));
+		int mask = simd_movemask(simd_cmpgt(side, simd_load(d + t)));
+		// Append the index of every lane that faces the camera
+		while (mask) {
+			int lane = 0;
+			while (!(mask & (1 << lane)))
+				lane++;
+			visible.push_back(static_cast<uint32_t>(t + lane));
+			mask &= mask - 1;
+		}
+	}
+#endif
+	for (; t < count; t++) {
+		float side = nx[t] * cameraPos.x + ny[t] * cameraPos.y + nz[t] * cameraPos.z;
+		if (side > d[t])
+			visible.push_back(static_cast<uint32_t>(t));
+	}
+	stats.input += static_cast<uint32_t>(count);
+	stats.backfaceCulled += static_cast<uint32_t>(count - visible.size());
+}
+
+void clipTriangles(const Mesh& mesh, const std::vector<uint32_t>& visible, const ClipSpaceStream& clip, const VertexStream& screen,
+	float viewportWidth, float viewportHeight, std::vector<ScreenTriangle>& out, ClipStats& stats, const float* vertexLight) {
+	const float halfWidth = 0.5f * viewportWidth;
+	const float halfHeight = 0.5f * viewportHeight;
+	const float guard = guardBandScale(viewportWidth, viewportHeight);
+
+	for (uint32_t t : visible) {
+		uint32_t idx[3] = { mesh.indices[t * 3], mesh.indices[t * 3 + 1], mesh.indices[t * 3 + 2] };
+		ClipVertex v[3];
+		unsigned codes[3];
+		for (int i = 0; i < 3; i++) {
+			v[i] = { clip.x[idx[i]], clip.y[idx[i]], clip.z[idx[i]], clip.w[idx[i]], vertexLight ? vertexLight[idx[i]] : 1.0f };
+			codes[i] = outcode(v[i], guard);
+		}
+
+		// All three corners outside the same plane, nothing of the triangle can be on screen
+		if (codes[0] & codes[1] & codes[2] & ~OUT_GUARD) {
+			stats.frustumCulled++;
+			continue;
+		}
+
+		// The common case, nothing to cut, the screen positions come straight from the post-transform cache
+		if (((codes[0] | codes[1] | codes[2]) & (OUT_NEAR | OUT_GUARD)) == 0) {
+			ScreenTriangle st;
+			for (int i = 0; i < 3; i++) {
+				st.x[i] = screen.x[idx[i]];
+				st.y[i] = screen.y[idx[i]];
+				st.z[i] = screen.z[idx[i]];
+				st.shade[i] = v[i].s;
+			}
+			st.id = t;
+			out.push_back(st);
+			stats.emitted++;
+			continue;
+		}
+
+		// Cut against the near plane and, where needed, the guard band, then fan the polygon back into triangles
+		ClipVertex polyA[maxPolygon], polyB[maxPolygon];
+		ClipVertex* poly = polyA;
+		ClipVertex* next = polyB;
+		int count = 3;
+		for (int i = 0; i < 3; i++)
+			poly[i] = v[i];
+		unsigned all = codes[0] | codes[1] | codes[2];
+		for (int plane = 0; plane < 5 && count > 0; plane++) {
+			if (plane == 0 && !(all & OUT_NEAR))
+				continue;
+			if (plane > 0 && !(all & OUT_GUARD))
+				break;
+			count = clipPolygon(poly, count, next, plane, guard);
+			ClipVertex* tmp = poly;
+			poly = next;
+			next = tmp;
+		}
+		stats.clipped++;
+		if (count < 3)
+			continue;
+
+		float px[maxPolygon], py[maxPolygon], pz[maxPolygon];
+		for (int i = 0; i < count; i++)
+			project(poly[i], halfWidth, halfHeight, px[i], py[i], pz[i]);
+		for (int i = 1; i + 1 < count; i++) {
+			ScreenTriangle st = {
+				{ px[0], px[i], px[i + 1] },
+				{ py[0], py[i], py[i + 1] },
+				{ pz[0], pz[i], pz[i + 1] },
+				{ poly[0].s, poly[i].s, poly[i + 1].s },
+				t
+			};
+			out.push_back(st);
+			stats.emitted++;
+		}
+	}
+}
+
+void clipEdges(const Mesh& mesh, const std::vector<uint32_t>& visible, const ClipSpaceStream& clip, const VertexStream& screen,
+	float viewportWidth, float viewportHeight, std::vector<ScreenLine>& out, ClipStats& stats, std::vector<uint8_t>& facing) {
+	const float halfWidth = 0.5f * viewportWidth;
+	const float halfHeight = 0.5f * viewportHeight;
+	const float guard = guardBandScale(viewportWidth, viewportHeight);
+
+	// One flag per triangle so an edge can look up both of its sides. Only the visible ones are set and they are
+	// cleared again at the end, so the buffer is never zeroed as a whole
+	if (facing.size() < mesh.triangleCount())
+		facing.resize(mesh.triangleCount(), 0);
+	for (uint32_t t : visible)
+		facing[t] = 1;
+
+	for (const MeshEdge& e : mesh.edges) {
+		if (!facing[e.face[0]] && (e.face[1] == MeshEdge::noFace || !facing[e.face[1]]))
+			continue;
+
+		ClipVertex v[2];
+		unsigned codes[2];
+		for (int i = 0; i < 2; i++) {
+			uint32_t idx = e.v[i];
+			v[i] = { clip.x[idx], clip.y[idx], clip.z[idx], clip.w[idx], 0.0f };
+			codes[i] = outcode(v[i], guard);
+		}
+		if (codes[0] & codes[1] & ~OUT_GUARD)
+			continue;
+
+		ScreenLine line;
+		if (((codes[0] | codes[1]) & (OUT_NEAR | OUT_GUARD)) == 0) {
+			for (int i = 0; i < 2; i++) {
+				line.x[i] = screen.x[e.v[i]];
+				line.y[i] = screen.y[e.v[i]];
+			}
+		}
+		else {
+			// Liang-Barsky against the same planes the triangles are cut against
+			float t0 = 0.0f, t1 = 1.0f;
+			bool inside = true;
+			for (int plane = 0; plane < 5 && inside; plane++) {
+				float da = planeDistance(v[0], plane, guard);
+				float db = planeDistance(v[1], plane, guard);
+				if (da < 0.0f && db < 0.0f)
+					inside = false;
+				else if (da < 0.0f)
+					t0 = std::max(t0, da / (da - db));
+				else if (db < 0.0f)
+					t1 = std::min(t1, da / (da - db));
+			}
+			if (!inside || t0 > t1)
+				continue;
+			const float ts[2] = { t0, t1 };
+			for (int i = 0; i < 2; i++) {
+				float t = ts[i];
+				ClipVertex p = {
+					v[0].x + (v[1].x - v[0].x) * t,
+					v[0].y + (v[1].y - v[0].y) * t,
+					v[0].z + (v[1].z - v[0].z) * t,
+					v[0].w + (v[1].w - v[0].w) * t,
+					0.0f
+				};
+				float z;
+				project(p, halfWidth, halfHeight, line.x[i], line.y[i], z);
+			}
+		}
+		out.push_back(line);
+		stats.lines++;
+	}
+
+	for (uint32_t t : visible)
+		facing[t] = 0;
+}
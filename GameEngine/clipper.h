@@ -0,0 +1,83 @@
+#pragma once
+
+#include "geometry.h"
+#include "transform.h"
+
+/*
+* The clip stage sits between the vertex transform and the rasterizer.
+*
+* 1. Backface culling, before anything is projected. A triangle faces away from the camera when the camera
+*    is behind the triangle's plane, which is one dot product against the cached world space normal.
+* 2. Frustum culling, triangles entirely outside one side of the view volume are dropped.
+* 3. Clipping in homogeneous space. Triangles crossing the near plane are cut against it before the
+*    perspective divide, so no vertex behind the camera is ever divided by a negative or zero w. Triangles
+*    reaching past the guard band are cut against it as well so the rasterizer's fixed point maths never
+*    overflows. Everything else is only clipped to the screen by the rasterizer's bounding box.
+*/
+
+// A triangle ready for the rasterizer, screen space x and y, depth z and light level per corner
+struct ScreenTriangle
+{
+	float x[3];
+	float y[3];
+	float z[3];
+	// 0 to 1, see lighting.h, 1 unless the triangle was lit
+	float shade[3];
+	// The mesh triangle this came from, clipping can produce two ScreenTriangles for one mesh triangle
+	uint32_t id;
+};
+
+// A wireframe edge ready for the line drawer, screen space x and y per end
+struct ScreenLine
+{
+	float x[2];
+	float y[2];
+};
+
+// Per frame counters of what the clip stage did with the mesh
+struct ClipStats
+{
+	uint32_t input = 0;
+	uint32_t backfaceCulled = 0;
+	uint32_t frustumCulled = 0;
+	// Triangles that had to be cut against the near plane or the guard band
+	uint32_t clipped = 0;
+	// ScreenTriangles handed to the rasterizer
+	uint32_t emitted = 0;
+	// ScreenLines handed to the line drawer in wireframe mode
+	uint32_t lines = 0;
+	void reset() { *this = ClipStats(); }
+};
+
+/*
+* Plane offset of every triangle, plane t is dot(worldNormals[t], p) = planeOffsets[t] through the first
+* corner in world space. Like the world normals it only changes when the mesh moves.
+*/
+void computePlaneOffsets(const mat4x4& world, const Mesh& mesh, const VertexStream& worldNormals, std::vector<float>& planeOffsets);
+
+/*
+* Collect the triangles facing the camera, SIMD_WIDTH triangles at a time.
+* A triangle faces the camera when the camera lies in front of its plane, dot(normal, camera) > offset.
+*/
+void cullBackfaces(const VertexStream& worldNormals, const std::vector<float>& planeOffsets, const vec3& cameraPos,
+	std::vector<uint32_t>& visible, ClipStats& stats);
+
+/*
+* Frustum cull and clip the visible triangles of mesh and append the result to out.
+* clip and screen are the outputs of transformVertices for the mesh's vertices.
+* vertexLight, when given, is a light level per vertex that becomes ScreenTriangle::shade, interpolated like the
+* position where a triangle is cut.
+*/
+void clipTriangles(const Mesh& mesh, const std::vector<uint32_t>& visible, const ClipSpaceStream& clip, const VertexStream& screen,
+	float viewportWidth, float viewportHeight, std::vector<ScreenTriangle>& out, ClipStats& stats, const float* vertexLight = nullptr);
+
+/*
+* Frustum cull and clip the wireframe of the visible triangles of mesh and append the result to out.
+* Every edge in mesh.edges is emitted at most once, when at least one of the triangles on either side of it
+* is visible, so an edge shared by two triangles is not drawn twice. Edges are cut against the near plane and
+* the guard band in homogeneous space just like triangles.
+* facing is scratch space, a flag per triangle, owned by the caller so repeated calls never allocate. It is left
+* all zeros, pass the same vector every time and never touch it otherwise.
+*/
+void clipEdges(const Mesh& mesh, const std::vector<uint32_t>& visible, const ClipSpaceStream& clip, const VertexStream& screen,
+	float viewportWidth, float viewportHeight, std::vector<ScreenLine>& out, ClipStats& stats, std::vector<uint8_t>& facing);
@@ -1,80 +1,126 @@
 ﻿#pragma once
 
-#include <Windows.h>
+#include "platform.h"
 #include <iostream>
 #include <thread>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <utility>
+#include "ansiterminal.h"
+#include "framecapture.h"
+#include "framebuffer.h"
+#include "profiler.h"
 #include "geometry.h"
-
-enum COLOUR
+#include "lighting.h"
+#include "raster.h"
+#include "supersample.h"
+#include "tilerenderer.h"
+#include "threadpool.h"
+#include "framescheduler.h"
+
+// Where the console's frames go
+enum class ConsoleTarget
 {
-	FG_BLACK = 0x0000,
-	FG_DARK_BLUE = 0x0001,
-	FG_DARK_GREEN = 0x0002,
-	FG_DARK_CYAN = 0x0003,
-	FG_DARK_RED = 0x0004,
-	FG_DARK_MAGENTA = 0x0005,
-	FG_DARK_YELLOW = 0x0006,
-	FG_GREY = 0x0007,
-	FG_DARK_GREY = 0x0008,
-	FG_BLUE = 0x0009,
-	FG_GREEN = 0x000A,
-	FG_CYAN = 0x000B,
-	FG_RED = 0x000C,
-	FG_MAGENTA = 0x000D,
-	FG_YELLOW = 0x000E,
-	FG_WHITE = 0x000F,
-	BG_BLACK = 0x0000,
-	BG_DARK_BLUE = 0x0010,
-	BG_DARK_GREEN = 0x0020,
-	BG_DARK_CYAN = 0x0030,
-	BG_DARK_RED = 0x0040,
-	BG_DARK_MAGENTA = 0x0050,
-	BG_DARK_YELLOW = 0x0060,
-	BG_GREY = 0x0070,
-	BG_DARK_GREY = 0x0080,
-	BG_BLUE = 0x0090,
-	BG_GREEN = 0x00A0,
-	BG_CYAN = 0x00B0,
-	BG_RED = 0x00C0,
-	BG_MAGENTA = 0x00D0,
-	BG_YELLOW = 0x00E0,
-	BG_WHITE = 0x00F0,
-};
-
-/*
-•	PIXEL_SOLID (0x2588): Represents a solid block character (█).
-•	PIXEL_THREEQUARTERS (0x2593): Represents a three-quarters block character (▓).
-•	PIXEL_HALF (0x2592): Represents a half block character (▒).
-•	PIXEL_QUARTER (0x2591): Represents a quarter block character (░).
-*/
-enum PIXEL_TYPE
-{
-	PIXEL_SOLID = 0x2588,
-	PIXEL_THREEQUARTERS = 0x2593,
-	PIXEL_HALF = 0x2592,
-	PIXEL_QUARTER = 0x2591,
+	// The Windows console, or the terminal everywhere else
+	Screen,
+	// Nowhere, frames only exist in memory, for benchmarks and automated checks that run without a window
+	Headless,
 };
 
 class console {
 private:
 	short m_screenWidth;
 	short m_screenHeight;
+#ifdef GAMEENGINE_WIN32_CONSOLE
 	// Reference to the console output screen buffer
 	HANDLE m_hConsole;
 	// Reference to the console input buffer (Keyboard, mouse...)
 	HANDLE m_hConsoleIn;
-	CHAR_INFO* m_screenBuffer;
+#else
+	// Everywhere but the Windows console the frame is presented to the terminal with escape sequences
+	AnsiTerminal m_terminal;
+#endif
+	// What the last render cost
+	PresentStats m_presentStats;
+	// Drawing works as usual but nothing is presented and no operating system console is touched
+	bool m_headless = false;
+	/*
+	* Triple buffered frames so the present of one frame overlaps the drawing of the next.
+	* At any time one frame is being drawn (m_back, the screen buffer), one is being presented (m_front) and the third
+	* is the latest finished frame waiting to be presented (m_ready). submitFrame and presentLatest swap their frame
+	* with the waiting one in a single atomic exchange, so the drawing and present threads never lock or wait on
+	* each other. When drawing is faster than presenting the waiting frame is replaced and the older one is never shown.
+	* Only a present thread with nothing to present waits, asleep in waitForFrame until submitFrame wakes it.
+	*/
+	static const int frameCount = 3;
+	// Set in m_ready when the waiting frame has not been presented yet
+	static const int freshFrame = 4;
+	// Drawn in ConsoleCells, a byte each unless GAMEENGINE_WIDE_CELLS, see framebuffer.h
+	Framebuffer<ConsoleCell> m_frames[frameCount];
+	// Only touched by the drawing thread
+	int m_back = 0;
+	// Only touched by the present thread
+	int m_front = 1;
+	std::atomic<int> m_ready{ 2 };
+	// Finished frames replaced before they were presented, only touched by the drawing thread
+	uint64_t m_droppedFrames = 0;
+	std::atomic<uint64_t> m_presentedFrames{ 0 };
+	// Wakes the present thread in waitForFrame, the mutex only guards the sleep, never the frames
+	std::mutex m_presentMutex;
+	std::condition_variable m_presentWake;
+	bool m_presentStopped = false;
+	// The cells of the frame being drawn, always m_frames[m_back]
+	ConsoleCell* m_screenBuffer;
+	// The frame being presented expanded to CHAR_INFO, only touched by whichever thread presents
+	std::vector<CHAR_INFO> m_presentCells;
+	// One depth value per character cell, used by fillTriangle for hidden surface removal
+	float* m_depthBuffer;
+	// Splits the screen into tiles for fillTriangles
+	TileRenderer m_tiles{ 0, 0 };
+	// The light level plane of every triangle fillTrianglesLit draws, kept so a frame does not allocate
+	std::vector<ShadePlane> m_shadePlanes;
+	// Where fillTriangles and drawLines draw while supersampling is on, see setSupersampling
+	SupersampleBuffer m_samples;
+	// The colour of the last geometry drawn into m_samples, and the shades it resolves to
+	short m_sampleColour = FG_WHITE;
+	ShadeTable<ConsoleCell> m_shades;
 	std::wstring m_appName;
+#ifdef GAMEENGINE_WIN32_CONSOLE
 	// To select a window size
 	SMALL_RECT m_windowCoord;
+#endif
+
+	void createBuffers() {
+		// Allocate memory for the screen buffers
+		for (int i = 0; i < frameCount; i++)
+			m_frames[i] = Framebuffer<ConsoleCell>(m_screenWidth, m_screenHeight);
+		if (!m_headless)
+			m_presentCells.resize(static_cast<size_t>(m_screenWidth) * m_screenHeight);
+		m_screenBuffer = m_frames[m_back].data();
+		m_depthBuffer = new float[m_screenWidth * m_screenHeight];
+		clearDepth();
+		m_tiles = TileRenderer(m_screenWidth, m_screenHeight);
+	}
 public:
 	console() {
 		// height and width are in characters
 		m_screenHeight = 100;
 		m_screenWidth = 100;
+		m_appName = L"GameEngine";
+		m_screenBuffer = nullptr;
+		m_depthBuffer = nullptr;
+
+#ifdef GAMEENGINE_WIN32_CONSOLE
 		m_hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
 		m_hConsoleIn = GetStdHandle(STD_INPUT_HANDLE);
-		m_appName = L"GameEngine";
 		m_windowCoord = { 0, 0, 1, 1 };
 
 		try {
@@ -93,22 +139,38 @@ public:
 			m_windowCoord = { 0, 0, static_cast<short>(m_screenWidth - 1), static_cast<short>(m_screenHeight - 1) };
 			SetConsoleWindowInfo(m_hConsole, TRUE, &m_windowCoord);
 
-			// Allocate memory for the screen buffer
-			m_screenBuffer = new CHAR_INFO[m_screenWidth * m_screenHeight];
-			memset(m_screenBuffer, 0, sizeof(CHAR_INFO) * m_screenWidth * m_screenHeight);
+			createBuffers();
 		}
 		catch (const std::exception& e) {
 			std::cerr << "Exception: " << e.what() << std::endl;
 		}
+#else
+		createBuffers();
+		m_terminal.open(m_screenWidth, m_screenHeight);
+#endif
 	}
 
-	console(short int width, short int height, short int fontWidth, short int fontHeight) {
+	console(short int width, short int height, short int fontWidth, short int fontHeight, ConsoleTarget target = ConsoleTarget::Screen) {
 		m_screenHeight = height;
 		m_screenWidth = width;
-		m_hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-		m_hConsoleIn = GetStdHandle(STD_INPUT_HANDLE);
 		m_appName = L"GameEngine";
 		m_screenBuffer = nullptr;
+		m_depthBuffer = nullptr;
+
+		if (target == ConsoleTarget::Headless) {
+			m_headless = true;
+#ifdef GAMEENGINE_WIN32_CONSOLE
+			m_hConsole = INVALID_HANDLE_VALUE;
+			m_hConsoleIn = INVALID_HANDLE_VALUE;
+			m_windowCoord = { 0, 0, static_cast<short>(m_screenWidth - 1), static_cast<short>(m_screenHeight - 1) };
+#endif
+			createBuffers();
+			return;
+		}
+
+#ifdef GAMEENGINE_WIN32_CONSOLE
+		m_hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+		m_hConsoleIn = GetStdHandle(STD_INPUT_HANDLE);
 
 		try {
 
@@ -154,9 +216,7 @@ public:
 			if(!SetConsoleWindowInfo(m_hConsole, TRUE, &m_windowCoord))
 				throw std::runtime_error("SetConsoleWindowInfo failed");
 
-			// Allocate memory for the screen buffer
-			m_screenBuffer = new CHAR_INFO[m_screenWidth * m_screenHeight];
-			memset(m_screenBuffer, 0, sizeof(CHAR_INFO) * m_screenWidth * m_screenHeight);
+			createBuffers();
 
 			SetConsoleTitle(m_appName.c_str());
 
@@ -164,40 +224,57 @@ public:
 		catch (const std::exception& e) {
             std::cerr << "Exception: " << e.what() << std::endl;
 		}
+#else
+		// The terminal's font is the user's choice
+		(void)fontWidth;
+		(void)fontHeight;
+		createBuffers();
+		m_terminal.open(m_screenWidth, m_screenHeight);
+#endif
 	}
 
 	~console() {
-		delete[] m_screenBuffer;
+		delete[] m_depthBuffer;
 	}
 
 	void draw(int x, int y, short c = PIXEL_SOLID, short color = FG_WHITE) {
-		if (x >= 0 && x < m_screenWidth && y >= 0 && y < m_screenHeight) {
-			m_screenBuffer[y * m_screenWidth + x].Char.UnicodeChar = c;
-			m_screenBuffer[y * m_screenWidth + x].Attributes = color;
-		}
+		if (x >= 0 && x < m_screenWidth && y >= 0 && y < m_screenHeight)
+			m_screenBuffer[y * m_screenWidth + x] = ConsoleCell::make(c, color);
 	}
 
 	void drawLine(int x1, int y1, int x2, int y2, short c = PIXEL_SOLID, short color = FG_WHITE) {
-		// Uses DDAs algorithm to draw a line between two points
-		// How this works is that it calculates the slope of the line and then
-		// increments the x and y values by the slope until it reaches the end point
-		// Basically, when we move one pixel in the x direction, we move the slope in the y direction
-		int dx = x2 - x1;
-		int dy = y2 - y1;
-		// Steps is the number of pixels we need to draw, which is the maximum of the absolute value of dx and dy
-		// This is because we need to draw the longest distance
-		int steps = (abs(dx) > abs(dy) ? abs(dx) : abs(dy));
-		// Calculate the increment in x and y direction
-		float Xinc = dx / (float)steps;
-		float Yinc = dy / (float)steps;
-		// Start drawing from the first point
-		float X = static_cast<float>(x1);
-		float Y = static_cast<float>(y1);
-		for (int i = 0; i <= steps; i++) {
-			draw(static_cast<int>(X), static_cast<int>(Y), c, color);
-			X += Xinc;
-			Y += Yinc;
+		// Bresenham style, the line steps one cell at a time along its longer axis and the error term
+		// decides when to also step along the shorter one, all in integers
+		// The line is clipped to the screen before the first cell, so cells are written without the bounds check in draw()
+		if (!m_screenBuffer)
+			return;
+		ConsoleCell* screen = m_screenBuffer;
+		const int width = m_screenWidth;
+		const ConsoleCell cell = ConsoleCell::make(c, color);
+		raster::drawLine(static_cast<float>(x1), static_cast<float>(y1), static_cast<float>(x2), static_cast<float>(y2),
+			0, 0, m_screenWidth, m_screenHeight,
+			[screen, width, cell](int px, int py) {
+				screen[py * width + px] = cell;
+			});
+	}
+
+	// Draw a batch of lines, typically the wireframe edges from the clip stage, each one exactly once
+	void drawLines(const std::vector<ScreenLine>& lines, short c = PIXEL_SOLID, short color = FG_WHITE) {
+		if (!m_screenBuffer)
+			return;
+		if (m_samples.factor() > 1) {
+			m_sampleColour = color;
+			m_samples.drawLines(lines);
+			return;
 		}
+		ConsoleCell* screen = m_screenBuffer;
+		const int width = m_screenWidth;
+		const ConsoleCell cell = ConsoleCell::make(c, color);
+		auto plot = [screen, width, cell](int px, int py) {
+			screen[py * width + px] = cell;
+		};
+		for (const ScreenLine& line : lines)
+			raster::drawLine(line.x[0], line.y[0], line.x[1], line.y[1], 0, 0, m_screenWidth, m_screenHeight, plot);
 	}
 
 	void drawTriangle(int x1, int y1, int x2, int y2, int x3, int y3, short c = 0x2588, short col = 0x000F)
@@ -207,18 +284,257 @@ public:
 		drawLine(x3, y3, x1, y1, c, col);
 	}
 
-	// To render the screen buffer to the console
+	// Reset every cell of the depth buffer to the far plane, call once per frame before fillTriangle
+	void clearDepth() {
+		if (m_depthBuffer)
+			std::fill(m_depthBuffer, m_depthBuffer + m_screenWidth * m_screenHeight, FLT_MAX);
+		if (m_samples.factor() > 1)
+			m_samples.clearDepth();
+	}
+
+	/*
+	* Draw a solid triangle with hidden surface removal.
+	* Each vertex is a screen space x, y and a depth z (smaller is closer), the depth is interpolated
+	* across the triangle and a cell is only drawn if it is closer than what the depth buffer already holds.
+	* Returns the number of cells drawn.
+	*/
+	int fillTriangle(float x1, float y1, float z1, float x2, float y2, float z2, float x3, float y3, float z3,
+		short c = PIXEL_SOLID, short col = FG_WHITE) {
+		if (!m_screenBuffer || !m_depthBuffer)
+			return 0;
+		const float x[3] = { x1, x2, x3 };
+		const float y[3] = { y1, y2, y3 };
+		const float z[3] = { z1, z2, z3 };
+		ConsoleCell* screen = m_screenBuffer;
+		const int width = m_screenWidth;
+		const ConsoleCell cell = ConsoleCell::make(c, col);
+		// The rasterizer already clips to the screen, so the cell is written without the bounds check in draw()
+		return raster::fillTriangle(x, y, z, 0, 0, m_screenWidth, m_screenHeight, m_depthBuffer, m_screenWidth,
+			[screen, width, cell](int px, int py) {
+				screen[py * width + px] = cell;
+			});
+	}
+
+	/*
+	* Draw a batch of solid, depth tested triangles, typically the output of the clip stage.
+	* The triangles are binned into screen tiles and the tiles are rasterized in parallel on pool,
+	* the result is identical to calling fillTriangle on each triangle in order.
+	*/
+	void fillTriangles(const std::vector<ScreenTriangle>& triangles, ThreadPool& pool, short c = PIXEL_SOLID, short col = FG_WHITE) {
+		if (!m_screenBuffer || !m_depthBuffer)
+			return;
+		if (m_samples.factor() > 1) {
+			m_sampleColour = col;
+			m_samples.fillTriangles(triangles, pool);
+			return;
+		}
+		m_tiles.bin(triangles);
+		ConsoleCell* screen = m_screenBuffer;
+		const int width = m_screenWidth;
+		const ConsoleCell cell = ConsoleCell::make(c, col);
+		// Every tile owns its cells, so these writes never race
+		m_tiles.rasterize(triangles, m_depthBuffer, pool, [screen, width, cell](int px, int py, uint32_t) {
+			screen[py * width + px] = cell;
+		});
+	}
+
+	/*
+	* Draw a batch of depth tested triangles shaded by their light level. ScreenTriangle::shade is interpolated
+	* across each triangle (it is the same at every corner for flat shading), scaled to the levels of ramp and
+	* looked up there. With dither the level is offset by a 4x4 ordered dither pattern before it is cut to a whole
+	* level, so a surface between two levels comes out as a mix of both rather than a band of one.
+	* Per pixel there is no branch, the same plane evaluation, clamp and table load for every pixel.
+	* While supersampling the samples take each triangle's average level instead, in the ramp's colour.
+	*/
+	void fillTrianglesLit(const std::vector<ScreenTriangle>& triangles, ThreadPool& pool, const LightRamp<ConsoleCell>& ramp, bool dither) {
+		if (!m_screenBuffer || !m_depthBuffer)
+			return;
+		if (m_samples.factor() > 1) {
+			m_sampleColour = ramp.colour;
+			m_samples.fillTriangles(triangles, pool, true);
+			return;
+		}
+		computeShadePlanes(triangles, m_shadePlanes);
+		m_tiles.bin(triangles);
+		ConsoleCell* screen = m_screenBuffer;
+		const int width = m_screenWidth;
+		const ShadePlane* planes = m_shadePlanes.data();
+		const ConsoleCell* cells = ramp.cells;
+		const float* threshold = dither ? orderedDither : noDither;
+		const int levels = LightRamp<ConsoleCell>::levels;
+		m_tiles.rasterize(triangles, m_depthBuffer, pool, [=](int px, int py, uint32_t i) {
+			const ShadePlane& p = planes[i];
+			float level = (p.a + p.b * px + p.c * py) * (levels - 1) + threshold[(py & 3) * 4 + (px & 3)];
+			int index = std::min(std::max(static_cast<int>(level), 0), levels - 1);
+			screen[py * width + px] = cells[index];
+		});
+	}
+
+	/*
+	* Anti-aliased geometry: with factor 2 or 4, fillTriangles and drawLines draw into factor x factor samples per
+	* cell instead of the cells, and resolveSamples turns the samples into shade glyphs, see supersample.h. The
+	* glyph passed to them is not used, the coverage picks the glyph. 1 turns it off and frees the samples.
+	*/
+	void setSupersampling(int factor) {
+		if (factor == 2 || factor == 4)
+			m_samples = SupersampleBuffer(m_screenWidth, m_screenHeight, factor);
+		else
+			m_samples = SupersampleBuffer();
+	}
+	int supersampling() const { return m_samples.factor(); }
+
+	/*
+	* Draw what fillTriangles and drawLines put into the samples this frame into the cells, in the colour of the last
+	* of them, and empty the samples. Call once the geometry is drawn and before anything that should go on top of it.
+	* Does nothing when supersampling is off.
+	*/
+	void resolveSamples() {
+		if (!m_screenBuffer || m_samples.factor() <= 1)
+			return;
+		PROFILE_ZONE("resolve");
+		if (m_shades.colour != m_sampleColour)
+			m_shades.build(m_sampleColour);
+		m_samples.resolve(m_screenBuffer, m_shades);
+	}
+
+	// To render the screen buffer to the console, on the calling thread
 	void render() {
+		if (!m_screenBuffer)
+			return;
+		present(m_frames[m_back]);
+	}
+
+	/*
+	* Hand the finished frame to the present thread and start drawing the next one, see m_frames.
+	* The next frame's buffer still holds an older frame, so draw every cell of it (the way a frame starts with fill).
+	*/
+	void submitFrame() {
+		if (!m_screenBuffer)
+			return;
+		// Release publishes the cells drawn into the frame, acquire makes sure the present thread is done with the frame we get back
+		int previous = m_ready.exchange(m_back | freshFrame, std::memory_order_acq_rel);
+		if (previous & freshFrame)
+			m_droppedFrames++;
+		m_back = previous & ~freshFrame;
+		m_screenBuffer = m_frames[m_back].data();
+		// Taking the mutex orders the new frame before a waitForFrame that is about to sleep, so the wake is not lost
+		{
+			std::lock_guard<std::mutex> lock(m_presentMutex);
+		}
+		m_presentWake.notify_one();
+	}
+
+	/*
+	* Sleep the present thread until a submitted frame is waiting or stopPresenting is called.
+	* Returns false for the stop, which it consumes so presenting can start again later.
+	*/
+	bool waitForFrame() {
+		std::unique_lock<std::mutex> lock(m_presentMutex);
+		m_presentWake.wait(lock, [this]() { return m_presentStopped || (m_ready.load(std::memory_order_acquire) & freshFrame); });
+		if (m_presentStopped) {
+			m_presentStopped = false;
+			return false;
+		}
+		return true;
+	}
+
+	// Make waitForFrame return false, called once nothing more will be submitted
+	void stopPresenting() {
+		{
+			std::lock_guard<std::mutex> lock(m_presentMutex);
+			m_presentStopped = true;
+		}
+		m_presentWake.notify_one();
+	}
+
+	/*
+	* Present the latest submitted frame if there is one that was not presented yet, called from the present thread.
+	* Returns whether a frame was presented.
+	*/
+	bool presentLatest() {
+		// m_screenBuffer belongs to the drawing thread, m_frames does not change once created
+		if (!m_frames[0].data() || !(m_ready.load(std::memory_order_acquire) & freshFrame))
+			return false;
+		int previous = m_ready.exchange(m_front, std::memory_order_acq_rel);
+		m_front = previous & ~freshFrame;
+		present(m_frames[m_front]);
+		m_presentedFrames.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	uint64_t presentedFrames() const { return m_presentedFrames.load(std::memory_order_relaxed); }
+	uint64_t droppedFrames() const { return m_droppedFrames; }
+
+private:
+	void present(const Framebuffer<ConsoleCell>& frame) {
+		PROFILE_ZONE("present");
+		if (m_headless) {
+			m_presentStats = PresentStats();
+			return;
+		}
+		// Drawing never touches CHAR_INFO, the frame is only expanded here on its way out
+		frame.expand(m_presentCells.data());
+		const CHAR_INFO* cells = m_presentCells.data();
+#ifdef GAMEENGINE_WIN32_CONSOLE
+		auto start = std::chrono::steady_clock::now();
 		// Write the screen buffer to the console output
-		WriteConsoleOutput(m_hConsole, m_screenBuffer, { m_screenWidth, m_screenHeight }, { 0, 0 }, &m_windowCoord);
+		WriteConsoleOutput(m_hConsole, cells, { m_screenWidth, m_screenHeight }, { 0, 0 }, &m_windowCoord);
+		// The console always takes the whole buffer
+		m_presentStats.bytes = sizeof(CHAR_INFO) * m_screenWidth * m_screenHeight;
+		m_presentStats.changedCells = static_cast<uint32_t>(m_screenWidth * m_screenHeight);
+		m_presentStats.nanoseconds = static_cast<uint64_t>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+#else
+		// Only the cells that changed since the last frame are sent
+		m_terminal.present(cells, m_screenWidth, m_screenHeight);
+		m_presentStats = m_terminal.lastStats();
+#endif
+	}
+
+public:
+
+	short getWidth() const { return m_screenWidth; }
+	short getHeight() const { return m_screenHeight; }
+	bool isHeadless() const { return m_headless; }
+	// The cells drawn so far this frame, width * height of them row by row
+	const ConsoleCell* getBuffer() const { return m_screenBuffer; }
+	// The same expanded to CHAR_INFO, out is resized to width * height
+	void copyBuffer(std::vector<CHAR_INFO>& out) const {
+		out.resize(static_cast<size_t>(m_screenWidth) * m_screenHeight);
+		if (m_screenBuffer)
+			m_frames[m_back].expand(out.data());
+	}
+
+	// Bytes written, cells changed and time taken by the last render
+	// Written by the thread that presents, so while engine's present thread runs only read it from there
+	const PresentStats& presentStats() const {
+		return m_presentStats;
+	}
+
+	// Read the keyboard, call once per frame before keyDown
+	void pollInput() {
+#ifndef GAMEENGINE_WIN32_CONSOLE
+		if (!m_headless)
+			m_terminal.pollInput();
+#endif
+	}
+
+	// Whether key (an upper case letter or a virtual key code) is down
+	bool keyDown(int key) const {
+		// A headless console has no keyboard
+		if (m_headless)
+			return false;
+#ifdef GAMEENGINE_WIN32_CONSOLE
+		return (GetAsyncKeyState(key) & 0x8000) != 0;
+#else
+		return m_terminal.keyDown(key);
+#endif
 	}
 
+	// Every cell from (x1, y1) to (x2, y2) inclusive, a row at a time
 	void fill(int x1, int y1, int x2, int y2, short c = PIXEL_SOLID, short color = FG_WHITE) {
-		for (int x = x1; x <= x2; x++) {
-			for (int y = y1; y <= y2; y++) {
-				draw(x, y, c, color);
-			}
-		}
+		if (m_screenBuffer)
+			m_frames[m_back].fill(x1, y1, x2, y2, ConsoleCell::make(c, color));
 	}
 };
 
@@ -236,10 +552,10 @@ public:
 	vec3 m_right;
 	// This is the vector which gives the y direction of the camera, this is derived from the cross product of x and z
 	vec3 m_up;
-	// The speed at which the camera moves
+	// The speed at which the camera moves, in world units per second
 	float m_speed;
 	camera() {
-		m_speed = 0.5f;
+		m_speed = 3.0f;
 		m_pos = { 0.0, 0.0, 3.0 };
 		m_target = { 0.0 , 0.0 , 0.0 };
 		updateCameraFields();
@@ -256,24 +572,25 @@ public:
 
 		m_up = cross_product(m_forward, m_right);
 	}
-	void updateCameraForward() {
-		m_pos = vec3_add(m_pos, vec3_mul(m_forward, m_speed));
+	// The moves take the time they cover in seconds, so the camera moves as fast whatever the frame or step rate
+	void updateCameraForward(float dt) {
+		m_pos = vec3_add(m_pos, vec3_mul(m_forward, m_speed * dt));
 		updateCameraFields();
 	}
-	void updateCameraBackward() {
-		m_pos = vec3_sub(m_pos, vec3_mul(m_forward, m_speed));
+	void updateCameraBackward(float dt) {
+		m_pos = vec3_sub(m_pos, vec3_mul(m_forward, m_speed * dt));
 		updateCameraFields();
 	}
-	void updateCameraRight() {
+	void updateCameraRight(float dt) {
 		vec3 cp = cross_product(m_forward, m_up);
 		normalize(cp);
-		m_pos = vec3_add(m_pos, vec3_mul(cp, m_speed));
+		m_pos = vec3_add(m_pos, vec3_mul(cp, m_speed * dt));
 		updateCameraFields();
 	}
-	void updateCameraLeft() {
+	void updateCameraLeft(float dt) {
 		vec3 cp = cross_product(m_forward, m_up);
 		normalize(cp);
-		m_pos = vec3_sub(m_pos, vec3_mul(cp, m_speed));
+		m_pos = vec3_sub(m_pos, vec3_mul(cp, m_speed * dt));
 		updateCameraFields();
 	}
 };
@@ -281,30 +598,146 @@ public:
 class engine {
 private:
 	static std::atomic<bool> m_engineActive;
+	// Set by requestRedraw, cleared when a frame is drawn
+	bool m_redraw = true;
+	// Whether presentThread is running, then finished frames are submitted to it instead of presented in place
+	bool m_pipelined = false;
 	void engineMainThread() {
+		m_scheduler.start();
 		while (m_engineActive) {
-			updateFrame();
-			m_console.render();
+			PROFILE_BEGIN_FRAME();
+			int steps = m_scheduler.beginFrame();
+			// Input is only read when a step will look at it, a key pressed between steps waits for the next one
+			if (steps > 0)
+				m_console.pollInput();
+			for (int i = 0; i < steps; i++)
+				fixedUpdate(static_cast<float>(m_scheduler.fixedStep()));
+
+			bool draw = m_scheduler.shouldRender(m_redraw);
+			if (draw) {
+				m_redraw = false;
+				alpha = m_scheduler.alpha();
+				deltaTime = m_scheduler.frameDelta();
+				updateFrame();
+				if (m_pipelined)
+					m_console.submitFrame();
+				else
+					m_console.render();
+				PROFILE_END_FRAME();
+			}
+			m_scheduler.endFrame(draw);
 		}
+		if (m_pipelined)
+			m_console.stopPresenting();
+	}
+	// Presents every frame the main thread submits while it simulates and draws the next one
+	void presentThread() {
+		// Asleep whenever there is nothing to present, an idle engine wakes it only for the frames it draws
+		while (m_console.waitForFrame())
+			m_console.presentLatest();
+		// The last frame submitted before stop
+		m_console.presentLatest();
 	}
 protected:
+	// Seconds between the last two drawn frames
 	float deltaTime = 0.0f;
-	float lastFrame = 0.0f;
+	// How far the drawn frame is between the previous and the latest fixedUpdate, 0 to 1, see FrameScheduler
+	float alpha = 1.0f;
 public:
 	console m_console;
 	camera m_camera;
+	// Worker threads shared by the parallel stages of the frame, one per hardware thread
+	ThreadPool m_pool;
+	// When to simulate and when to draw, configure it before start
+	FrameScheduler m_scheduler;
 	engine() : m_console(), m_camera() {
 	}
 
-	engine(short int width, short int height, short int fontWidth, short int fontHeight) : m_console(width, height, fontWidth, fontHeight), m_camera() {
+	engine(short int width, short int height, short int fontWidth, short int fontHeight, ConsoleTarget target = ConsoleTarget::Screen)
+		: m_console(width, height, fontWidth, fontHeight, target), m_camera() {
 	}
 
 	void start() {
 		m_engineActive = true;
+		// A headless console has nothing to present, everywhere else presenting a frame overlaps drawing the next
+		m_pipelined = !m_console.isHeadless();
+		std::thread present;
+		if (m_pipelined)
+			present = std::thread(&engine::presentThread, this);
 		std::thread t = std::thread(&engine::engineMainThread,this);
 		t.join();
+		if (present.joinable())
+			present.join();
+	}
+
+	// Make start return after the current frame, callable from updateFrame or another thread
+	void stop() {
+		m_engineActive = false;
+	}
+
+	// What runFrames measured
+	struct FrameRun
+	{
+		int frames = 0;
+		double seconds = 0.0;
+		// Frame number and hash of every captured frame, in order
+		std::vector<std::pair<int, uint64_t>> captures;
+	};
+
+	/*
+	* Run frames frames back to back as fast as possible on the calling thread, meant for a headless console.
+	* Every frame whose number (counting from 0) is in captureFrames is hashed and, if capturePath is not empty,
+	* saved as capturePath_<frame>.txt and capturePath_<frame>.ppm, see framecapture.h.
+	* Every frame runs exactly one fixedUpdate and is drawn with alpha 1, so the frames do not depend on
+	* how fast the machine is. The hashing and saving is not counted in seconds.
+	*/
+	FrameRun runFrames(int frames, const std::vector<int>& captureFrames = {}, const std::string& capturePath = "") {
+		FrameRun run;
+		std::vector<CHAR_INFO> captured;
+		std::chrono::steady_clock::duration busy{};
+		for (int frame = 0; frame < frames; frame++) {
+			auto start = std::chrono::steady_clock::now();
+			PROFILE_BEGIN_FRAME();
+			m_console.pollInput();
+			fixedUpdate(static_cast<float>(m_scheduler.fixedStep()));
+			m_redraw = false;
+			alpha = 1.0f;
+			deltaTime = static_cast<float>(m_scheduler.fixedStep());
+			updateFrame();
+			m_console.render();
+			PROFILE_END_FRAME();
+			busy += std::chrono::steady_clock::now() - start;
+			run.frames++;
+
+			if (std::find(captureFrames.begin(), captureFrames.end(), frame) == captureFrames.end())
+				continue;
+			if (!m_console.getBuffer())
+				continue;
+			m_console.copyBuffer(captured);
+			const CHAR_INFO* cells = captured.data();
+			int width = m_console.getWidth(), height = m_console.getHeight();
+			run.captures.push_back({ frame, hashFrame(cells, width, height) });
+			if (!capturePath.empty()) {
+				std::string name = capturePath + "_" + std::to_string(frame);
+				writeFrameText(name + ".txt", cells, width, height);
+				writeFramePPM(name + ".ppm", cells, width, height);
+			}
+		}
+		run.seconds = std::chrono::duration<double>(busy).count();
+		return run;
+	}
+
+	// Ask for the next frame to be drawn, in idle mode frames nobody asked for are skipped
+	void requestRedraw() {
+		m_redraw = true;
+	}
+
+	// Advance the simulation by dt seconds, called at the scheduler's fixed step rate with input already polled
+	virtual void fixedUpdate(float dt) {
+		(void)dt;
 	}
 
+	// Draw the frame, interpolating the simulation by alpha
 	virtual void updateFrame() = 0;
 };
 
@@ -0,0 +1,53 @@
+#include "framebuffer.h"
+#include "simd.h"
+
+#if defined(SIMD_AVX) || defined(SIMD_SSE)
+#include <emmintrin.h>
+#define FRAMEBUFFER_SSE 1
+#endif
+
+static_assert(sizeof(PaletteCell) == 1, "a palette cell is one byte");
+static_assert(sizeof(CHAR_INFO) == 4, "expand writes CHAR_INFO as a 16 bit glyph followed by 16 bit attributes");
+
+// The glyph of every class, the classes make never produces are solid like the glyphs they stand for
+static const unsigned short classGlyphs[16] = {
+	0x0020, 0x2591, 0x2592, 0x2593, 0x2588, 0x2588, 0x2588, 0x2588,
+	0x2588, 0x2588, 0x2588, 0x2588, 0x2588, 0x2588, 0x2588, 0x2588,
+};
+
+void PaletteCell::expand(const PaletteCell* in, CHAR_INFO* out, size_t count) {
+	const uint8_t* cells = reinterpret_cast<const uint8_t*>(in);
+	size_t i = 0;
+#ifdef FRAMEBUFFER_SSE
+	// 16 cells a load. Each byte is widened to 16 bits, the glyph worked out from the class with compares (SSE2
+	// has no byte shuffle to look it up) and glyphs and colours interleaved into CHAR_INFO pairs.
+	// AVX1 has no 256 bit integer instructions, so this is SSE2 in AVX builds too
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i colourMask = _mm_set1_epi16(0x0F);
+	const __m128i shadeBase = _mm_set1_epi16(0x2590);
+	const __m128i solid = _mm_set1_epi16(0x2588);
+	const __m128i space = _mm_set1_epi16(0x0020);
+	const __m128i lastShade = _mm_set1_epi16(ThreeQuarters);
+	auto expand8 = [&](__m128i v, CHAR_INFO* dst) {
+		__m128i colour = _mm_and_si128(v, colourMask);
+		__m128i glyphClass = _mm_srli_epi16(v, 4);
+		// Quarter, half and three quarters are 0x2591 to 0x2593
+		__m128i glyph = _mm_add_epi16(glyphClass, shadeBase);
+		__m128i isSolid = _mm_cmpgt_epi16(glyphClass, lastShade);
+		glyph = _mm_or_si128(_mm_and_si128(isSolid, solid), _mm_andnot_si128(isSolid, glyph));
+		__m128i isSpace = _mm_cmpeq_epi16(glyphClass, zero);
+		glyph = _mm_or_si128(_mm_and_si128(isSpace, space), _mm_andnot_si128(isSpace, glyph));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi16(glyph, colour));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4), _mm_unpackhi_epi16(glyph, colour));
+	};
+	for (; i + 16 <= count; i += 16) {
+		__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cells + i));
+		expand8(_mm_unpacklo_epi8(bytes, zero), out + i);
+		expand8(_mm_unpackhi_epi8(bytes, zero), out + i + 8);
+	}
+#endif
+	for (; i < count; i++) {
+		out[i].Char.UnicodeChar = classGlyphs[cells[i] >> 4];
+		out[i].Attributes = cells[i] & 0x0F;
+	}
+}
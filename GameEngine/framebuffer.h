@@ -0,0 +1,186 @@
+#pragma once
+
+#include "platform.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/*
+* The cells the console draws into, in a layout chosen at compile time.
+*
+* The console only ever draws the four shade glyphs in 16 colours, so by default a cell is one byte, a glyph class
+* and a foreground colour (PaletteCell). Clearing, filling and rasterizing then touch a quarter of the memory a
+* CHAR_INFO frame needs. The cells are turned into CHAR_INFO only when a frame is presented or captured, 16 at a
+* time with SSE2, see PaletteCell::expand.
+*
+* Define GAMEENGINE_WIDE_CELLS to draw straight into CHAR_INFO cells instead (WideCell), for code that needs any
+* glyph or background colour. Framebuffer works with any cell type that has the same make and expand functions.
+*/
+
+// The colours and glyphs cells are drawn with, as the Windows console takes them in CHAR_INFO
+enum COLOUR
+{
+	FG_BLACK = 0x0000,
+	FG_DARK_BLUE = 0x0001,
+	FG_DARK_GREEN = 0x0002,
+	FG_DARK_CYAN = 0x0003,
+	FG_DARK_RED = 0x0004,
+	FG_DARK_MAGENTA = 0x0005,
+	FG_DARK_YELLOW = 0x0006,
+	FG_GREY = 0x0007,
+	FG_DARK_GREY = 0x0008,
+	FG_BLUE = 0x0009,
+	FG_GREEN = 0x000A,
+	FG_CYAN = 0x000B,
+	FG_RED = 0x000C,
+	FG_MAGENTA = 0x000D,
+	FG_YELLOW = 0x000E,
+	FG_WHITE = 0x000F,
+	BG_BLACK = 0x0000,
+	BG_DARK_BLUE = 0x0010,
+	BG_DARK_GREEN = 0x0020,
+	BG_DARK_CYAN = 0x0030,
+	BG_DARK_RED = 0x0040,
+	BG_DARK_MAGENTA = 0x0050,
+	BG_DARK_YELLOW = 0x0060,
+	BG_GREY = 0x0070,
+	BG_DARK_GREY = 0x0080,
+	BG_BLUE = 0x0090,
+	BG_GREEN = 0x00A0,
+	BG_CYAN = 0x00B0,
+	BG_RED = 0x00C0,
+	BG_MAGENTA = 0x00D0,
+	BG_YELLOW = 0x00E0,
+	BG_WHITE = 0x00F0,
+};
+
+/*
+•	PIXEL_SOLID (0x2588): Represents a solid block character (█).
+•	PIXEL_THREEQUARTERS (0x2593): Represents a three-quarters block character (▓).
+•	PIXEL_HALF (0x2592): Represents a half block character (▒).
+•	PIXEL_QUARTER (0x2591): Represents a quarter block character (░).
+*/
+enum PIXEL_TYPE
+{
+	PIXEL_SOLID = 0x2588,
+	PIXEL_THREEQUARTERS = 0x2593,
+	PIXEL_HALF = 0x2592,
+	PIXEL_QUARTER = 0x2591,
+};
+
+// A glyph and attributes as the console's draw functions take them
+struct Shade
+{
+	short glyph;
+	short attributes;
+};
+
+/*
+* One byte, the glyph class in the high nibble and the foreground colour in the low one, always over black.
+* A space with a background colour is stored as a solid block of that colour, which looks the same. Any other
+* background colour is dropped, and glyphs other than the shade blocks and the space become solid blocks.
+*/
+struct PaletteCell
+{
+	enum Glyph : uint8_t
+	{
+		Space = 0,
+		Quarter = 1,
+		Half = 2,
+		ThreeQuarters = 3,
+		Solid = 4,
+	};
+
+	uint8_t value = 0;
+
+	// Whether a background colour other than black survives make
+	static const bool hasBackground = false;
+
+	static constexpr PaletteCell make(short glyph, short attributes) {
+		PaletteCell cell;
+		uint8_t colour = static_cast<uint8_t>(attributes & 0x0F);
+		Glyph g = Solid;
+		switch (static_cast<unsigned short>(glyph)) {
+		case 0x2591: g = Quarter; break;
+		case 0x2592: g = Half; break;
+		case 0x2593: g = ThreeQuarters; break;
+		case 0x0000:
+		case 0x0020:
+			g = (attributes & 0xF0) ? Solid : Space;
+			if (g == Solid)
+				colour = static_cast<uint8_t>((attributes >> 4) & 0x0F);
+			break;
+		default: break;
+		}
+		cell.value = static_cast<uint8_t>(g << 4 | colour);
+		return cell;
+	}
+
+	// Write count cells as CHAR_INFO, a cell drawn as make(glyph, attributes) comes back as glyph and attributes
+	// whenever it could be stored as it was
+	static void expand(const PaletteCell* in, CHAR_INFO* out, size_t count);
+};
+
+// A CHAR_INFO as it is, expanding is a copy
+struct WideCell
+{
+	CHAR_INFO info = {};
+
+	static const bool hasBackground = true;
+
+	static WideCell make(short glyph, short attributes) {
+		WideCell cell;
+		cell.info.Char.UnicodeChar = glyph;
+		cell.info.Attributes = attributes;
+		return cell;
+	}
+
+	static void expand(const WideCell* in, CHAR_INFO* out, size_t count) {
+		memcpy(out, in, sizeof(CHAR_INFO) * count);
+	}
+};
+
+#ifdef GAMEENGINE_WIDE_CELLS
+typedef WideCell ConsoleCell;
+#else
+typedef PaletteCell ConsoleCell;
+#endif
+
+template <typename Cell>
+class Framebuffer
+{
+public:
+	Framebuffer() = default;
+	Framebuffer(int width, int height) : m_width(width), m_height(height), m_cells(static_cast<size_t>(width) * height) {}
+
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+	Cell* data() { return m_cells.data(); }
+	const Cell* data() const { return m_cells.data(); }
+	size_t size() const { return m_cells.size(); }
+	size_t bytes() const { return m_cells.size() * sizeof(Cell); }
+
+	// Set every cell in the rectangle from (x1, y1) to (x2, y2) inclusive, the parts off the screen are skipped
+	void fill(int x1, int y1, int x2, int y2, Cell cell) {
+		x1 = std::max(x1, 0);
+		y1 = std::max(y1, 0);
+		x2 = std::min(x2, m_width - 1);
+		y2 = std::min(y2, m_height - 1);
+		if (x1 > x2)
+			return;
+		for (int y = y1; y <= y2; y++) {
+			Cell* row = m_cells.data() + static_cast<size_t>(y) * m_width;
+			std::fill(row + x1, row + x2 + 1, cell);
+		}
+	}
+
+	// The whole frame as CHAR_INFO, out holds width * height cells
+	void expand(CHAR_INFO* out) const { Cell::expand(m_cells.data(), out, m_cells.size()); }
+
+private:
+	int m_width = 0;
+	int m_height = 0;
+	std::vector<Cell> m_cells;
+};
@@ -0,0 +1,117 @@
+#include "framecapture.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+// The classic console palette, indexed by the 4 bit colour of an attribute
+const unsigned char palette[16][3] = {
+	{ 0, 0, 0 },		{ 0, 0, 128 },		{ 0, 128, 0 },		{ 0, 128, 128 },
+	{ 128, 0, 0 },		{ 128, 0, 128 },	{ 128, 128, 0 },	{ 192, 192, 192 },
+	{ 128, 128, 128 },	{ 0, 0, 255 },		{ 0, 255, 0 },		{ 0, 255, 255 },
+	{ 255, 0, 0 },		{ 255, 0, 255 },	{ 255, 255, 0 },	{ 255, 255, 255 },
+};
+
+// How much of a cell the glyph covers, out of 4
+int coverage(WCHAR c) {
+	switch (c) {
+	case 0:
+	case ' ':
+		return 0;
+	case 0x2591:
+		return 1;
+	case 0x2592:
+		return 2;
+	case 0x2593:
+		return 3;
+	case 0x2588:
+		return 4;
+	default:
+		// Letters and other symbols cover about half of the cell
+		return 2;
+	}
+}
+
+void putUtf8(std::string& out, WCHAR c) {
+	if (c < 0x20) {
+		out += ' ';
+	}
+	else if (c < 0x80) {
+		out += static_cast<char>(c);
+	}
+	else if (c < 0x800) {
+		out += static_cast<char>(0xC0 | (c >> 6));
+		out += static_cast<char>(0x80 | (c & 0x3F));
+	}
+	else if (c >= 0xD800 && c <= 0xDFFF) {
+		out += '?';
+	}
+	else {
+		out += static_cast<char>(0xE0 | (c >> 12));
+		out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+		out += static_cast<char>(0x80 | (c & 0x3F));
+	}
+}
+
+bool writeFile(const std::string& filename, const void* data, size_t size) {
+	std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+	if (!file)
+		return false;
+	file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+	file.close();
+	return !file.fail();
+}
+
+}
+
+uint64_t hashFrame(const CHAR_INFO* cells, int width, int height) {
+	uint64_t hash = 14695981039346656037ull;
+	auto mix = [&hash](unsigned int value) {
+		// Byte by byte, low byte first, so the hash does not depend on the machine's byte order
+		for (int i = 0; i < 2; i++) {
+			hash ^= (value >> (i * 8)) & 0xFF;
+			hash *= 1099511628211ull;
+		}
+	};
+	mix(static_cast<unsigned int>(width));
+	mix(static_cast<unsigned int>(height));
+	const size_t count = static_cast<size_t>(width) * height;
+	for (size_t i = 0; i < count; i++) {
+		mix(cells[i].Char.UnicodeChar);
+		mix(cells[i].Attributes);
+	}
+	return hash;
+}
+
+bool writeFrameText(const std::string& filename, const CHAR_INFO* cells, int width, int height) {
+	char header[96];
+	snprintf(header, sizeof(header), "%d %d %016llx\n", width, height, static_cast<unsigned long long>(hashFrame(cells, width, height)));
+	std::string text = header;
+	text.reserve(text.size() + static_cast<size_t>(width + 1) * height * 3);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++)
+			putUtf8(text, cells[static_cast<size_t>(y) * width + x].Char.UnicodeChar);
+		text += '\n';
+	}
+	return writeFile(filename, text.data(), text.size());
+}
+
+bool writeFramePPM(const std::string& filename, const CHAR_INFO* cells, int width, int height) {
+	char header[64];
+	int headerSize = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+	const size_t count = static_cast<size_t>(width) * height;
+	std::vector<unsigned char> image(headerSize + count * 3);
+	memcpy(image.data(), header, headerSize);
+	unsigned char* pixel = image.data() + headerSize;
+	for (size_t i = 0; i < count; i++) {
+		const unsigned char* fg = palette[cells[i].Attributes & 0xF];
+		const unsigned char* bg = palette[(cells[i].Attributes >> 4) & 0xF];
+		int cover = coverage(cells[i].Char.UnicodeChar);
+		for (int c = 0; c < 3; c++)
+			pixel[c] = static_cast<unsigned char>((fg[c] * cover + bg[c] * (4 - cover)) / 4);
+		pixel += 3;
+	}
+	return writeFile(filename, image.data(), image.size());
+}
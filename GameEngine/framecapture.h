@@ -0,0 +1,30 @@
+#pragma once
+
+#include "platform.h"
+#include <cstdint>
+#include <string>
+
+/*
+* Saving console frames outside of a window, for automated runs.
+*
+* A frame is identified by a 64 bit FNV-1a hash of its cells, the glyph and attributes of every cell in order,
+* so two runs that draw the same frame produce the same hash on every platform. A frame can also be saved as
+* text, which diffs well, or as a PPM image with one pixel per cell for looking at.
+*/
+
+// Hash of a width x height cell buffer, the size is part of the hash
+uint64_t hashFrame(const CHAR_INFO* cells, int width, int height);
+
+/*
+* Save the glyphs as UTF-8 text, one line per row, after a header line with the size and hash.
+* Empty cells are written as spaces. Returns false if the file could not be written.
+*/
+bool writeFrameText(const std::string& filename, const CHAR_INFO* cells, int width, int height);
+
+/*
+* Save the frame as a binary PPM (P6) image, one pixel per cell.
+* Each pixel mixes the cell's foreground and background colour by how much of the cell the glyph covers,
+* a solid block is all foreground, the shade blocks a quarter, half or three quarters, a space none of it.
+* Returns false if the file could not be written.
+*/
+bool writeFramePPM(const std::string& filename, const CHAR_INFO* cells, int width, int height);
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <chrono>
+#include <thread>
+
+/*
+* Decides when the engine simulates and when it draws.
+*
+* Simulation runs in fixed steps, independent of the frame rate. Every frame the real time that passed is added to
+* an accumulator and as many whole steps as fit are run, the leftover fraction of a step is alpha, which the frame
+* can use to interpolate between the previous and the current simulation state so motion stays smooth when the
+* frame rate and the step rate differ. A frame that falls far behind runs at most maxUpdatesPerFrame steps and drops
+* the rest of the backlog instead of trying to catch up forever.
+*
+* Frames are paced to a target frame rate. Waiting sleeps for most of the remaining time, which lets the core idle,
+* and spins for the last spinMargin because a sleep can oversleep by a scheduler tick. With idle mode on, frames
+* where nothing asked for a redraw are skipped entirely and the loop sleeps until the next simulation step is due,
+* without the spin, a skipped frame has nothing to show so waking a tick late costs nothing. A static scene then
+* costs almost no CPU.
+*/
+class FrameScheduler
+{
+public:
+	using clock = std::chrono::steady_clock;
+
+	// Length of one simulation step in seconds
+	void setFixedStep(double seconds) { m_step = seconds > 0.0 ? seconds : m_step; }
+	double fixedStep() const { return m_step; }
+
+	// Frames per second to pace to, 0 draws as fast as possible
+	void setTargetFrameRate(double fps) { m_period = fps > 0.0 ? 1.0 / fps : 0.0; }
+	double targetFrameRate() const { return m_period > 0.0 ? 1.0 / m_period : 0.0; }
+
+	// Skip drawing frames nothing asked to redraw, see FrameScheduler
+	void setIdleMode(bool idle) { m_idle = idle; }
+	bool idleMode() const { return m_idle; }
+
+	// How long before a deadline sleeping stops and spinning starts
+	void setSpinMargin(double seconds) { m_spinMargin = seconds; }
+	void setMaxUpdatesPerFrame(int updates) { m_maxUpdates = updates > 0 ? updates : 1; }
+
+	// Reset the clock, call once before the first beginFrame
+	void start() {
+		m_last = clock::now();
+		m_nextFrame = m_last;
+		m_accumulator = 0.0;
+		m_alpha = 0.0f;
+		m_frameDelta = 0.0f;
+	}
+
+	/*
+	* Account for the time since the previous call and return how many fixed steps to run this frame.
+	*/
+	int beginFrame() {
+		clock::time_point now = clock::now();
+		double elapsed = std::chrono::duration<double>(now - m_last).count();
+		m_last = now;
+		m_accumulator += elapsed;
+		m_sinceRender += elapsed;
+
+		int steps = static_cast<int>(m_accumulator / m_step);
+		if (steps > m_maxUpdates) {
+			// Too far behind, drop the backlog rather than spiralling
+			steps = m_maxUpdates;
+			m_accumulator = 0.0;
+		}
+		else {
+			m_accumulator -= steps * m_step;
+		}
+		m_alpha = static_cast<float>(m_accumulator / m_step);
+		m_updates += steps;
+		return steps;
+	}
+
+	// Where between the previous and the current simulation step this frame is, 0 to 1
+	float alpha() const { return m_alpha; }
+
+	// Whether this frame should be drawn, redraw is whether anything changed since the last drawn frame
+	bool shouldRender(bool redraw) const { return !m_idle || redraw; }
+
+	/*
+	* Call after the frame, rendered is whether it was drawn. Waits until the next frame is due: the next
+	* frame period when pacing, or when idle and nothing was drawn, until the next simulation step. Only the wait
+	* after a drawn frame spins, see FrameScheduler.
+	*/
+	void endFrame(bool rendered) {
+		clock::time_point now = clock::now();
+		if (rendered) {
+			m_rendered++;
+			m_frameDelta = static_cast<float>(m_sinceRender);
+			m_sinceRender = 0.0;
+		}
+		else {
+			m_skipped++;
+		}
+
+		clock::time_point deadline = now;
+		if (rendered && m_period > 0.0) {
+			// Keep a steady cadence, a frame that ran late does not push every later frame back
+			m_nextFrame += toDuration(m_period);
+			if (m_nextFrame < now)
+				m_nextFrame = now;
+			deadline = m_nextFrame;
+		}
+		else if (!rendered) {
+			// Nothing to draw, nothing to do until the simulation has another step to run
+			deadline = now + toDuration(m_step - m_accumulator - std::chrono::duration<double>(now - m_last).count());
+			if (m_period > 0.0 && m_nextFrame > deadline)
+				deadline = m_nextFrame;
+		}
+		waitUntil(deadline, rendered);
+	}
+
+	// Seconds between the last two drawn frames
+	float frameDelta() const { return m_frameDelta; }
+
+	unsigned long long framesRendered() const { return m_rendered; }
+	unsigned long long framesSkipped() const { return m_skipped; }
+	unsigned long long updates() const { return m_updates; }
+
+private:
+	static clock::duration toDuration(double seconds) {
+		return std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(seconds > 0.0 ? seconds : 0.0));
+	}
+
+	// Sleep until deadline, with spin the last spinMargin is spun instead so the wake up is on time
+	void waitUntil(clock::time_point deadline, bool spin) {
+		clock::time_point sleepUntil = spin ? deadline - toDuration(m_spinMargin) : deadline;
+		if (clock::now() < sleepUntil)
+			std::this_thread::sleep_until(sleepUntil);
+		while (clock::now() < deadline)
+			std::this_thread::yield();
+	}
+
+	double m_step = 1.0 / 60.0;
+	double m_period = 0.0;
+	double m_spinMargin = 0.002;
+	int m_maxUpdates = 8;
+	bool m_idle = false;
+
+	clock::time_point m_last = clock::now();
+	clock::time_point m_nextFrame = m_last;
+	double m_accumulator = 0.0;
+	double m_sinceRender = 0.0;
+	float m_alpha = 0.0f;
+	float m_frameDelta = 0.0f;
+	unsigned long long m_rendered = 0;
+	unsigned long long m_skipped = 0;
+	unsigned long long m_updates = 0;
+};
@@ -1,4 +1,10 @@
 #include "geometry.h"
+#include "objloader.h"
+#include "meshcache.h"
+#include "simd.h"
+#include "vecmath.h"
+#include <thread>
+#include <algorithm>
 
 vec3 vec3_add(const vec3& v1, const vec3& v2) {
 	return { v1.x + v2.x, v1.y + v2.y, v1.z + v2.z };
@@ -43,6 +49,30 @@ vec3 cross_product(const vec3& v1, const vec3& v2) {
 	};
 }
 
+void VertexStream::resize(size_t n) {
+	x.resize(n);
+	y.resize(n);
+	z.resize(n);
+}
+
+void VertexStream::reserve(size_t n) {
+	x.reserve(n);
+	y.reserve(n);
+	z.reserve(n);
+}
+
+void VertexStream::clear() {
+	x.clear();
+	y.clear();
+	z.clear();
+}
+
+void VertexStream::push_back(const vec3& v) {
+	x.push_back(v.x);
+	y.push_back(v.y);
+	z.push_back(v.z);
+}
+
 void Triangle::computeNormal() {
 	vec3 line1 = { p[1].x - p[0].x, p[1].y - p[0].y, p[1].z - p[0].z };
 	vec3 line2 = { p[2].x - p[0].x, p[2].y - p[0].y, p[2].z - p[0].z };
@@ -53,22 +83,26 @@ void Triangle::computeNormal() {
 }
 
 mat4x4 mat4x4::operator*(const mat4x4& rhs) const {
+	// Row c of the result is rhs's row c run through this matrix, the sums in the same order as the scalar loop
+	// so both paths give the same bits
 	mat4x4 res;
+#ifdef VECMATH_SSE
+	const __m128 r0 = _mm_load_ps(m[0]), r1 = _mm_load_ps(m[1]), r2 = _mm_load_ps(m[2]), r3 = _mm_load_ps(m[3]);
 	for (int c = 0; c < 4; c++) {
-		for (int r = 0; r < 4; r++) {
-			res.m[c][r] = m[0][r] * rhs.m[c][0] + m[1][r] * rhs.m[c][1] + m[2][r] * rhs.m[c][2] + m[3][r] * rhs.m[c][3];
-		}
+		__m128 row = _mm_mul_ps(_mm_set1_ps(rhs.m[c][0]), r0);
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(rhs.m[c][1]), r1));
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(rhs.m[c][2]), r2));
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(rhs.m[c][3]), r3));
+		_mm_store_ps(res.m[c], row);
 	}
-	return res;
-}
-
-mat4x4 mat4x4::operator=(const mat4x4& rhs) {
+#else
 	for (int c = 0; c < 4; c++) {
 		for (int r = 0; r < 4; r++) {
-			m[c][r] = rhs.m[c][r];
+			res.m[c][r] = m[0][r] * rhs.m[c][0] + m[1][r] * rhs.m[c][1] + m[2][r] * rhs.m[c][2] + m[3][r] * rhs.m[c][3];
 		}
 	}
-	return *this;
+#endif
+	return res;
 }
 
 void mat4x4::matrixMultiplyVector(vec3& input, vec3& output) const {
@@ -135,132 +169,230 @@ void mat4x4::initProjectionMatrix(float fNear, float fFar, float fFov, float fAs
 	* 
 	*/
 		
-	float tanHalfFov = tanf(fFov / 2.0f);
-	m[0][0] = fAspectRatio / tanHalfFov;
-	m[1][1] = 1.0f / tanHalfFov;
-	m[2][2] = fFar / (fFar - fNear);
-	m[3][2] = (-fNear * fFar) / (fFar - fNear);
-	m[2][3] = 1.0f;
+	*this = perspective(fNear, fFar, fFov, fAspectRatio);
+}
+
+mat4x4 mat4x4::perspective(float fNear, float fFar, float fFov, float fAspectRatio) {
+	return projection(fNear, fFar, tanf(fFov / 2.0f), fAspectRatio);
 }
 
 void mat4x4::initTranslationMatrix(float x, float y, float z) {
 	/*	Translation matrix is used to move the object in 3D space */
-	m[0][0] = 1.0f;
-	m[1][1] = 1.0f;
-	m[2][2] = 1.0f;
-	m[3][3] = 1.0f;
-	m[3][0] = x;
-	m[3][1] = y;
-	m[3][2] = z;
+	*this = translation(x, y, z);
 }
 
 void mat4x4::initViewMatrix(const vec3& pos, const vec3& forward, const vec3& up, const vec3& right) {
 	/*	View matrix is used to transform objects in the world space to the camera's view space
-	* For this we need to multiply a Rotation Matrix and a Translation Matrix
+	* For this we need to multiply a Rotation Matrix and a Translation Matrix, view writes out their product
+	* (the translation first) directly instead of multiplying the two
 	*/
+	*this = view(pos, forward, up, right);
+}
 
-	// Rotation Matrix
-	mat4x4 matRot;
-	matRot.m[0][0] = right.x;
-	matRot.m[0][1] = right.y;
-	matRot.m[0][2] = right.z;
-	matRot.m[1][0] = up.x;
-	matRot.m[1][1] = up.y;
-	matRot.m[1][2] = up.z;
-	matRot.m[2][0] = -forward.x;
-	matRot.m[2][1] = -forward.y;
-	matRot.m[2][2] = -forward.z;
-	matRot.m[3][3] = 1.0f;
-
-	// Translation Matrix
-	mat4x4 matTrans;
-	matTrans.m[0][0] = 1.0f;
-	matTrans.m[1][1] = 1.0f;
-	matTrans.m[2][2] = 1.0f;
-	matTrans.m[3][3] = 1.0f;
-	matTrans.m[3][0] = -pos.x;
-	matTrans.m[3][1] = -pos.y;
-	matTrans.m[3][2] = -pos.z;
-
-	// The view matrix is the product of the rotation matrix and the translation matrix
-	*this = matRot * matTrans;
+Triangle Mesh::getTriangle(size_t t) const {
+	Triangle tri;
+	for (int i = 0; i < 3; i++) {
+		tri.p[i] = positions.get(indices[t * 3 + i]);
+	}
+	return tri;
 }
 
-Cube::Cube(float x, float y, float z, float s) {
-	// SOUTH face
-	triangles.push_back({
-		{ {x, y, z}, {x, y + s, z}, {x + s, y + s, z} }
-		});
-	triangles.push_back({
-		{ {x, y, z}, {x + s, y + s, z}, {x + s, y, z} }
-		});
-
-	// EAST face
-	triangles.push_back({
-		{ {x + s, y, z}, {x + s, y + s, z}, {x + s, y + s, z + s} }
-		});
-	triangles.push_back({
-		{ {x + s, y, z}, {x + s, y + s, z + s}, {x + s, y, z + s} }
-		});
-
-	// NORTH face
-	triangles.push_back({
-		{ {x + s, y, z + s}, {x + s, y + s, z + s}, {x, y + s, z + s} }
-		});
-	triangles.push_back({
-		{ {x + s, y, z + s}, {x, y + s, z + s}, {x, y, z + s} }
-		});
-
-	// WEST face
-	triangles.push_back({
-		{ {x, y, z}, {x, y + s, z}, {x, y + s, z + s} }
-		});
-	triangles.push_back({
-		{ {x, y, z}, {x, y + s, z + s}, {x, y, z + s} }
-		});
-
-	// TOP face
-	triangles.push_back({
-		{ {x, y + s, z}, {x, y + s, z + s}, {x + s, y + s, z + s} }
-		});
-	triangles.push_back({
-		{ {x, y + s, z}, {x + s, y + s, z + s}, {x + s, y + s, z} }
-		});
-
-	// BOTTOM face
-	triangles.push_back({
-		{ {x, y, z}, {x + s, y, z}, {x + s, y, z + s} }
-		});
-	triangles.push_back({
-		{ {x, y, z}, {x + s, y, z + s}, {x, y, z + s} }
-		});
+size_t Mesh::memoryUsage() const {
+	return (positions.size() + normals.size()) * 3 * sizeof(float) + indices.size() * sizeof(uint32_t) + edges.size() * sizeof(MeshEdge);
 }
 
-bool Mesh::loadFromObjectFile(const std::string& filename) {
-	std::ifstream f(filename);
-	if (!f.is_open())
-		return false;
+void Mesh::buildEdges() {
+	// Every triangle contributes three (edge, face) pairs keyed by the edge's sorted vertex pair
+	// Sorting brings the copies of a shared edge next to each other
+	size_t count = triangleCount();
+	std::vector<std::pair<uint64_t, uint32_t>> halfEdges;
+	halfEdges.reserve(count * 3);
+	for (size_t t = 0; t < count; t++) {
+		for (int i = 0; i < 3; i++) {
+			uint64_t a = indices[t * 3 + i];
+			uint64_t b = indices[t * 3 + (i + 1) % 3];
+			if (a > b)
+				std::swap(a, b);
+			halfEdges.push_back({ (a << 32) | b, static_cast<uint32_t>(t) });
+		}
+	}
+	std::sort(halfEdges.begin(), halfEdges.end());
 
-	std::vector<vec3> verts;
+	edges.clear();
+	edges.reserve(count * 3 / 2 + 1);
+	for (size_t i = 0; i < halfEdges.size(); ) {
+		uint64_t key = halfEdges[i].first;
+		MeshEdge e;
+		e.v[0] = static_cast<uint32_t>(key >> 32);
+		e.v[1] = static_cast<uint32_t>(key & 0xFFFFFFFFu);
+		e.face[0] = halfEdges[i].second;
+		e.face[1] = MeshEdge::noFace;
+		i++;
+		// On a closed mesh there is exactly one more, a non-manifold edge can have more but it is still drawn once
+		if (i < halfEdges.size() && halfEdges[i].first == key)
+			e.face[1] = halfEdges[i].second;
+		while (i < halfEdges.size() && halfEdges[i].first == key)
+			i++;
+		edges.push_back(e);
+	}
+}
 
-	std::string line;
-	while (std::getline(f, line)) {
-		std::istringstream s(line);
+void Mesh::setVertex(size_t i, const vec3& v) {
+	positions.x[i] = v.x;
+	positions.y[i] = v.y;
+	positions.z[i] = v.z;
+	normalsDirty = true;
+}
 
-		char junk;
-		if (line[0] == 'v') {
-			vec3 v;
-			s >> junk >> v.x >> v.y >> v.z;
-			verts.push_back(v);
-		}
-		else if (line[0] == 'f') {
-			int f[3];
-			s >> junk >> f[0] >> f[1] >> f[2];
-			if (f[0] > 0 && f[1] > 0 && f[2] > 0 &&
-				f[0] <= verts.size() && f[1] <= verts.size() && f[2] <= verts.size()) {
-				triangles.push_back({ verts[f[0] - 1], verts[f[1] - 1], verts[f[2] - 1] });
+// Computes the normals of triangles [begin, end), SIMD_WIDTH triangles at a time
+// This is Triangle::computeNormal laid out across lanes, the corners are gathered through the index buffer
+// into small SoA blocks first since there is no gather instruction on SSE/AVX1
+static void computeFaceNormals(const VertexStream& pos, const uint32_t* indices, VertexStream& normals, size_t begin, size_t end) {
+	size_t t = begin;
+#if SIMD_WIDTH > 1
+	alignas(32) float corner[3][3][SIMD_WIDTH];
+	const simd_float zero = simd_set1(0.0f);
+	const simd_float one = simd_set1(1.0f);
+	for (; t + SIMD_WIDTH <= end; t += SIMD_WIDTH) {
+		for (int lane = 0; lane < SIMD_WIDTH; lane++) {
+			for (int i = 0; i < 3; i++) {
+				uint32_t v = indices[(t + lane) * 3 + i];
+				corner[i][0][lane] = pos.x[v];
+				corner[i][1][lane] = pos.y[v];
+				corner[i][2][lane] = pos.z[v];
 			}
 		}
+		simd_float p0x = simd_load(corner[0][0]), p0y = simd_load(corner[0][1]), p0z = simd_load(corner[0][2]);
+		simd_float l1x = simd_sub(simd_load(corner[1][0]), p0x);
+		simd_float l1y = simd_sub(simd_load(corner[1][1]), p0y);
+		simd_float l1z = simd_sub(simd_load(corner[1][2]), p0z);
+		simd_float l2x = simd_sub(simd_load(corner[2][0]), p0x);
+		simd_float l2y = simd_sub(simd_load(corner[2][1]), p0y);
+		simd_float l2z = simd_sub(simd_load(corner[2][2]), p0z);
+
+		simd_float nx = simd_sub(simd_mul(l1y, l2z), simd_mul(l1z, l2y));
+		simd_float ny = simd_sub(simd_mul(l1z, l2x), simd_mul(l1x, l2z));
+		simd_float nz = simd_sub(simd_mul(l1x, l2y), simd_mul(l1y, l2x));
+
+		simd_float l = simd_sqrt(simd_madd(nz, nz, simd_madd(ny, ny, simd_mul(nx, nx))));
+		// Degenerate triangles keep a zero normal instead of dividing by zero
+		l = simd_select(simd_cmpeq(l, zero), one, l);
+		simd_store(&normals.x[t], simd_div(nx, l));
+		simd_store(&normals.y[t], simd_div(ny, l));
+		simd_store(&normals.z[t], simd_div(nz, l));
+	}
+#endif
+	for (; t < end; t++) {
+		vec3 p0 = pos.get(indices[t * 3]);
+		vec3 line1 = vec3_sub(pos.get(indices[t * 3 + 1]), p0);
+		vec3 line2 = vec3_sub(pos.get(indices[t * 3 + 2]), p0);
+		vec3 n = cross_product(line1, line2);
+		float l = vec3_length(n);
+		if (l == 0.0f)
+			l = 1.0f;
+		normals.x[t] = n.x / l;
+		normals.y[t] = n.y / l;
+		normals.z[t] = n.z / l;
+	}
+}
+
+bool Mesh::updateNormals() {
+	if (!normalsDirty)
+		return false;
+
+	size_t count = triangleCount();
+	normals.resize(count);
+
+	// Below this many triangles the threads cost more to start than they save
+	const size_t parallelThreshold = 1 << 16;
+	unsigned int threads = std::thread::hardware_concurrency();
+	if (count < parallelThreshold || threads < 2) {
+		computeFaceNormals(positions, indices.data(), normals, 0, count);
+	}
+	else {
+		// Chunks are rounded to whole SIMD blocks so every chunk but the last runs entirely in the vector loop
+		size_t chunk = (count / threads + SIMD_WIDTH) / SIMD_WIDTH * SIMD_WIDTH;
+		std::vector<std::thread> workers;
+		for (size_t begin = 0; begin < count; begin += chunk) {
+			size_t end = begin + chunk < count ? begin + chunk : count;
+			workers.emplace_back(computeFaceNormals, std::cref(positions), indices.data(), std::ref(normals), begin, end);
+		}
+		for (auto& w : workers) {
+			w.join();
+		}
 	}
+	normalsDirty = false;
+	return true;
+}
+
+Cube::Cube(float x, float y, float z, float s) {
+	// The 8 corners of the cube, each shared by the faces that meet there
+	positions.push_back({ x, y, z });				// 0
+	positions.push_back({ x, y + s, z });			// 1
+	positions.push_back({ x + s, y + s, z });		// 2
+	positions.push_back({ x + s, y, z });			// 3
+	positions.push_back({ x + s, y + s, z + s });	// 4
+	positions.push_back({ x + s, y, z + s });		// 5
+	positions.push_back({ x, y + s, z + s });		// 6
+	positions.push_back({ x, y, z + s });			// 7
+
+	indices = {
+		// SOUTH face
+		0, 1, 2,	0, 2, 3,
+		// EAST face
+		3, 2, 4,	3, 4, 5,
+		// NORTH face
+		5, 4, 6,	5, 6, 7,
+		// WEST face
+		0, 1, 6,	0, 6, 7,
+		// TOP face
+		1, 6, 4,	1, 4, 2,
+		// BOTTOM face
+		0, 3, 5,	0, 5, 7,
+	};
+
+	buildEdges();
+	updateNormals();
+}
+
+bool Mesh::loadFromObjectFile(const std::string& filename, bool useCache) {
+	if (useCache && loadFromCache(filename))
+		return true;
+
+	ObjData data;
+	if (!parseObjFile(filename, data))
+		return false;
+
+	// Only positions are indexed by the mesh, the v lines are already the unique vertex list
+	// and the position index of each corner is the index buffer
+	positions = std::move(data.positions);
+	indices = std::move(data.positionIndices);
+	buildEdges();
+	normalsDirty = true;
+	updateNormals();
+
+	// A failed write only means the next start parses again
+	if (useCache)
+		writeMeshCache(meshCachePath(filename), *this, filename);
+	return true;
+}
+
+bool Mesh::loadFromCache(const std::string& filename) {
+	MappedMesh cache;
+	if (!cache.open(meshCachePath(filename), filename))
+		return false;
+
+	// The arrays are stored exactly as the vectors hold them, so each is a single bulk copy
+	size_t vertexCount = cache.vertexCount();
+	size_t triangleCount = cache.triangleCount();
+	positions.x.assign(cache.positions(0), cache.positions(0) + vertexCount);
+	positions.y.assign(cache.positions(1), cache.positions(1) + vertexCount);
+	positions.z.assign(cache.positions(2), cache.positions(2) + vertexCount);
+	indices.assign(cache.indices(), cache.indices() + cache.indexCount());
+	normals.x.assign(cache.normals(0), cache.normals(0) + triangleCount);
+	normals.y.assign(cache.normals(1), cache.normals(1) + triangleCount);
+	normals.z.assign(cache.normals(2), cache.normals(2) + triangleCount);
+	edges.assign(cache.edges(), cache.edges() + cache.edgeCount());
+	normalsDirty = false;
 	return true;
 }
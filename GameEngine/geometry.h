@@ -1,8 +1,12 @@
+#pragma once
+
 #include <vector>
 #include <fstream>
 #include <sstream>
 #include <string>
 #include <strstream>
+#include <cmath>
+#include <cstdint>
 
 struct vec2
 {
@@ -41,17 +45,139 @@ struct Triangle
 	void computeNormal();
 };
 
+/*
+* Structure-of-arrays vertex positions. Each component lives in its own contiguous array so the
+* batched transform can load 8 x's, 8 y's and 8 z's at a time instead of shuffling packed vec3s.
+*/
+struct VertexStream
+{
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+	size_t size() const { return x.size(); }
+	void resize(size_t n);
+	void reserve(size_t n);
+	void clear();
+	void push_back(const vec3& v);
+	vec3 get(size_t i) const { return { x[i], y[i], z[i] }; }
+};
+
+// An edge shared by up to two triangles, used to draw wireframes without drawing shared edges twice
+struct MeshEdge
+{
+	static const uint32_t noFace = 0xFFFFFFFFu;
+	// The two vertex indices, v[0] < v[1]
+	uint32_t v[2];
+	// The triangles on either side, face[1] is noFace on an open boundary
+	uint32_t face[2];
+};
+
 struct Mesh
 {
 	// A mesh is a collection of triangles, which can be used to represent a 3D object
-	std::vector<Triangle> triangles;
-	bool loadFromObjectFile(const std::string& filename);
+	// Every unique corner is stored once in SoA form, and each triangle is three 32 bit indices into it
+	// A vertex shared by six faces is therefore stored, and transformed, once instead of six times
+	VertexStream positions;
+	// Triangle t is made of positions[indices[3t]], positions[indices[3t + 1]] and positions[indices[3t + 2]]
+	std::vector<uint32_t> indices;
+	// One unit normal per triangle, computed at load rather than every frame since the mesh is static
+	VertexStream normals;
+	// Set whenever positions are edited, the normals are only recomputed while this is true
+	bool normalsDirty = true;
+	// Every unique edge once, built from the index buffer at load
+	std::vector<MeshEdge> edges;
+	// Load an OBJ file. With useCache the binary cache next to it is used when it is up to date,
+	// otherwise the OBJ is parsed and the cache (re)written for next time
+	bool loadFromObjectFile(const std::string& filename, bool useCache = true);
+	// Load from the binary cache of an OBJ file, returns false if there is none or it is stale
+	bool loadFromCache(const std::string& filename);
+	// Move vertex i, this invalidates the normals of every triangle using it
+	void setVertex(size_t i, const vec3& v);
+	// Rebuild the edge list from the index buffer, only needed after changing the indices
+	void buildEdges();
+	// Recompute the normals if the geometry changed since the last call, large meshes are split across threads
+	// Returns true if the normals were recomputed
+	bool updateNormals();
+	size_t vertexCount() const { return positions.size(); }
+	size_t triangleCount() const { return indices.size() / 3; }
+	// Assemble triangle t from the index buffer
+	Triangle getTriangle(size_t t) const;
+	// Bytes held by the vertex and index buffers
+	size_t memoryUsage() const;
 };
 
-class mat4x4
+// Rows are 16 byte aligned so the SIMD multiply can load them whole, see vecmath.h
+class alignas(16) mat4x4
 {
 public:
 	float m[4][4] = { 0 };
+
+	/*
+	* The same matrices as the init functions below, built as values so they can be constexpr,
+	* e.g. a projection that never changes can be computed once instead of every frame.
+	*/
+	static constexpr mat4x4 identity() {
+		return translation(0.0f, 0.0f, 0.0f);
+	}
+	static constexpr mat4x4 translation(float x, float y, float z) {
+		mat4x4 r;
+		r.m[0][0] = 1.0f;
+		r.m[1][1] = 1.0f;
+		r.m[2][2] = 1.0f;
+		r.m[3][3] = 1.0f;
+		r.m[3][0] = x;
+		r.m[3][1] = y;
+		r.m[3][2] = z;
+		return r;
+	}
+	// Takes tan(fov / 2) since tanf is not constexpr, perspective is the version that takes the fov
+	static constexpr mat4x4 projection(float fNear, float fFar, float tanHalfFov, float fAspectRatio) {
+		mat4x4 r;
+		r.m[0][0] = fAspectRatio / tanHalfFov;
+		r.m[1][1] = 1.0f / tanHalfFov;
+		r.m[2][2] = fFar / (fFar - fNear);
+		r.m[3][2] = (-fNear * fFar) / (fFar - fNear);
+		r.m[2][3] = 1.0f;
+		return r;
+	}
+	static mat4x4 perspective(float fNear, float fFar, float fFov, float fAspectRatio);
+	/*
+	* The move to the camera followed by the rotation onto its axes, folded into one matrix.
+	* Each column projects onto one camera axis, so a point in front of the camera gets a positive z, which
+	* the projection turns into a positive w. right and up point left and up in world space, while the
+	* screen's x grows to the right and y grows downwards, so both are negated
+	*/
+	static constexpr mat4x4 view(const vec3& pos, const vec3& forward, const vec3& up, const vec3& right) {
+		mat4x4 r;
+		r.m[0][0] = -right.x;
+		r.m[1][0] = -right.y;
+		r.m[2][0] = -right.z;
+		r.m[0][1] = -up.x;
+		r.m[1][1] = -up.y;
+		r.m[2][1] = -up.z;
+		r.m[0][2] = forward.x;
+		r.m[1][2] = forward.y;
+		r.m[2][2] = forward.z;
+		for (int c = 0; c < 3; c++)
+			r.m[3][c] = -(pos.x * r.m[0][c] + pos.y * r.m[1][c] + pos.z * r.m[2][c]);
+		r.m[3][3] = 1.0f;
+		return r;
+	}
+	/*
+	* The viewport scale from clip space to [0, width] x [0, height], applied before the perspective divide
+	* (x * width / 2 + w * width / 2) so it can be folded into the model-view-projection, see transformVertices.
+	*/
+	static constexpr mat4x4 viewport(float width, float height) {
+		mat4x4 r;
+		r.m[0][0] = 0.5f * width;
+		r.m[3][0] = 0.5f * width;
+		r.m[1][1] = 0.5f * height;
+		r.m[3][1] = 0.5f * height;
+		r.m[2][2] = 1.0f;
+		r.m[3][3] = 1.0f;
+		return r;
+	}
+
 	/*
 	* The projection matrix is used to convert 3D coordinates into 2D coordinates, use this function to create
 	* a projection matrix
@@ -82,8 +208,8 @@ public:
 	* @param up: The up vector of the camera.
 	*/
 	void initViewMatrix(const vec3& pos, const vec3& target, const vec3& up, const vec3& right);
+	// a * b applies b first, then a, a row at a time with SSE
 	mat4x4 operator*(const mat4x4& rhs) const;
-	mat4x4 operator=(const mat4x4& rhs);
 	void matrixMultiplyVector(vec3& input, vec3& output) const;
 
 };
@@ -0,0 +1,135 @@
+#include "instancing.h"
+#include <algorithm>
+#include <cmath>
+
+// Rotate v about x, then y, then z
+static vec3 rotate(const vec3& v, const vec3& angles) {
+	float s = sinf(angles.x), c = cosf(angles.x);
+	vec3 r = { v.x, v.y * c - v.z * s, v.y * s + v.z * c };
+	s = sinf(angles.y);
+	c = cosf(angles.y);
+	r = { r.x * c + r.z * s, r.y, -r.x * s + r.z * c };
+	s = sinf(angles.z);
+	c = cosf(angles.z);
+	return { r.x * c - r.y * s, r.x * s + r.y * c, r.z };
+}
+
+mat4x4 Instance::worldMatrix() const {
+	// A point is multiplied as a row vector, so row i is where the mesh's i axis ends up and row 3 is the translation
+	mat4x4 m;
+	const vec3 axes[3] = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } };
+	for (int i = 0; i < 3; i++) {
+		vec3 a = vec3_mul(rotate(axes[i], rotation), scale);
+		m.m[i][0] = a.x;
+		m.m[i][1] = a.y;
+		m.m[i][2] = a.z;
+	}
+	m.m[3][0] = position.x;
+	m.m[3][1] = position.y;
+	m.m[3][2] = position.z;
+	m.m[3][3] = 1.0f;
+	return m;
+}
+
+InstancedMesh::InstancedMesh(const Mesh& mesh) : m_mesh(mesh) {
+	update();
+}
+
+void InstancedMesh::update() {
+	const VertexStream& p = m_mesh.positions;
+	if (p.size() == 0) {
+		m_center = { 0.0f, 0.0f, 0.0f };
+		m_radius = 0.0f;
+	}
+	else {
+		vec3 lo = p.get(0), hi = lo;
+		for (size_t i = 1; i < p.size(); i++) {
+			lo = { std::min(lo.x, p.x[i]), std::min(lo.y, p.y[i]), std::min(lo.z, p.z[i]) };
+			hi = { std::max(hi.x, p.x[i]), std::max(hi.y, p.y[i]), std::max(hi.z, p.z[i]) };
+		}
+		m_center = vec3_mul(vec3_add(lo, hi), 0.5f);
+		float radius2 = 0.0f;
+		for (size_t i = 0; i < p.size(); i++) {
+			vec3 d = vec3_sub(p.get(i), m_center);
+			radius2 = std::max(radius2, dot_product(d, d));
+		}
+		m_radius = sqrtf(radius2);
+	}
+	mat4x4 identity;
+	identity.initTranslationMatrix(0.0f, 0.0f, 0.0f);
+	computePlaneOffsets(identity, m_mesh, m_mesh.normals, m_planeOffsets);
+}
+
+void InstancedMesh::frustumPlanes(const mat4x4& viewProj, float planes[6][4]) {
+	// Clip space component c of a point is dot((x, y, z, 1), column c), so each clip space bound is a plane
+	// in world space made of columns: -w <= x <= w, -w <= y <= w and 0 <= z <= w
+	const mat4x4& m = viewProj;
+	for (int k = 0; k < 4; k++) {
+		planes[0][k] = m.m[k][3] + m.m[k][0];
+		planes[1][k] = m.m[k][3] - m.m[k][0];
+		planes[2][k] = m.m[k][3] + m.m[k][1];
+		planes[3][k] = m.m[k][3] - m.m[k][1];
+		planes[4][k] = m.m[k][2];
+		planes[5][k] = m.m[k][3] - m.m[k][2];
+	}
+	// Unit normals, so a plane's value at a point is its distance and can be compared with a radius
+	for (int i = 0; i < 6; i++) {
+		float length = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+		if (length > 0.0f) {
+			for (int k = 0; k < 4; k++)
+				planes[i][k] /= length;
+		}
+	}
+}
+
+bool InstancedMesh::prepare(const Instance& instance, const mat4x4& viewProj, const float planes[6][4], const vec3& cameraPos,
+	float viewportWidth, float viewportHeight, ClipStats& stats) {
+	const mat4x4 world = instance.worldMatrix();
+
+	vec3 center;
+	world.matrixMultiplyVector(m_center, center);
+	const float radius = m_radius * instance.scale;
+	for (int i = 0; i < 6; i++) {
+		if (planes[i][0] * center.x + planes[i][1] * center.y + planes[i][2] * center.z + planes[i][3] < -radius) {
+			m_culled++;
+			return false;
+		}
+	}
+
+	// The camera in mesh space, undoing the move, the rotation (rows of world are orthogonal) and the scale
+	vec3 d = vec3_sub(cameraPos, instance.position);
+	const float inverseScale2 = 1.0f / (instance.scale * instance.scale);
+	vec3 camera = {
+		(d.x * world.m[0][0] + d.y * world.m[0][1] + d.z * world.m[0][2]) * inverseScale2,
+		(d.x * world.m[1][0] + d.y * world.m[1][1] + d.z * world.m[1][2]) * inverseScale2,
+		(d.x * world.m[2][0] + d.y * world.m[2][1] + d.z * world.m[2][2]) * inverseScale2,
+	};
+	cullBackfaces(m_mesh.normals, m_planeOffsets, camera, m_visible, stats);
+	if (m_visible.empty())
+		return false;
+
+	transformVertices(viewProj * world, m_mesh.positions, m_clip, m_screen, viewportWidth, viewportHeight);
+	return true;
+}
+
+void InstancedMesh::clipTriangles(const mat4x4& viewProj, const vec3& cameraPos, float viewportWidth, float viewportHeight,
+	std::vector<ScreenTriangle>& out, ClipStats& stats) {
+	float planes[6][4];
+	frustumPlanes(viewProj, planes);
+	m_culled = 0;
+	for (const Instance& instance : instances) {
+		if (prepare(instance, viewProj, planes, cameraPos, viewportWidth, viewportHeight, stats))
+			::clipTriangles(m_mesh, m_visible, m_clip, m_screen, viewportWidth, viewportHeight, out, stats);
+	}
+}
+
+void InstancedMesh::clipEdges(const mat4x4& viewProj, const vec3& cameraPos, float viewportWidth, float viewportHeight,
+	std::vector<ScreenLine>& out, ClipStats& stats) {
+	float planes[6][4];
+	frustumPlanes(viewProj, planes);
+	m_culled = 0;
+	for (const Instance& instance : instances) {
+		if (prepare(instance, viewProj, planes, cameraPos, viewportWidth, viewportHeight, stats))
+			::clipEdges(m_mesh, m_visible, m_clip, m_screen, viewportWidth, viewportHeight, out, stats, m_facing);
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "geometry.h"
+#include "clipper.h"
+#include "transform.h"
+
+/*
+* Instanced drawing, one Mesh drawn many times with a different transform each time.
+*
+* Each copy is an Instance, a position, rotation and uniform scale record of 28 bytes instead of a copy of the
+* triangles, so thousands of identical props cost thousands of small records plus one mesh. Per frame and per
+* instance the world matrix and the model-view-projection are composed once, the instance is dropped if its
+* bounding sphere is outside the view, the camera is moved into the mesh's own space so the backfaces are
+* culled against the mesh's normals as they are (no per instance normals), and the mesh's vertices are then
+* streamed through the batched transform into scratch buffers that every instance reuses.
+*/
+
+// Where one copy of the mesh is, the mesh is scaled, then rotated, then moved
+struct Instance
+{
+	vec3 position = { 0.0f, 0.0f, 0.0f };
+	// Uniform, must be positive
+	float scale = 1.0f;
+	// Radians about x, then y, then z
+	vec3 rotation = { 0.0f, 0.0f, 0.0f };
+
+	mat4x4 worldMatrix() const;
+};
+
+class InstancedMesh
+{
+public:
+	// The mesh is referenced, not copied, and has to outlive this, its normals have to be up to date
+	explicit InstancedMesh(const Mesh& mesh);
+
+	// Recompute the bounding sphere and plane offsets, call after editing the mesh
+	void update();
+
+	std::vector<Instance> instances;
+
+	/*
+	* Cull, transform and clip every instance and append the resulting triangles to out.
+	* viewProj is the camera's matProj * matView, cameraPos its world position.
+	* The ScreenTriangle ids are mesh triangle indices, the same for every instance.
+	*/
+	void clipTriangles(const mat4x4& viewProj, const vec3& cameraPos, float viewportWidth, float viewportHeight,
+		std::vector<ScreenTriangle>& out, ClipStats& stats);
+
+	// The same for the wireframe, every edge of an instance at most once, see clipEdges
+	void clipEdges(const mat4x4& viewProj, const vec3& cameraPos, float viewportWidth, float viewportHeight,
+		std::vector<ScreenLine>& out, ClipStats& stats);
+
+	// Instances skipped by the last clip call because their bounding sphere was out of view
+	uint32_t culledInstances() const { return m_culled; }
+
+private:
+	// Cull and transform instance i into the scratch buffers, returns false if nothing of it can be visible
+	bool prepare(const Instance& instance, const mat4x4& viewProj, const float planes[6][4], const vec3& cameraPos,
+		float viewportWidth, float viewportHeight, ClipStats& stats);
+	// The planes of the view volume in world space from viewProj, inside is a.x + b.y + c.z + d >= 0
+	static void frustumPlanes(const mat4x4& viewProj, float planes[6][4]);
+
+	const Mesh& m_mesh;
+	// Bounding sphere in mesh space
+	vec3 m_center = { 0.0f, 0.0f, 0.0f };
+	float m_radius = 0.0f;
+	// Plane offsets of the untransformed mesh, see computePlaneOffsets
+	std::vector<float> m_planeOffsets;
+	uint32_t m_culled = 0;
+	// Reused by every instance
+	std::vector<uint32_t> m_visible;
+	std::vector<uint8_t> m_facing;
+	ClipSpaceStream m_clip;
+	VertexStream m_screen;
+};
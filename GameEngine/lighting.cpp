@@ -0,0 +1,241 @@
+#include "lighting.h"
+#include "profiler.h"
+#include "simd.h"
+#include "transform.h"
+#include <algorithm>
+#include <cmath>
+
+const float orderedDither[16] = {
+	0.5f / 16, 8.5f / 16, 2.5f / 16, 10.5f / 16,
+	12.5f / 16, 4.5f / 16, 14.5f / 16, 6.5f / 16,
+	3.5f / 16, 11.5f / 16, 1.5f / 16, 9.5f / 16,
+	15.5f / 16, 7.5f / 16, 13.5f / 16, 5.5f / 16,
+};
+
+const float noDither[16] = {
+	0.5f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f,
+	0.5f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f,
+};
+
+void evaluateLighting(const Lighting& lighting, const mat4x4& world, const float* x, const float* y, const float* z,
+	const float* nx, const float* ny, const float* nz, size_t count, float* out, std::vector<vec3>& toLight) {
+	// Towards each directional light, unit length, worked out once rather than per batch
+	toLight.resize(lighting.directional.size());
+	for (size_t l = 0; l < toLight.size(); l++) {
+		toLight[l] = vec3_mul(lighting.directional[l].direction, -1.0f);
+		normalize(toLight[l]);
+	}
+	const bool points = !lighting.points.empty();
+	const simd_float zero = simd_set1(0.0f);
+	const simd_float one = simd_set1(1.0f);
+	// Keeps the reciprocal square root finite for a point sitting on a light
+	const simd_float tiny = simd_set1(1e-12f);
+	const simd_float ambient = simd_set1(lighting.ambient);
+
+	for (size_t i = 0; i < count; i += SIMD_WIDTH) {
+		simd_float vnx = simd_load(nx + i);
+		simd_float vny = simd_load(ny + i);
+		simd_float vnz = simd_load(nz + i);
+		simd_float light = ambient;
+		for (size_t l = 0; l < toLight.size(); l++) {
+			simd_float lambert = simd_madd(vnz, simd_set1(toLight[l].z), simd_madd(vny, simd_set1(toLight[l].y), simd_mul(vnx, simd_set1(toLight[l].x))));
+			light = simd_madd(simd_max(lambert, zero), simd_set1(lighting.directional[l].intensity), light);
+		}
+		if (points) {
+			// Only point lights need to know where the point is
+			simd_float px = simd_load(x + i), py = simd_load(y + i), pz = simd_load(z + i);
+			simd_float wx = simd_madd(pz, simd_set1(world.m[2][0]), simd_madd(py, simd_set1(world.m[1][0]), simd_madd(px, simd_set1(world.m[0][0]), simd_set1(world.m[3][0]))));
+			simd_float wy = simd_madd(pz, simd_set1(world.m[2][1]), simd_madd(py, simd_set1(world.m[1][1]), simd_madd(px, simd_set1(world.m[0][1]), simd_set1(world.m[3][1]))));
+			simd_float wz = simd_madd(pz, simd_set1(world.m[2][2]), simd_madd(py, simd_set1(world.m[1][2]), simd_madd(px, simd_set1(world.m[0][2]), simd_set1(world.m[3][2]))));
+			for (const PointLight& p : lighting.points) {
+				simd_float vx = simd_sub(simd_set1(p.position.x), wx);
+				simd_float vy = simd_sub(simd_set1(p.position.y), wy);
+				simd_float vz = simd_sub(simd_set1(p.position.z), wz);
+				simd_float d2 = simd_madd(vz, vz, simd_madd(vy, vy, simd_mul(vx, vx)));
+				simd_float lambert = simd_mul(simd_madd(vnz, vz, simd_madd(vny, vy, simd_mul(vnx, vx))), simd_rsqrt_refined(simd_max(d2, tiny)));
+				simd_float reaching = simd_div(simd_set1(p.intensity), simd_madd(d2, simd_set1(p.falloff), one));
+				light = simd_madd(simd_max(lambert, zero), reaching, light);
+			}
+		}
+		simd_store(out + i, simd_min(light, one));
+	}
+}
+
+void LightingStage::reserveBatch(size_t count) {
+	size_t padded = (count + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+	if (m_light.size() >= padded)
+		return;
+	// The padding lanes are lit like any other point and thrown away, they only have to hold numbers
+	for (std::vector<float>* v : { &m_x, &m_y, &m_z, &m_nx, &m_ny, &m_nz, &m_light })
+		v->resize(padded, 0.0f);
+}
+
+void LightingStage::shadeFlat(const Lighting& lighting, const mat4x4& world, const Mesh& mesh, const VertexStream& worldNormals,
+	const std::vector<uint32_t>& visible) {
+	PROFILE_ZONE("light");
+	m_faceLight.resize(mesh.triangleCount());
+	const size_t count = visible.size();
+	reserveBatch(count);
+	const VertexStream& p = mesh.positions;
+	for (size_t i = 0; i < count; i++) {
+		const uint32_t t = visible[i];
+		const uint32_t* idx = &mesh.indices[t * 3];
+		m_x[i] = (p.x[idx[0]] + p.x[idx[1]] + p.x[idx[2]]) * (1.0f / 3.0f);
+		m_y[i] = (p.y[idx[0]] + p.y[idx[1]] + p.y[idx[2]]) * (1.0f / 3.0f);
+		m_z[i] = (p.z[idx[0]] + p.z[idx[1]] + p.z[idx[2]]) * (1.0f / 3.0f);
+		m_nx[i] = worldNormals.x[t];
+		m_ny[i] = worldNormals.y[t];
+		m_nz[i] = worldNormals.z[t];
+	}
+	evaluateLighting(lighting, world, m_x.data(), m_y.data(), m_z.data(), m_nx.data(), m_ny.data(), m_nz.data(), count, m_light.data(), m_toLight);
+	for (size_t i = 0; i < count; i++)
+		m_faceLight[visible[i]] = m_light[i];
+}
+
+void LightingStage::applyFlat(std::vector<ScreenTriangle>& triangles, size_t begin, size_t end) const {
+	for (size_t i = begin; i < end; i++) {
+		float level = m_faceLight[triangles[i].id];
+		triangles[i].shade[0] = level;
+		triangles[i].shade[1] = level;
+		triangles[i].shade[2] = level;
+	}
+}
+
+void LightingStage::updateVertexNormals(const Mesh& mesh, const VertexStream& worldNormals) {
+	const size_t vertexCount = mesh.positions.size();
+	m_vertexNormals.resize(vertexCount);
+	std::fill(m_vertexNormals.x.begin(), m_vertexNormals.x.end(), 0.0f);
+	std::fill(m_vertexNormals.y.begin(), m_vertexNormals.y.end(), 0.0f);
+	std::fill(m_vertexNormals.z.begin(), m_vertexNormals.z.end(), 0.0f);
+	for (size_t t = 0; t < mesh.triangleCount(); t++) {
+		for (int c = 0; c < 3; c++) {
+			uint32_t v = mesh.indices[t * 3 + c];
+			m_vertexNormals.x[v] += worldNormals.x[t];
+			m_vertexNormals.y[v] += worldNormals.y[t];
+			m_vertexNormals.z[v] += worldNormals.z[t];
+		}
+	}
+	normalizeVectors(m_vertexNormals);
+}
+
+void LightingStage::shadeVertices(const Lighting& lighting, const mat4x4& world, const Mesh& mesh, const std::vector<uint32_t>& visible) {
+	PROFILE_ZONE("light");
+	const size_t vertexCount = mesh.positions.size();
+	m_vertexLight.resize(vertexCount);
+	if (m_stamp.size() != vertexCount || ++m_frame == 0) {
+		m_stamp.assign(vertexCount, 0);
+		m_frame = 1;
+	}
+
+	// Every vertex of a visible triangle once
+	m_ids.clear();
+	for (uint32_t t : visible) {
+		for (int c = 0; c < 3; c++) {
+			uint32_t v = mesh.indices[t * 3 + c];
+			if (m_stamp[v] != m_frame) {
+				m_stamp[v] = m_frame;
+				m_ids.push_back(v);
+			}
+		}
+	}
+
+	const size_t count = m_ids.size();
+	reserveBatch(count);
+	const VertexStream& p = mesh.positions;
+	for (size_t i = 0; i < count; i++) {
+		const uint32_t v = m_ids[i];
+		m_x[i] = p.x[v];
+		m_y[i] = p.y[v];
+		m_z[i] = p.z[v];
+		m_nx[i] = m_vertexNormals.x[v];
+		m_ny[i] = m_vertexNormals.y[v];
+		m_nz[i] = m_vertexNormals.z[v];
+	}
+	evaluateLighting(lighting, world, m_x.data(), m_y.data(), m_z.data(), m_nx.data(), m_ny.data(), m_nz.data(), count, m_light.data(), m_toLight);
+	for (size_t i = 0; i < count; i++)
+		m_vertexLight[m_ids[i]] = m_light[i];
+}
+
+void computeShadePlanes(const std::vector<ScreenTriangle>& triangles, std::vector<ShadePlane>& planes) {
+	planes.resize(triangles.size());
+	for (size_t i = 0; i < triangles.size(); i++) {
+		const ScreenTriangle& t = triangles[i];
+		const float* s = t.shade;
+		ShadePlane& plane = planes[i];
+		float x1 = t.x[1] - t.x[0], y1 = t.y[1] - t.y[0];
+		float x2 = t.x[2] - t.x[0], y2 = t.y[2] - t.y[0];
+		float s1 = s[1] - s[0], s2 = s[2] - s[0];
+		float area = x1 * y2 - x2 * y1;
+		if ((s1 == 0.0f && s2 == 0.0f) || area == 0.0f) {
+			plane = { s[0], 0.0f, 0.0f };
+			continue;
+		}
+		float b = (s1 * y2 - s2 * y1) / area;
+		float c = (x1 * s2 - x2 * s1) / area;
+		// The rasterizer samples pixel centers, folded into a so a pixel only needs its integer position
+		plane = { s[0] + b * (0.5f - t.x[0]) + c * (0.5f - t.y[0]), b, c };
+	}
+}
+
+void buildLightRamp(short colour, bool backgrounds, Shade* shades, int levels) {
+	// Brightness of a colour in the classic console palette, the largest of its channels
+	auto brightness = [](short c) {
+		if (c == FG_BLACK)
+			return 0.0f;
+		if (c == FG_GREY)
+			return 0.75f;
+		return c > FG_DARK_GREY ? 1.0f : 0.5f;
+	};
+
+	// The colours of the same hue as colour, from black up
+	colour &= 0x0F;
+	short hue[4];
+	int hueCount = 0;
+	hue[hueCount++] = FG_BLACK;
+	if (colour == FG_WHITE || colour == FG_GREY) {
+		hue[hueCount++] = FG_DARK_GREY;
+		hue[hueCount++] = FG_GREY;
+		if (colour == FG_WHITE)
+			hue[hueCount++] = FG_WHITE;
+	}
+	else if (colour > FG_DARK_GREY) {
+		hue[hueCount++] = static_cast<short>(colour - FG_DARK_GREY);
+		hue[hueCount++] = colour;
+	}
+	else if (colour != FG_BLACK) {
+		hue[hueCount++] = colour;
+	}
+
+	// Every block over every darker colour of the hue, or over black only
+	struct Candidate
+	{
+		Shade shade;
+		float brightness;
+	};
+	const short blocks[4] = { PIXEL_QUARTER, PIXEL_HALF, PIXEL_THREEQUARTERS, PIXEL_SOLID };
+	std::vector<Candidate> candidates;
+	candidates.push_back({ { ' ', FG_BLACK | BG_BLACK }, 0.0f });
+	for (int f = 1; f < hueCount; f++) {
+		for (int b = 0; b < (backgrounds ? f : 1); b++) {
+			for (int g = 0; g < 4; g++) {
+				float cover = (g + 1) / 4.0f;
+				// The solid block hides the background, one of them is enough
+				if (g == 3 && b > 0)
+					continue;
+				candidates.push_back({ { blocks[g], static_cast<short>(hue[f] | hue[b] << 4) },
+					cover * brightness(hue[f]) + (1.0f - cover) * brightness(hue[b]) });
+			}
+		}
+	}
+
+	const float full = brightness(colour);
+	for (int i = 0; i < levels; i++) {
+		float target = full * i / (levels - 1);
+		const Candidate* best = &candidates[0];
+		for (const Candidate& c : candidates) {
+			if (fabsf(c.brightness - target) < fabsf(best->brightness - target))
+				best = &c;
+		}
+		shades[i] = best->shade;
+	}
+}
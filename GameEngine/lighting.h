@@ -0,0 +1,132 @@
+#pragma once
+
+#include "clipper.h"
+#include "framebuffer.h"
+#include "geometry.h"
+#include <cstdint>
+#include <vector>
+
+/*
+* Lighting.
+*
+* Light is evaluated for surface points in batches, SIMD_WIDTH points at a time with no branches: an ambient term,
+* Lambert for every directional light and Lambert with distance falloff for every point light, clamped to 1.
+* LightingStage picks the points from the triangles that survived backface culling only, so its cost follows the
+* visible triangles rather than the mesh:
+*
+* - flat, one level per visible triangle, at its centroid with its face normal, copied into the ScreenTriangles
+*   after clipping (applyFlat)
+* - Gouraud, one level per vertex used by a visible triangle, with vertex normals averaged from the faces around
+*   it, which clipTriangles carries to the corners of the ScreenTriangles and the rasterizer interpolates
+*
+* The rasterizer turns a level into a cell through a LightRamp, a table from level to the glyph and colours that
+* look closest to that brightness, optionally offset by an ordered dither pattern first. Per pixel that is a plane
+* evaluation, an add, a clamp and a table load, see console::fillTrianglesLit.
+*/
+
+struct DirectionalLight
+{
+	// The way the light travels, does not need to be unit length
+	vec3 direction;
+	float intensity;
+};
+
+struct PointLight
+{
+	vec3 position;
+	float intensity;
+	// The light reaching a point d away is intensity / (1 + falloff * d * d)
+	float falloff;
+};
+
+struct Lighting
+{
+	float ambient = 0.1f;
+	std::vector<DirectionalLight> directional;
+	std::vector<PointLight> points;
+};
+
+/*
+* The light level, 0 to 1, of count points (x, y, z, transformed by world) with world space unit normals
+* (nx, ny, nz). Every array holds count rounded up to a multiple of SIMD_WIDTH, out too, the padding is ignored.
+* toLight is scratch space for the directions to the directional lights, kept by the caller so a call does not allocate.
+*/
+void evaluateLighting(const Lighting& lighting, const mat4x4& world, const float* x, const float* y, const float* z,
+	const float* nx, const float* ny, const float* nz, size_t count, float* out, std::vector<vec3>& toLight);
+
+class LightingStage
+{
+public:
+	// Light the visible triangles of mesh, one level each, see faceLight
+	void shadeFlat(const Lighting& lighting, const mat4x4& world, const Mesh& mesh, const VertexStream& worldNormals,
+		const std::vector<uint32_t>& visible);
+	// The level shadeFlat gave triangle t, only meaningful for the triangles that were visible
+	float faceLight(uint32_t t) const { return m_faceLight[t]; }
+	// Give the ScreenTriangles in [begin, end) the flat level of the mesh triangle they came from
+	void applyFlat(std::vector<ScreenTriangle>& triangles, size_t begin, size_t end) const;
+
+	/*
+	* World space vertex normals of mesh, the average of the normals of the triangles around each vertex.
+	* Like worldNormals only needed again when the mesh moves or another level is drawn.
+	*/
+	void updateVertexNormals(const Mesh& mesh, const VertexStream& worldNormals);
+	// Light every vertex used by a visible triangle, for clipTriangles' vertexLight
+	void shadeVertices(const Lighting& lighting, const mat4x4& world, const Mesh& mesh, const std::vector<uint32_t>& visible);
+	// One level per vertex of the mesh, only meaningful for the vertices of the visible triangles
+	const float* vertexLight() const { return m_vertexLight.data(); }
+
+private:
+	// Make room for count points in the batch arrays, rounded up to whole SIMD batches
+	void reserveBatch(size_t count);
+
+	std::vector<float> m_faceLight;
+	VertexStream m_vertexNormals;
+	std::vector<float> m_vertexLight;
+	// The frame a vertex was last gathered in, so gathering needs no clearing
+	std::vector<uint32_t> m_stamp;
+	uint32_t m_frame = 0;
+	// The points of one call in SoA form
+	std::vector<float> m_x, m_y, m_z, m_nx, m_ny, m_nz, m_light;
+	std::vector<uint32_t> m_ids;
+	// evaluateLighting's scratch
+	std::vector<vec3> m_toLight;
+};
+
+// A light level plane over the screen, level = a + b * x + c * y for the pixel at (x, y), measured at its center
+struct ShadePlane
+{
+	float a;
+	float b;
+	float c;
+};
+
+// The plane through the three corners of every triangle, flat when the corners have the same level
+void computeShadePlanes(const std::vector<ScreenTriangle>& triangles, std::vector<ShadePlane>& planes);
+
+// 4x4 ordered dither thresholds, row by row, in (0, 1)
+extern const float orderedDither[16];
+// No dither, every pixel rounds to the nearest level
+extern const float noDither[16];
+
+/*
+* Fill shades with levels entries, entry i the glyph and colours closest in brightness to i / (levels - 1) of
+* colour at full light, from the shade blocks of PIXEL_TYPE over the darker shades of the colour in COLOUR.
+* Without backgrounds (PaletteCell) only black is used behind the blocks.
+*/
+void buildLightRamp(short colour, bool backgrounds, Shade* shades, int levels);
+
+template <typename Cell>
+struct LightRamp
+{
+	static const int levels = 64;
+	Cell cells[levels];
+	short colour = -1;
+
+	void build(short c) {
+		colour = c;
+		Shade shades[levels];
+		buildLightRamp(c, Cell::hasBackground, shades, levels);
+		for (int i = 0; i < levels; i++)
+			cells[i] = Cell::make(shades[i].glyph, shades[i].attributes);
+	}
+};
@@ -0,0 +1,338 @@
+#include "lod.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <queue>
+
+namespace {
+
+// Sum of squared distances to a set of planes, as the symmetric 4x4 matrix sum(p * p^T) of the planes (a, b, c, d)
+struct Quadric
+{
+	// aa ab ac ad bb bc bd cc cd dd
+	double q[10] = {};
+
+	void addPlane(double a, double b, double c, double d, double weight) {
+		q[0] += weight * a * a; q[1] += weight * a * b; q[2] += weight * a * c; q[3] += weight * a * d;
+		q[4] += weight * b * b; q[5] += weight * b * c; q[6] += weight * b * d;
+		q[7] += weight * c * c; q[8] += weight * c * d;
+		q[9] += weight * d * d;
+	}
+	void add(const Quadric& o) {
+		for (int i = 0; i < 10; i++)
+			q[i] += o.q[i];
+	}
+	double error(const vec3& p) const {
+		double x = p.x, y = p.y, z = p.z;
+		return x * x * q[0] + 2 * x * y * q[1] + 2 * x * z * q[2] + 2 * x * q[3]
+			+ y * y * q[4] + 2 * y * z * q[5] + 2 * y * q[6]
+			+ z * z * q[7] + 2 * z * q[8] + q[9];
+	}
+	// The point with the least error, false when the planes do not pin one down (flat or straight neighbourhoods)
+	bool minimum(vec3& p) const {
+		double det = q[0] * (q[4] * q[7] - q[5] * q[5]) - q[1] * (q[1] * q[7] - q[5] * q[2]) + q[2] * (q[1] * q[5] - q[4] * q[2]);
+		if (!(std::fabs(det) > 1e-9 * std::fabs(q[0] * q[4] * q[7])))
+			return false;
+		// Cramer's rule on A p = -b
+		double bx = -q[3], by = -q[6], bz = -q[8];
+		double x = (bx * (q[4] * q[7] - q[5] * q[5]) - q[1] * (by * q[7] - q[5] * bz) + q[2] * (by * q[5] - q[4] * bz)) / det;
+		double y = (q[0] * (by * q[7] - bz * q[5]) - bx * (q[1] * q[7] - q[5] * q[2]) + q[2] * (q[1] * bz - by * q[2])) / det;
+		double z = (q[0] * (q[4] * bz - q[5] * by) - q[1] * (q[1] * bz - by * q[2]) + bx * (q[1] * q[5] - q[4] * q[2])) / det;
+		p = { static_cast<float>(x), static_cast<float>(y), static_cast<float>(z) };
+		return true;
+	}
+};
+
+struct Collapse
+{
+	double cost;
+	uint32_t v[2];
+	// The versions of both vertices when this was queued, it is stale once either changed
+	uint32_t version[2];
+	vec3 target;
+	bool operator<(const Collapse& o) const { return cost > o.cost; }
+};
+
+// Weight of the planes holding boundary edges in place, relative to the surface planes
+const double boundaryWeight = 1000.0;
+
+class Simplifier
+{
+public:
+	Simplifier(const Mesh& mesh) : m_positions(mesh.positions), m_indices(mesh.indices) {
+		const size_t vertices = m_positions.size();
+		const size_t triangles = m_indices.size() / 3;
+		m_quadrics.resize(vertices);
+		m_version.assign(vertices, 0);
+		m_removed.assign(vertices, false);
+		m_faces.resize(vertices);
+		m_alive.assign(triangles, true);
+		m_live = triangles;
+
+		for (size_t t = 0; t < triangles; t++) {
+			vec3 n = faceNormal(t);
+			double length = vec3_length(n);
+			if (length > 0.0) {
+				// Weighted by area, a big triangle's plane matters more than a sliver's
+				vec3 p = corner(t, 0);
+				double a = n.x / length, b = n.y / length, c = n.z / length;
+				double d = -(a * p.x + b * p.y + c * p.z);
+				for (int k = 0; k < 3; k++)
+					m_quadrics[m_indices[t * 3 + k]].addPlane(a, b, c, d, length * 0.5);
+			}
+			for (int k = 0; k < 3; k++)
+				m_faces[m_indices[t * 3 + k]].push_back(static_cast<uint32_t>(t));
+		}
+
+		std::vector<MeshEdge> edges = mesh.edges;
+		if (edges.empty()) {
+			Mesh copy;
+			copy.indices = mesh.indices;
+			copy.positions = mesh.positions;
+			copy.buildEdges();
+			edges = std::move(copy.edges);
+		}
+		for (const MeshEdge& e : edges) {
+			if (e.face[1] == MeshEdge::noFace) {
+				// A plane through the edge at right angles to its triangle, so sliding along the boundary is free but leaving it is not
+				vec3 p0 = m_positions.get(e.v[0]);
+				vec3 dir = vec3_sub(m_positions.get(e.v[1]), p0);
+				vec3 n = cross_product(dir, faceNormal(e.face[0]));
+				double length = vec3_length(n);
+				if (length > 0.0) {
+					double a = n.x / length, b = n.y / length, c = n.z / length;
+					double d = -(a * p0.x + b * p0.y + c * p0.z);
+					double weight = boundaryWeight * dot_product(dir, dir);
+					m_quadrics[e.v[0]].addPlane(a, b, c, d, weight);
+					m_quadrics[e.v[1]].addPlane(a, b, c, d, weight);
+				}
+			}
+		}
+		for (const MeshEdge& e : edges)
+			queue(e.v[0], e.v[1]);
+	}
+
+	bool run(size_t targetTriangles) {
+		while (m_live > targetTriangles && !m_heap.empty()) {
+			Collapse c = m_heap.top();
+			m_heap.pop();
+			if (m_removed[c.v[0]] || m_removed[c.v[1]] || m_version[c.v[0]] != c.version[0] || m_version[c.v[1]] != c.version[1])
+				continue;
+			if (flips(c.v[0], c.v[1], c.target) || flips(c.v[1], c.v[0], c.target))
+				continue;
+			collapse(c.v[0], c.v[1], c.target);
+		}
+		return m_live <= targetTriangles;
+	}
+
+	// Write the surviving triangles and the vertices they use
+	void write(Mesh& out) const {
+		std::vector<uint32_t> remap(m_positions.size(), 0xFFFFFFFFu);
+		out = Mesh();
+		out.indices.reserve(m_live * 3);
+		for (size_t t = 0; t < m_alive.size(); t++) {
+			if (!m_alive[t])
+				continue;
+			for (int k = 0; k < 3; k++) {
+				uint32_t v = m_indices[t * 3 + k];
+				if (remap[v] == 0xFFFFFFFFu) {
+					remap[v] = static_cast<uint32_t>(out.positions.size());
+					out.positions.push_back(m_positions.get(v));
+				}
+				out.indices.push_back(remap[v]);
+			}
+		}
+		out.buildEdges();
+		out.updateNormals();
+	}
+
+private:
+	vec3 corner(size_t t, int k) const { return m_positions.get(m_indices[t * 3 + k]); }
+
+	vec3 faceNormal(size_t t) const {
+		vec3 p0 = corner(t, 0);
+		return cross_product(vec3_sub(corner(t, 1), p0), vec3_sub(corner(t, 2), p0));
+	}
+
+	void queue(uint32_t a, uint32_t b) {
+		Quadric q = m_quadrics[a];
+		q.add(m_quadrics[b]);
+		vec3 pa = m_positions.get(a), pb = m_positions.get(b);
+		// The minimum of the merged quadric when there is one near the edge, else the best of the ends and the middle.
+		// A nearly flat neighbourhood can put the minimum far off, pulling a vertex through the surface
+		vec3 middle = vec3_mul(vec3_add(pa, pb), 0.5f);
+		vec3 candidates[4] = { pa, pb, middle, pa };
+		int count = 3;
+		if (q.minimum(candidates[3])) {
+			vec3 offset = vec3_sub(candidates[3], middle), edge = vec3_sub(pb, pa);
+			if (dot_product(offset, offset) <= dot_product(edge, edge))
+				count = 4;
+		}
+		Collapse c;
+		c.cost = q.error(candidates[0]);
+		c.target = candidates[0];
+		for (int i = 1; i < count; i++) {
+			double e = q.error(candidates[i]);
+			if (e < c.cost) {
+				c.cost = e;
+				c.target = candidates[i];
+			}
+		}
+		c.v[0] = a;
+		c.v[1] = b;
+		c.version[0] = m_version[a];
+		c.version[1] = m_version[b];
+		m_heap.push(c);
+	}
+
+	// Whether moving v to target turns over one of its triangles that does not also use other
+	bool flips(uint32_t v, uint32_t other, const vec3& target) const {
+		for (uint32_t t : m_faces[v]) {
+			if (!m_alive[t])
+				continue;
+			const uint32_t* tri = &m_indices[t * 3];
+			if (tri[0] == other || tri[1] == other || tri[2] == other)
+				continue;
+			vec3 p[3];
+			for (int k = 0; k < 3; k++)
+				p[k] = tri[k] == v ? target : m_positions.get(tri[k]);
+			vec3 moved = cross_product(vec3_sub(p[1], p[0]), vec3_sub(p[2], p[0]));
+			if (dot_product(moved, faceNormal(t)) <= 0.0f)
+				return true;
+		}
+		return false;
+	}
+
+	// Merge b into a at target
+	void collapse(uint32_t a, uint32_t b, const vec3& target) {
+		m_positions.x[a] = target.x;
+		m_positions.y[a] = target.y;
+		m_positions.z[a] = target.z;
+		m_quadrics[a].add(m_quadrics[b]);
+		m_removed[b] = true;
+		m_version[a]++;
+
+		for (uint32_t t : m_faces[b]) {
+			if (!m_alive[t])
+				continue;
+			uint32_t* tri = &m_indices[t * 3];
+			if (tri[0] == a || tri[1] == a || tri[2] == a) {
+				// The triangles along the edge shrink to nothing
+				m_alive[t] = false;
+				m_live--;
+				continue;
+			}
+			for (int k = 0; k < 3; k++) {
+				if (tri[k] == b)
+					tri[k] = a;
+			}
+			m_faces[a].push_back(t);
+		}
+		m_faces[b].clear();
+		m_faces[b].shrink_to_fit();
+
+		// Drop the dead triangles from a's list and queue the edges to its neighbours again with the new quadric
+		std::vector<uint32_t>& faces = m_faces[a];
+		faces.erase(std::remove_if(faces.begin(), faces.end(), [this](uint32_t t) { return !m_alive[t]; }), faces.end());
+		m_neighbours.clear();
+		for (uint32_t t : faces) {
+			for (int k = 0; k < 3; k++) {
+				uint32_t v = m_indices[t * 3 + k];
+				if (v != a)
+					m_neighbours.push_back(v);
+			}
+		}
+		std::sort(m_neighbours.begin(), m_neighbours.end());
+		m_neighbours.erase(std::unique(m_neighbours.begin(), m_neighbours.end()), m_neighbours.end());
+		for (uint32_t v : m_neighbours)
+			queue(a, v);
+	}
+
+	VertexStream m_positions;
+	std::vector<uint32_t> m_indices;
+	std::vector<Quadric> m_quadrics;
+	// Bumped every time a vertex moves, see Collapse
+	std::vector<uint32_t> m_version;
+	std::vector<bool> m_removed;
+	// The triangles around every vertex, may still list some that died
+	std::vector<std::vector<uint32_t>> m_faces;
+	std::vector<bool> m_alive;
+	size_t m_live;
+	std::priority_queue<Collapse> m_heap;
+	std::vector<uint32_t> m_neighbours;
+};
+
+}
+
+bool simplifyMesh(const Mesh& in, size_t targetTriangles, Mesh& out) {
+	Simplifier simplifier(in);
+	bool reached = simplifier.run(targetTriangles);
+	simplifier.write(out);
+	return reached;
+}
+
+void LodMesh::build(const Mesh& mesh, const std::vector<float>& fractions) {
+	m_source = &mesh;
+	m_levels.clear();
+	m_levels.reserve(fractions.size());
+	const Mesh* previous = &mesh;
+	for (float fraction : fractions) {
+		size_t target = static_cast<size_t>(mesh.triangleCount() * fraction);
+		if (target == 0 || target >= previous->triangleCount())
+			continue;
+		m_levels.emplace_back();
+		simplifyMesh(*previous, target, m_levels.back());
+		previous = &m_levels.back();
+	}
+
+	const VertexStream& p = mesh.positions;
+	m_center = { 0.0f, 0.0f, 0.0f };
+	m_radius = 0.0f;
+	if (p.size() == 0)
+		return;
+	vec3 lo = p.get(0), hi = lo;
+	for (size_t i = 1; i < p.size(); i++) {
+		lo = { std::min(lo.x, p.x[i]), std::min(lo.y, p.y[i]), std::min(lo.z, p.z[i]) };
+		hi = { std::max(hi.x, p.x[i]), std::max(hi.y, p.y[i]), std::max(hi.z, p.z[i]) };
+	}
+	m_center = vec3_mul(vec3_add(lo, hi), 0.5f);
+	float radius2 = 0.0f;
+	for (size_t i = 0; i < p.size(); i++) {
+		vec3 d = vec3_sub(p.get(i), m_center);
+		radius2 = std::max(radius2, dot_product(d, d));
+	}
+	m_radius = sqrtf(radius2);
+}
+
+float LodMesh::coveredCells(const mat4x4& world, const vec3& cameraPos, float projectionScale, float viewportHeight) const {
+	vec3 local = m_center, center;
+	world.matrixMultiplyVector(local, center);
+	// The longest axis of the world matrix, so a scaled object gets a scaled sphere
+	float scale = 0.0f;
+	for (int i = 0; i < 3; i++)
+		scale = std::max(scale, sqrtf(world.m[i][0] * world.m[i][0] + world.m[i][1] * world.m[i][1] + world.m[i][2] * world.m[i][2]));
+	float radius = m_radius * scale;
+	float distance = vec3_length(vec3_sub(center, cameraPos));
+	// Inside the sphere, as big as it gets
+	if (distance <= radius)
+		return FLT_MAX;
+	float cellRadius = radius / distance * projectionScale * viewportHeight * 0.5f;
+	return 3.14159265f * cellRadius * cellRadius;
+}
+
+size_t LodMesh::ideal(float cells) const {
+	size_t best = 0;
+	for (size_t i = 1; i < levelCount(); i++) {
+		if (level(i).triangleCount() >= cells * trianglesPerCell)
+			best = i;
+	}
+	return best;
+}
+
+size_t LodMesh::select(float cells, size_t current) const {
+	size_t finer = ideal(cells);
+	if (finer < current)
+		return finer;
+	size_t coarser = ideal(cells * (1.0f + hysteresis));
+	return coarser > current ? coarser : current;
+}
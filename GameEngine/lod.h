@@ -0,0 +1,63 @@
+#pragma once
+
+#include "geometry.h"
+
+/*
+* Level of detail.
+*
+* simplifyMesh reduces a mesh by edge collapses in the order of the quadric error metric (Garland and Heckbert):
+* every vertex carries the sum of the squared distances to the planes of the triangles around it, collapsing an
+* edge merges the two sums and moves the surviving vertex to where the merged sum is smallest, and the edge whose
+* collapse adds the least error goes first. Collapses that would flip a triangle over are skipped, and open
+* boundaries are held in place by extra planes along them so holes do not grow.
+*
+* LodMesh keeps a chain of such simplifications of a mesh, and picks one per object from how many screen cells
+* the object covers: the coarsest level that still has about trianglesPerCell triangles for every covered cell.
+* A distant teapot covering a few cells is drawn from a few dozen triangles instead of thousands. To stop an
+* object sitting right at a threshold from switching levels every frame, moving to a coarser level needs the
+* coverage to drop a further hysteresis fraction below the threshold.
+*/
+
+/*
+* Simplify in down to at most targetTriangles triangles and write the result to out, with its edges and normals built.
+* Returns false if that was not reached, out then holds the smallest mesh the collapses could reach.
+*/
+bool simplifyMesh(const Mesh& in, size_t targetTriangles, Mesh& out);
+
+class LodMesh
+{
+public:
+	/*
+	* Build the chain for mesh, one level per fraction of its triangle count, finest first, e.g. { 0.5f, 0.25f, 0.1f }.
+	* Each level is simplified from the one before it. The mesh is referenced as level 0, not copied.
+	*/
+	void build(const Mesh& mesh, const std::vector<float>& fractions = { 0.5f, 0.25f, 0.1f });
+
+	// Level 0 is the mesh itself
+	size_t levelCount() const { return m_levels.size() + (m_source ? 1 : 0); }
+	const Mesh& level(size_t i) const { return i == 0 ? *m_source : m_levels[i - 1]; }
+
+	/*
+	* Screen cells covered by the mesh's bounding sphere, transformed by world, seen from cameraPos.
+	* projectionScale is matProj.m[1][1] and viewportHeight the screen height in cells.
+	*/
+	float coveredCells(const mat4x4& world, const vec3& cameraPos, float projectionScale, float viewportHeight) const;
+
+	// The level to draw for an object covering cells screen cells that was drawn at level current last frame
+	size_t select(float cells, size_t current) const;
+
+	// How many triangles a covered cell is worth
+	float trianglesPerCell = 1.0f;
+	// See LodMesh, as a fraction of the threshold
+	float hysteresis = 0.25f;
+
+private:
+	// The coarsest level with enough triangles for cells
+	size_t ideal(float cells) const;
+
+	const Mesh* m_source = nullptr;
+	std::vector<Mesh> m_levels;
+	// Bounding sphere of the source mesh, in mesh space
+	vec3 m_center = { 0.0f, 0.0f, 0.0f };
+	float m_radius = 0.0f;
+};
@@ -0,0 +1,108 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& filename) {
+	close();
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		return false;
+	}
+	m_file = file;
+	m_size = static_cast<size_t>(size.QuadPart);
+	m_open = true;
+
+	// An empty file cannot be mapped, but it is still a valid (empty) view
+	if (m_size == 0)
+		return true;
+
+	m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_mapping == nullptr) {
+		close();
+		return false;
+	}
+	m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (m_data == nullptr) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close() {
+	if (m_data)
+		UnmapViewOfFile(m_data);
+	if (m_mapping)
+		CloseHandle(m_mapping);
+	if (m_file)
+		CloseHandle(m_file);
+	m_data = nullptr;
+	m_mapping = nullptr;
+	m_file = nullptr;
+	m_size = 0;
+	m_open = false;
+}
+
+#else
+
+bool MappedFile::open(const std::string& filename) {
+	close();
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		::close(fd);
+		return false;
+	}
+	m_fd = fd;
+	m_size = static_cast<size_t>(st.st_size);
+	m_open = true;
+
+	// An empty file cannot be mapped, but it is still a valid (empty) view
+	if (m_size == 0)
+		return true;
+
+	void* p = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) {
+		close();
+		return false;
+	}
+	// We read front to back, let the kernel read ahead aggressively
+	madvise(p, m_size, MADV_SEQUENTIAL);
+	m_data = static_cast<const char*>(p);
+	return true;
+}
+
+void MappedFile::close() {
+	if (m_data)
+		munmap(const_cast<char*>(m_data), m_size);
+	if (m_fd >= 0)
+		::close(m_fd);
+	m_data = nullptr;
+	m_fd = -1;
+	m_size = 0;
+	m_open = false;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+/*
+* A read-only view of a whole file mapped into memory, so loaders can parse straight out of the
+* page cache without copying the file into a buffer first. The mapping is released when this goes
+* out of scope. Uses CreateFileMapping on Windows and mmap everywhere else.
+*/
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Map the file, returns false if it does not exist or cannot be mapped
+	bool open(const std::string& filename);
+	void close();
+
+	const char* data() const { return m_data; }
+	size_t size() const { return m_size; }
+	bool isOpen() const { return m_open; }
+
+private:
+	const char* m_data = nullptr;
+	size_t m_size = 0;
+	bool m_open = false;
+#ifdef _WIN32
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#else
+	int m_fd = -1;
+#endif
+};
@@ -0,0 +1,185 @@
+#include "meshcache.h"
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const char meshCacheMagic[4] = { 'G', 'E', 'M', 'C' };
+const uint64_t sectionAlignment = 64;
+
+constexpr uint64_t alignUp(uint64_t v) {
+	return (v + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+}
+
+// The header padded to the first section boundary, where the payload starts
+constexpr uint64_t headerBlockSize = alignUp(sizeof(MeshCacheHeader));
+
+const uint64_t checksumSeed = 0xcbf29ce484222325ull;
+
+// A 64 bit multiply-xor hash over 8 byte words, several GB/s so checking does not dominate the load
+// Continues from h, so a hash can run over several pieces
+uint64_t checksum(const char* data, size_t size, uint64_t h = checksumSeed) {
+	const uint64_t prime = 0x100000001b3ull;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		h = (h ^ word) * prime;
+		h ^= h >> 29;
+	}
+	for (; i < size; i++) {
+		h = (h ^ static_cast<unsigned char>(data[i])) * prime;
+	}
+	return h;
+}
+
+// The header, with its own checksum field taken as 0, followed by the payload
+uint64_t fileChecksum(const MeshCacheHeader& header, const char* payload, size_t payloadSize) {
+	MeshCacheHeader copy = header;
+	copy.checksum = 0;
+	uint64_t h = checksum(reinterpret_cast<const char*>(&copy), sizeof(copy));
+	return checksum(payload, payloadSize, h);
+}
+
+// Whether count items of size bytes at offset lie inside a file of fileSize bytes, after the header and
+// aligned for the item type. Written so that no sum or product can overflow, whatever the header claims
+bool sectionFits(uint64_t offset, uint64_t count, uint64_t size, uint64_t alignment, uint64_t fileSize) {
+	return offset >= headerBlockSize && offset <= fileSize && offset % alignment == 0 &&
+		count <= (fileSize - offset) / size;
+}
+
+// Size and modification time of the source file, the two things that invalidate a cache
+bool sourceStamp(const std::string& sourceFile, uint64_t& size, int64_t& time) {
+	std::error_code ec;
+	auto fileSize = std::filesystem::file_size(sourceFile, ec);
+	if (ec)
+		return false;
+	auto fileTime = std::filesystem::last_write_time(sourceFile, ec);
+	if (ec)
+		return false;
+	size = static_cast<uint64_t>(fileSize);
+	time = static_cast<int64_t>(fileTime.time_since_epoch().count());
+	return true;
+}
+
+}
+
+std::string meshCachePath(const std::string& sourceFile) {
+	return sourceFile + ".meshcache";
+}
+
+bool writeMeshCache(const std::string& cacheFile, const Mesh& mesh, const std::string& sourceFile) {
+	MeshCacheHeader header = {};
+	memcpy(header.magic, meshCacheMagic, sizeof(header.magic));
+	header.version = meshCacheVersion;
+	if (!sourceStamp(sourceFile, header.sourceSize, header.sourceTime))
+		return false;
+	header.vertexCount = mesh.positions.size();
+	header.indexCount = mesh.indices.size();
+	header.triangleCount = mesh.normals.size();
+	header.edgeCount = mesh.edges.size();
+
+	// Lay the arrays out back to back, each on its own alignment boundary
+	uint64_t offset = headerBlockSize;
+	for (int c = 0; c < 3; c++) {
+		header.positionsOffset[c] = offset;
+		offset = alignUp(offset + header.vertexCount * sizeof(float));
+	}
+	header.indicesOffset = offset;
+	offset = alignUp(offset + header.indexCount * sizeof(uint32_t));
+	for (int c = 0; c < 3; c++) {
+		header.normalsOffset[c] = offset;
+		offset = alignUp(offset + header.triangleCount * sizeof(float));
+	}
+	header.edgesOffset = offset;
+	offset = alignUp(offset + header.edgeCount * sizeof(MeshEdge));
+	const uint64_t headerSize = headerBlockSize;
+	header.payloadSize = offset - headerSize;
+
+	// Build the payload in memory so it can be checksummed, with the header, before either is written
+	std::vector<char> payload(static_cast<size_t>(header.payloadSize), 0);
+	auto put = [&](uint64_t at, const void* src, size_t bytes) {
+		if (bytes)
+			memcpy(payload.data() + (at - headerSize), src, bytes);
+	};
+	const std::vector<float>* pos[3] = { &mesh.positions.x, &mesh.positions.y, &mesh.positions.z };
+	const std::vector<float>* nrm[3] = { &mesh.normals.x, &mesh.normals.y, &mesh.normals.z };
+	for (int c = 0; c < 3; c++) {
+		put(header.positionsOffset[c], pos[c]->data(), pos[c]->size() * sizeof(float));
+		put(header.normalsOffset[c], nrm[c]->data(), nrm[c]->size() * sizeof(float));
+	}
+	put(header.indicesOffset, mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+	put(header.edgesOffset, mesh.edges.data(), mesh.edges.size() * sizeof(MeshEdge));
+	header.checksum = fileChecksum(header, payload.data(), payload.size());
+
+	std::string tempFile = cacheFile + ".tmp";
+	bool written;
+	{
+		std::ofstream f(tempFile, std::ios::binary | std::ios::trunc);
+		if (!f.is_open())
+			return false;
+		char headerBlock[headerBlockSize] = {};
+		memcpy(headerBlock, &header, sizeof(header));
+		f.write(headerBlock, sizeof(headerBlock));
+		f.write(payload.data(), payload.size());
+		f.close();
+		written = !f.fail();
+	}
+	std::error_code ec;
+	// Do not leave half a cache behind, e.g. when the disk is full
+	if (!written) {
+		std::filesystem::remove(tempFile, ec);
+		return false;
+	}
+	std::filesystem::rename(tempFile, cacheFile, ec);
+	if (ec) {
+		std::filesystem::remove(tempFile, ec);
+		return false;
+	}
+	return true;
+}
+
+bool MappedMesh::open(const std::string& cacheFile, const std::string& sourceFile) {
+	close();
+	if (!m_file.open(cacheFile))
+		return false;
+
+	const uint64_t fileSize = m_file.size();
+	if (fileSize < headerBlockSize) {
+		close();
+		return false;
+	}
+	const MeshCacheHeader* header = reinterpret_cast<const MeshCacheHeader*>(m_file.data());
+
+	// Every array has to lie inside the file before anything is read from it
+	bool valid = header->payloadSize == fileSize - headerBlockSize &&
+		header->triangleCount <= UINT64_MAX / 3 && header->indexCount == header->triangleCount * 3 &&
+		sectionFits(header->indicesOffset, header->indexCount, sizeof(uint32_t), alignof(uint32_t), fileSize) &&
+		sectionFits(header->edgesOffset, header->edgeCount, sizeof(MeshEdge), alignof(MeshEdge), fileSize);
+	for (int c = 0; c < 3; c++) {
+		valid = valid &&
+			sectionFits(header->positionsOffset[c], header->vertexCount, sizeof(float), alignof(float), fileSize) &&
+			sectionFits(header->normalsOffset[c], header->triangleCount, sizeof(float), alignof(float), fileSize);
+	}
+
+	uint64_t size = 0;
+	int64_t time = 0;
+	valid = valid && memcmp(header->magic, meshCacheMagic, sizeof(header->magic)) == 0 &&
+		header->version == meshCacheVersion &&
+		sourceStamp(sourceFile, size, time) &&
+		header->sourceSize == size && header->sourceTime == time &&
+		fileChecksum(*header, m_file.data() + headerBlockSize, static_cast<size_t>(header->payloadSize)) == header->checksum;
+	if (!valid) {
+		close();
+		return false;
+	}
+	m_header = header;
+	return true;
+}
+
+void MappedMesh::close() {
+	m_file.close();
+	m_header = nullptr;
+}
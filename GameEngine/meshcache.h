@@ -0,0 +1,87 @@
+#pragma once
+
+#include "geometry.h"
+#include "mappedfile.h"
+
+/*
+* Binary mesh cache.
+*
+* After an OBJ file has been parsed once, its positions, indices and face normals are written next to it
+* in a binary file laid out exactly as they are used in memory. Later runs map that file and use the arrays
+* in place, there is nothing to parse.
+*
+* Layout, all integers little endian:
+*	MeshCacheHeader
+*	positions x, y, z		vertexCount floats each
+*	indices					indexCount uint32s
+*	normals x, y, z			triangleCount floats each
+*	edges					edgeCount MeshEdges
+* Every array starts on a 64 byte boundary so it can be streamed straight into the SIMD transform.
+*
+* A cache is rejected if its magic, version or checksum is wrong, if an array does not lie inside the file, or
+* if the size or modification time recorded for the source OBJ no longer match the file on disk.
+*/
+
+struct MeshCacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	// Size in bytes and modification time of the OBJ the cache was built from
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	uint64_t vertexCount;
+	uint64_t indexCount;
+	uint64_t triangleCount;
+	uint64_t edgeCount;
+	// Byte offsets from the start of the file
+	uint64_t positionsOffset[3];
+	uint64_t indicesOffset;
+	uint64_t normalsOffset[3];
+	uint64_t edgesOffset;
+	// Everything after the header
+	uint64_t payloadSize;
+	// Over the header, taken with this field 0, and the payload
+	uint64_t checksum;
+};
+
+const uint32_t meshCacheVersion = 3;
+
+// The cache file used for an OBJ file
+std::string meshCachePath(const std::string& sourceFile);
+
+/*
+* Write mesh to cacheFile, stamped with the size and modification time of sourceFile.
+* The file is written under a temporary name and renamed into place, so a reader never sees half a cache.
+*/
+bool writeMeshCache(const std::string& cacheFile, const Mesh& mesh, const std::string& sourceFile);
+
+/*
+* A mesh cache mapped into memory. The accessors point straight into the mapping, so reading
+* a mesh this way costs one mmap plus the checksum pass.
+*/
+class MappedMesh
+{
+public:
+	// Map and validate cacheFile against sourceFile, returns false if the cache is missing or stale
+	bool open(const std::string& cacheFile, const std::string& sourceFile);
+	void close();
+
+	size_t vertexCount() const { return m_header ? static_cast<size_t>(m_header->vertexCount) : 0; }
+	size_t indexCount() const { return m_header ? static_cast<size_t>(m_header->indexCount) : 0; }
+	size_t triangleCount() const { return m_header ? static_cast<size_t>(m_header->triangleCount) : 0; }
+	size_t edgeCount() const { return m_header ? static_cast<size_t>(m_header->edgeCount) : 0; }
+
+	// Component c (0 = x, 1 = y, 2 = z) of every position
+	const float* positions(int c) const { return array<float>(m_header->positionsOffset[c]); }
+	const uint32_t* indices() const { return array<uint32_t>(m_header->indicesOffset); }
+	// Component c of every face normal
+	const float* normals(int c) const { return array<float>(m_header->normalsOffset[c]); }
+	const MeshEdge* edges() const { return array<MeshEdge>(m_header->edgesOffset); }
+
+private:
+	template <typename T>
+	const T* array(uint64_t offset) const { return reinterpret_cast<const T*>(m_file.data() + offset); }
+
+	MappedFile m_file;
+	const MeshCacheHeader* m_header = nullptr;
+};
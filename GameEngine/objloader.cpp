@@ -0,0 +1,310 @@
+#include "objloader.h"
+#include "mappedfile.h"
+#include <charconv>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+// Below this many bytes per chunk, starting a thread costs more than it saves
+const size_t minChunkSize = 1 << 20;
+
+// Relative (negative) indices are resolved against the number of elements defined before the face,
+// which for a chunk other than the first is only known once every earlier chunk has been parsed.
+// Until then they are stored as chunk local indices offset by this bias, which no absolute index reaches
+const int64_t relativeBias = int64_t(1) << 40;
+
+// Everything one chunk of the file produced, indices are still unresolved
+struct ChunkResult
+{
+	VertexStream positions;
+	VertexStream normals;
+	std::vector<vec2> texcoords;
+	// Three unresolved indices (position, texcoord, normal) per triangle corner
+	std::vector<int64_t> corners;
+};
+
+inline bool isSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char* skipSpaces(const char* p, const char* end) {
+	while (p < end && isSpace(*p))
+		p++;
+	return p;
+}
+
+// Parse a float at p, std::from_chars does not accept a leading '+' so skip it ourselves
+inline const char* parseFloat(const char* p, const char* end, float& value) {
+	p = skipSpaces(p, end);
+	if (p < end && *p == '+')
+		p++;
+	auto result = std::from_chars(p, end, value);
+	if (result.ec != std::errc())
+		value = 0.0f;
+	return result.ptr;
+}
+
+inline const char* parseInt(const char* p, const char* end, int64_t& value) {
+	auto result = std::from_chars(p, end, value);
+	if (result.ec != std::errc())
+		value = 0;
+	return result.ptr;
+}
+
+// Turns an OBJ index into a 0 based one, relative indices are kept chunk local and biased
+inline int64_t encodeIndex(int64_t raw, size_t localCount) {
+	if (raw > 0)
+		return raw - 1;
+	if (raw < 0)
+		return relativeBias + static_cast<int64_t>(localCount) + raw;
+	// 0 is not a valid OBJ index, treat it like a missing one
+	return -1;
+}
+
+inline int64_t decodeIndex(int64_t encoded, size_t base, size_t total) {
+	if (encoded >= relativeBias / 2)
+		encoded = encoded - relativeBias + static_cast<int64_t>(base);
+	if (encoded < 0 || encoded >= static_cast<int64_t>(total))
+		return -1;
+	return encoded;
+}
+
+void parseChunk(const char* p, const char* end, ChunkResult& out) {
+	// Rough guesses so the vectors do not regrow constantly, a vertex line is ~30 bytes
+	size_t guess = static_cast<size_t>(end - p) / 64;
+	out.positions.reserve(guess);
+	out.corners.reserve(guess * 6);
+
+	// Corners of the current polygon, kept outside the loop so it never reallocates after the first line
+	std::vector<int64_t> poly;
+
+	while (p < end) {
+		const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+		if (lineEnd == nullptr)
+			lineEnd = end;
+
+		const char* s = skipSpaces(p, lineEnd);
+		if (s + 1 < lineEnd && s[0] == 'v' && isSpace(s[1])) {
+			vec3 v;
+			s = parseFloat(s + 1, lineEnd, v.x);
+			s = parseFloat(s, lineEnd, v.y);
+			parseFloat(s, lineEnd, v.z);
+			out.positions.push_back(v);
+		}
+		else if (s + 2 < lineEnd && s[0] == 'v' && s[1] == 'n' && isSpace(s[2])) {
+			vec3 n;
+			s = parseFloat(s + 2, lineEnd, n.x);
+			s = parseFloat(s, lineEnd, n.y);
+			parseFloat(s, lineEnd, n.z);
+			out.normals.push_back(n);
+		}
+		else if (s + 2 < lineEnd && s[0] == 'v' && s[1] == 't' && isSpace(s[2])) {
+			vec2 t;
+			s = parseFloat(s + 2, lineEnd, t.x);
+			parseFloat(s, lineEnd, t.y);
+			out.texcoords.push_back(t);
+		}
+		else if (s + 1 < lineEnd && s[0] == 'f' && isSpace(s[1])) {
+			poly.clear();
+			s++;
+			while (true) {
+				s = skipSpaces(s, lineEnd);
+				if (s >= lineEnd || *s == '#')
+					break;
+				// A corner is v, v/vt, v//vn or v/vt/vn
+				int64_t v = 0, vt = 0, vn = 0;
+				const char* next = parseInt(s, lineEnd, v);
+				if (next == s)
+					break;
+				s = next;
+				if (s < lineEnd && *s == '/') {
+					s++;
+					if (s < lineEnd && *s != '/')
+						s = parseInt(s, lineEnd, vt);
+					if (s < lineEnd && *s == '/') {
+						s++;
+						s = parseInt(s, lineEnd, vn);
+					}
+				}
+				poly.push_back(encodeIndex(v, out.positions.size()));
+				poly.push_back(vt ? encodeIndex(vt, out.texcoords.size()) : -1);
+				poly.push_back(vn ? encodeIndex(vn, out.normals.size()) : -1);
+				// Skip anything malformed up to the next separator
+				while (s < lineEnd && !isSpace(*s))
+					s++;
+			}
+			// Fan triangulation, (0, i, i + 1) for every i, which is exact for the convex polygons OBJ exporters write
+			size_t cornerCount = poly.size() / 3;
+			for (size_t i = 1; i + 1 < cornerCount; i++) {
+				out.corners.insert(out.corners.end(), poly.begin(), poly.begin() + 3);
+				out.corners.insert(out.corners.end(), poly.begin() + i * 3, poly.begin() + i * 3 + 6);
+			}
+		}
+		p = lineEnd + 1;
+	}
+}
+
+// A chunk's triangles with every index made global, faces with a bad position index are dropped
+struct ResolvedChunk
+{
+	std::vector<uint32_t> positionIndices;
+	std::vector<uint32_t> texcoordIndices;
+	std::vector<uint32_t> normalIndices;
+};
+
+void resolveChunk(const ChunkResult& c, size_t positionBase, size_t positionCount, size_t texcoordBase, size_t texcoordCount,
+	size_t normalBase, size_t normalCount, ResolvedChunk& out) {
+	size_t cornerCount = c.corners.size() / 3;
+	out.positionIndices.reserve(cornerCount);
+	out.texcoordIndices.reserve(cornerCount);
+	out.normalIndices.reserve(cornerCount);
+
+	// A triangle at a time so a bad corner drops the whole face
+	for (size_t t = 0; t + 9 <= c.corners.size(); t += 9) {
+		uint32_t resolved[9];
+		bool valid = true;
+		for (int k = 0; k < 3; k++) {
+			int64_t v = decodeIndex(c.corners[t + k * 3], positionBase, positionCount);
+			if (v < 0) {
+				valid = false;
+				break;
+			}
+			int64_t vt = c.corners[t + k * 3 + 1];
+			int64_t vn = c.corners[t + k * 3 + 2];
+			vt = vt < 0 ? -1 : decodeIndex(vt, texcoordBase, texcoordCount);
+			vn = vn < 0 ? -1 : decodeIndex(vn, normalBase, normalCount);
+			resolved[k * 3] = static_cast<uint32_t>(v);
+			resolved[k * 3 + 1] = vt < 0 ? ObjData::none : static_cast<uint32_t>(vt);
+			resolved[k * 3 + 2] = vn < 0 ? ObjData::none : static_cast<uint32_t>(vn);
+		}
+		if (!valid)
+			continue;
+		for (int k = 0; k < 3; k++) {
+			out.positionIndices.push_back(resolved[k * 3]);
+			out.texcoordIndices.push_back(resolved[k * 3 + 1]);
+			out.normalIndices.push_back(resolved[k * 3 + 2]);
+		}
+	}
+}
+
+template <typename T>
+void appendVector(std::vector<T>& dst, const std::vector<T>& src) {
+	dst.insert(dst.end(), src.begin(), src.end());
+}
+
+void appendStream(VertexStream& dst, const VertexStream& src) {
+	appendVector(dst.x, src.x);
+	appendVector(dst.y, src.y);
+	appendVector(dst.z, src.z);
+}
+
+}
+
+void parseObjText(const char* text, size_t size, ObjData& data, unsigned int threads) {
+	data = ObjData();
+	if (size == 0)
+		return;
+
+	if (threads == 0)
+		threads = std::thread::hardware_concurrency();
+	size_t maxChunks = size / minChunkSize + 1;
+	size_t chunkCount = threads < maxChunks ? threads : maxChunks;
+	if (chunkCount == 0)
+		chunkCount = 1;
+
+	// Split at newlines so no line straddles two chunks
+	std::vector<const char*> bounds;
+	bounds.push_back(text);
+	const char* end = text + size;
+	for (size_t i = 1; i < chunkCount; i++) {
+		const char* p = text + size * i / chunkCount;
+		if (p < bounds.back())
+			p = bounds.back();
+		const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+		p = nl ? nl + 1 : end;
+		bounds.push_back(p);
+	}
+	bounds.push_back(end);
+
+	std::vector<ChunkResult> chunks(chunkCount);
+	if (chunkCount == 1) {
+		parseChunk(bounds[0], bounds[1], chunks[0]);
+	}
+	else {
+		std::vector<std::thread> workers;
+		for (size_t i = 0; i < chunkCount; i++) {
+			workers.emplace_back(parseChunk, bounds[i], bounds[i + 1], std::ref(chunks[i]));
+		}
+		for (auto& w : workers) {
+			w.join();
+		}
+	}
+
+	// Every chunk's elements start where the previous chunk's ended
+	size_t positionCount = 0, normalCount = 0, texcoordCount = 0, cornerCount = 0;
+	std::vector<size_t> positionBase(chunkCount), normalBase(chunkCount), texcoordBase(chunkCount);
+	for (size_t i = 0; i < chunkCount; i++) {
+		positionBase[i] = positionCount;
+		normalBase[i] = normalCount;
+		texcoordBase[i] = texcoordCount;
+		positionCount += chunks[i].positions.size();
+		normalCount += chunks[i].normals.size();
+		texcoordCount += chunks[i].texcoords.size();
+		cornerCount += chunks[i].corners.size() / 3;
+	}
+
+	// Resolve every chunk's indices against the bases, in parallel like the parse itself
+	std::vector<ResolvedChunk> resolved(chunkCount);
+	auto resolve = [&](size_t i) {
+		resolveChunk(chunks[i], positionBase[i], positionCount, texcoordBase[i], texcoordCount,
+			normalBase[i], normalCount, resolved[i]);
+	};
+	if (chunkCount == 1) {
+		resolve(0);
+	}
+	else {
+		std::vector<std::thread> workers;
+		for (size_t i = 0; i < chunkCount; i++) {
+			workers.emplace_back(resolve, i);
+		}
+		for (auto& w : workers) {
+			w.join();
+		}
+	}
+
+	if (chunkCount == 1) {
+		// Nothing to concatenate, hand the buffers over
+		data.positions = std::move(chunks[0].positions);
+		data.normals = std::move(chunks[0].normals);
+		data.texcoords = std::move(chunks[0].texcoords);
+		data.positionIndices = std::move(resolved[0].positionIndices);
+		data.texcoordIndices = std::move(resolved[0].texcoordIndices);
+		data.normalIndices = std::move(resolved[0].normalIndices);
+		return;
+	}
+
+	data.positions.reserve(positionCount);
+	data.normals.reserve(normalCount);
+	data.texcoords.reserve(texcoordCount);
+	data.positionIndices.reserve(cornerCount);
+	data.texcoordIndices.reserve(cornerCount);
+	data.normalIndices.reserve(cornerCount);
+
+	for (size_t i = 0; i < chunkCount; i++) {
+		appendStream(data.positions, chunks[i].positions);
+		appendStream(data.normals, chunks[i].normals);
+		appendVector(data.texcoords, chunks[i].texcoords);
+		appendVector(data.positionIndices, resolved[i].positionIndices);
+		appendVector(data.texcoordIndices, resolved[i].texcoordIndices);
+		appendVector(data.normalIndices, resolved[i].normalIndices);
+	}
+}
+
+bool parseObjFile(const std::string& filename, ObjData& data, unsigned int threads) {
+	MappedFile file;
+	if (!file.open(filename))
+		return false;
+	parseObjText(file.data(), file.size(), data, threads);
+	return true;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "geometry.h"
+
+/*
+* Everything read from a Wavefront OBJ file.
+* Positions, normals and texture coordinates each have their own index space in OBJ, so every
+* triangle corner carries three indices. Corners without a texture coordinate or normal use ObjData::none.
+*/
+struct ObjData
+{
+	static const uint32_t none = 0xFFFFFFFFu;
+
+	VertexStream positions;
+	VertexStream normals;
+	// Texture coordinates, u in x and v in y
+	std::vector<vec2> texcoords;
+
+	// Three entries per triangle, polygons are already fan triangulated
+	std::vector<uint32_t> positionIndices;
+	std::vector<uint32_t> texcoordIndices;
+	std::vector<uint32_t> normalIndices;
+};
+
+/*
+* Parse an OBJ file into data.
+*
+* The file is memory mapped and split into newline aligned chunks which are parsed on separate threads,
+* numbers are read with std::from_chars straight out of the mapping so no line is ever copied.
+*
+* Understands v, vn, vt and f lines with v, v/vt, v//vn and v/vt/vn corners, negative (relative)
+* indices, and polygons with any number of corners. Faces that reference a missing vertex are dropped,
+* every other line is ignored.
+*
+* @param threads: How many threads to parse with, 0 picks one per hardware thread.
+*
+* @return false if the file could not be opened.
+*/
+bool parseObjFile(const std::string& filename, ObjData& data, unsigned int threads = 0);
+
+/*
+* Same as parseObjFile but over text already in memory.
+*/
+void parseObjText(const char* text, size_t size, ObjData& data, unsigned int threads = 0);
@@ -0,0 +1,38 @@
+#pragma once
+
+/*
+* The few operating system types the engine's drawing code is written against.
+*
+* On Windows these come from <Windows.h> and the console is presented with WriteConsoleOutput. Everywhere
+* else CHAR_INFO is defined here with the same layout, a 16 bit character and a 16 bit attribute, and the
+* console is presented to the terminal with ANSI escape sequences instead (see ansiterminal.h).
+* Define GAMEENGINE_ANSI_TERMINAL on Windows to use the ANSI backend there as well.
+*/
+
+#ifdef _WIN32
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+
+#ifndef GAMEENGINE_ANSI_TERMINAL
+#define GAMEENGINE_WIN32_CONSOLE 1
+#endif
+
+#else
+
+typedef char16_t WCHAR;
+typedef unsigned short WORD;
+
+struct CHAR_INFO
+{
+	union
+	{
+		WCHAR UnicodeChar;
+		char AsciiChar;
+	} Char;
+	WORD Attributes;
+};
+
+#endif
@@ -0,0 +1,216 @@
+#include "profiler.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+Profiler& Profiler::instance() {
+	static Profiler profiler;
+	return profiler;
+}
+
+namespace {
+
+// Gives the calling thread's ring back when the thread exits
+struct RingOwner
+{
+	std::atomic<bool>* used = nullptr;
+	~RingOwner() {
+		if (used)
+			used->store(false, std::memory_order_release);
+	}
+};
+
+}
+
+Profiler::Ring& Profiler::threadRing() {
+	// Found once per thread, after that recording a zone never takes the lock
+	thread_local Ring* ring = nullptr;
+	thread_local RingOwner owner;
+	if (!ring) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (auto& r : m_rings) {
+			bool expected = false;
+			if (r->used.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+				ring = r.get();
+				break;
+			}
+		}
+		if (!ring) {
+			m_rings.push_back(std::make_unique<Ring>());
+			ring = m_rings.back().get();
+			ring->thread = static_cast<uint32_t>(m_rings.size() - 1);
+			ring->used.store(true, std::memory_order_relaxed);
+		}
+		owner.used = &ring->used;
+	}
+	return *ring;
+}
+
+void Profiler::record(const char* name, uint64_t start, uint64_t end) {
+	Ring& ring = threadRing();
+	uint64_t head = ring.head.load(std::memory_order_relaxed);
+	Slot& slot = ring.slots[head & (ringCapacity - 1)];
+	// Mark the slot as being written before any field changes, see read
+	slot.sequence.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.name.store(name, std::memory_order_relaxed);
+	slot.start.store(start, std::memory_order_relaxed);
+	slot.end.store(end, std::memory_order_relaxed);
+	slot.frame.store(m_frame.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	slot.sequence.store(head + 1, std::memory_order_release);
+	ring.head.store(head + 1, std::memory_order_release);
+}
+
+bool Profiler::read(const Ring& ring, uint64_t index, ProfileEvent& event) {
+	const Slot& slot = ring.slots[index & (ringCapacity - 1)];
+	if (slot.sequence.load(std::memory_order_acquire) != index + 1)
+		return false;
+	event.name = slot.name.load(std::memory_order_relaxed);
+	event.start = slot.start.load(std::memory_order_relaxed);
+	event.end = slot.end.load(std::memory_order_relaxed);
+	event.frame = slot.frame.load(std::memory_order_relaxed);
+	// The fields are only the zone's if nothing started writing the slot meanwhile
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return slot.sequence.load(std::memory_order_relaxed) == index + 1;
+}
+
+void Profiler::beginFrame() {
+	m_frameStart = now();
+}
+
+void Profiler::endFrame() {
+	uint64_t end = now();
+	uint32_t frame = m_frame.load(std::memory_order_relaxed);
+	m_frameTimes.add(end - m_frameStart);
+
+	// Add up this frame's zones by name, a name used several times in a frame counts once with its total
+	std::map<std::string, uint64_t> totals;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (auto& ring : m_rings) {
+			uint64_t head = ring->head.load(std::memory_order_acquire);
+			uint64_t first = std::max(ring->scanned, head > ringCapacity ? head - ringCapacity : 0);
+			ProfileEvent e;
+			for (uint64_t i = first; i < head; i++) {
+				if (read(*ring, i, e) && e.frame == frame)
+					totals[e.name] += e.end - e.start;
+			}
+			ring->scanned = head;
+		}
+	}
+	for (const auto& total : totals)
+		m_zoneTimes[total.first].add(total.second);
+	m_frame.store(frame + 1, std::memory_order_relaxed);
+}
+
+void Profiler::Window::add(uint64_t value) {
+	if (samples.size() < windowSize) {
+		samples.push_back(value);
+	}
+	else {
+		samples[next] = value;
+		next = (next + 1) % windowSize;
+	}
+}
+
+ProfileStats Profiler::Window::stats() const {
+	ProfileStats s;
+	s.samples = samples.size();
+	if (samples.empty())
+		return s;
+	std::vector<uint64_t> sorted = samples;
+	std::sort(sorted.begin(), sorted.end());
+	double sum = 0.0;
+	for (uint64_t v : sorted)
+		sum += static_cast<double>(v);
+	s.mean = sum / sorted.size();
+	// Nearest rank
+	auto percentile = [&sorted](double p) {
+		size_t rank = static_cast<size_t>(p * sorted.size() + 0.999999);
+		return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+	};
+	s.p50 = percentile(0.50);
+	s.p95 = percentile(0.95);
+	s.p99 = percentile(0.99);
+	s.max = sorted.back();
+	return s;
+}
+
+ProfileStats Profiler::frameStats() const {
+	return m_frameTimes.stats();
+}
+
+ProfileStats Profiler::zoneStats(const std::string& name) const {
+	auto it = m_zoneTimes.find(name);
+	return it == m_zoneTimes.end() ? ProfileStats() : it->second.stats();
+}
+
+std::vector<std::string> Profiler::zoneNames() const {
+	std::vector<std::string> names;
+	for (const auto& zone : m_zoneTimes)
+		names.push_back(zone.first);
+	return names;
+}
+
+std::vector<ProfileEvent> Profiler::collect(std::vector<uint32_t>& threads) const {
+	std::vector<ProfileEvent> events;
+	threads.clear();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (const auto& ring : m_rings) {
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		uint64_t first = head > ringCapacity ? head - ringCapacity : 0;
+		ProfileEvent e;
+		for (uint64_t i = first; i < head; i++) {
+			if (!read(*ring, i, e))
+				continue;
+			events.push_back(e);
+			threads.push_back(ring->thread);
+		}
+	}
+	return events;
+}
+
+bool Profiler::writeCSV(const std::string& filename) const {
+	std::vector<uint32_t> threads;
+	std::vector<ProfileEvent> events = collect(threads);
+	std::ofstream file(filename, std::ios::trunc);
+	if (!file)
+		return false;
+	file << "thread,frame,zone,start_ns,duration_ns\n";
+	for (size_t i = 0; i < events.size(); i++) {
+		const ProfileEvent& e = events[i];
+		file << threads[i] << ',' << e.frame << ',' << e.name << ',' << static_cast<int64_t>(e.start - m_epoch) << ',' << (e.end - e.start) << '\n';
+	}
+	return !file.fail();
+}
+
+bool Profiler::writeChromeTrace(const std::string& filename) const {
+	std::vector<uint32_t> threads;
+	std::vector<ProfileEvent> events = collect(threads);
+	std::ofstream file(filename, std::ios::trunc);
+	if (!file)
+		return false;
+	// Trace timestamps are in microseconds, keep the nanoseconds as fractions
+	file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	char line[256];
+	for (size_t i = 0; i < events.size(); i++) {
+		const ProfileEvent& e = events[i];
+		snprintf(line, sizeof(line), "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%u}}",
+			i ? "," : "", e.name, threads[i], static_cast<int64_t>(e.start - m_epoch) * 1e-3, (e.end - e.start) * 1e-3, e.frame);
+		file << line;
+	}
+	file << "\n]}\n";
+	return !file.fail();
+}
+
+void Profiler::reset() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (auto& ring : m_rings) {
+		ring->head.store(0, std::memory_order_relaxed);
+		ring->scanned = 0;
+	}
+	m_frameTimes = Window();
+	m_zoneTimes.clear();
+	m_frame.store(0, std::memory_order_relaxed);
+	m_epoch = now();
+}
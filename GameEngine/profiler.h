@@ -0,0 +1,162 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+* Scoped-zone frame profiler.
+*
+* PROFILE_ZONE("name") times the rest of the enclosing scope. The start and end timestamps (nanoseconds) go into
+* a ring buffer owned by the calling thread, so recording a zone takes no lock and never allocates; when the ring
+* is full the oldest zones are overwritten. The name must be a string literal, only the pointer is stored.
+*
+* PROFILE_BEGIN_FRAME() and PROFILE_END_FRAME() bracket a frame. At the end of every frame the frame time and the
+* total time of every zone name in that frame go into rolling windows of the last few hundred frames, which give
+* the p50/p95/p99 for the frame and for each stage. The zones still in the rings can be exported as CSV or as
+* Chrome trace-event JSON (load it in chrome://tracing or ui.perfetto.dev) to look at a frame in detail.
+*
+* PROFILE_END_FRAME and the exports may read the rings while other threads record. Every slot carries the index of
+* the zone written to it, a zone whose slot is being overwritten while it is read is skipped. A thread's ring is
+* freed for reuse when the thread exits, so there are never more rings than threads alive at once. The stats and
+* reset are for the main thread between frames.
+*
+* Define GAMEENGINE_NO_PROFILE to compile every PROFILE_ macro out.
+*/
+
+// One timed zone
+struct ProfileEvent
+{
+	const char* name;
+	uint64_t start;
+	uint64_t end;
+	// The frame the zone was recorded in
+	uint32_t frame;
+};
+
+// Summary of a rolling window of samples, in nanoseconds
+struct ProfileStats
+{
+	size_t samples = 0;
+	double mean = 0.0;
+	uint64_t p50 = 0;
+	uint64_t p95 = 0;
+	uint64_t p99 = 0;
+	uint64_t max = 0;
+};
+
+class Profiler
+{
+public:
+	// Zones each thread keeps before overwriting the oldest, a power of two
+	static const size_t ringCapacity = 1 << 14;
+	// Frames the rolling statistics cover
+	static const size_t windowSize = 512;
+
+	static Profiler& instance();
+
+	static uint64_t now() {
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+	// Record one zone on the calling thread
+	void record(const char* name, uint64_t start, uint64_t end);
+
+	void beginFrame();
+	// Close the frame and add its frame time and per-zone totals to the rolling windows
+	void endFrame();
+
+	ProfileStats frameStats() const;
+	// Stats of the per-frame total of the zones called name, empty if there were none
+	ProfileStats zoneStats(const std::string& name) const;
+	// Every zone name seen so far, sorted
+	std::vector<std::string> zoneNames() const;
+
+	// One line per zone still in the rings: thread, frame, name, start and duration in nanoseconds
+	bool writeCSV(const std::string& filename) const;
+	// The zones still in the rings as complete ("X") trace events, one track per thread
+	bool writeChromeTrace(const std::string& filename) const;
+
+	// Forget every zone and sample
+	void reset();
+
+private:
+	// A ProfileEvent a reader can copy while its thread overwrites it
+	struct Slot
+	{
+		// Index + 1 of the zone in the slot, 0 while it is being written
+		std::atomic<uint64_t> sequence{ 0 };
+		std::atomic<const char*> name{ nullptr };
+		std::atomic<uint64_t> start{ 0 };
+		std::atomic<uint64_t> end{ 0 };
+		std::atomic<uint32_t> frame{ 0 };
+	};
+
+	struct Ring
+	{
+		Ring() : slots(ringCapacity) {}
+		std::vector<Slot> slots;
+		// Total zones ever written, the next one goes to head % ringCapacity
+		std::atomic<uint64_t> head{ 0 };
+		// How far endFrame has read
+		uint64_t scanned = 0;
+		uint32_t thread = 0;
+		// Owned by a live thread, cleared when it exits so the ring can be reused
+		std::atomic<bool> used{ false };
+	};
+
+	// The last windowSize values, oldest overwritten first
+	struct Window
+	{
+		std::vector<uint64_t> samples;
+		size_t next = 0;
+		void add(uint64_t value);
+		ProfileStats stats() const;
+	};
+
+	Profiler() = default;
+	Ring& threadRing();
+	// Copy zone index out of ring, false if it has been overwritten or is being written
+	static bool read(const Ring& ring, uint64_t index, ProfileEvent& event);
+	// Copy the zones still in every ring, oldest first per thread
+	std::vector<ProfileEvent> collect(std::vector<uint32_t>& threads) const;
+
+	mutable std::mutex m_mutex;
+	std::vector<std::unique_ptr<Ring>> m_rings;
+	std::atomic<uint32_t> m_frame{ 0 };
+	uint64_t m_frameStart = 0;
+	Window m_frameTimes;
+	std::map<std::string, Window> m_zoneTimes;
+	uint64_t m_epoch = now();
+};
+
+// Times the scope it is declared in, see PROFILE_ZONE
+class ProfileZone
+{
+public:
+	explicit ProfileZone(const char* name) : m_name(name), m_start(Profiler::now()) {}
+	~ProfileZone() { Profiler::instance().record(m_name, m_start, Profiler::now()); }
+	ProfileZone(const ProfileZone&) = delete;
+	ProfileZone& operator=(const ProfileZone&) = delete;
+private:
+	const char* m_name;
+	uint64_t m_start;
+};
+
+#ifndef GAMEENGINE_NO_PROFILE
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_BEGIN_FRAME() Profiler::instance().beginFrame()
+#define PROFILE_END_FRAME() Profiler::instance().endFrame()
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_BEGIN_FRAME() ((void)0)
+#define PROFILE_END_FRAME() ((void)0)
+#endif
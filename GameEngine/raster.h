@@ -0,0 +1,293 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+/*
+* Half-space (edge function) triangle rasterization with a depth test.
+*
+* The three vertices are snapped to a fixed point grid with 4 bits of sub-pixel precision and every
+* pixel center in the triangle's bounding box is tested against the three edge functions. The edge
+* functions are linear in x and y, so after the setup they are stepped with integer additions only.
+*
+* Pixels exactly on an edge follow the top-left fill rule: they belong to the triangle only if the edge
+* is a top or a left edge, so two triangles sharing an edge never both draw (or both skip) the same pixel.
+*
+* Depth is interpolated across the triangle as a plane and compared with the depth buffer before
+* the pixel is handed to plot, a pixel that fails the depth test costs nothing more than the compare.
+*
+* Lines are drawn Bresenham style with integer steps only. The segment is clipped to the clip rectangle
+* before the first pixel, so the inner loop never has to check whether a pixel is on screen.
+*/
+
+namespace raster {
+
+const int subPixelBits = 4;
+const int subPixelScale = 1 << subPixelBits;
+// Vertices further than this from the origin (in pixels) are outside the guard band, triangles
+// reaching that far must be clipped before rasterization or the fixed point maths would overflow
+const float guardBand = float(1 << 20);
+
+/*
+* Rasterize one triangle into the clip rectangle [minX, maxX) x [minY, maxY).
+*
+* @param x, y, z: The three screen space vertices, z is the depth, smaller is closer.
+*
+* @param depth: The depth buffer, indexed by y * stride + x.
+*
+* @param plot: Called as plot(x, y) for every pixel that passes the depth test, after the depth was written.
+*
+* @return The number of pixels that were plotted.
+*/
+template <typename Plot>
+int fillTriangle(const float x[3], const float y[3], const float z[3], int minX, int minY, int maxX, int maxY,
+	float* depth, int stride, Plot&& plot) {
+	for (int i = 0; i < 3; i++) {
+		// Also rejects NaN, which every comparison fails
+		if (!(fabsf(x[i]) < guardBand && fabsf(y[i]) < guardBand))
+			return 0;
+	}
+
+	// Snap to the sub-pixel grid
+	int64_t X[3], Y[3];
+	for (int i = 0; i < 3; i++) {
+		X[i] = static_cast<int64_t>(lrintf(x[i] * subPixelScale));
+		Y[i] = static_cast<int64_t>(lrintf(y[i] * subPixelScale));
+	}
+	float Z[3] = { z[0], z[1], z[2] };
+
+	int64_t area = (X[1] - X[0]) * (Y[2] - Y[0]) - (Y[1] - Y[0]) * (X[2] - X[0]);
+	if (area == 0)
+		return 0;
+	// Work with one winding only, swapping two vertices flips the sign of the area
+	if (area < 0) {
+		int64_t t;
+		t = X[1]; X[1] = X[2]; X[2] = t;
+		t = Y[1]; Y[1] = Y[2]; Y[2] = t;
+		float tz = Z[1]; Z[1] = Z[2]; Z[2] = tz;
+		area = -area;
+	}
+
+	// Bounding box in whole pixels, clipped to the target rectangle
+	int64_t bx0 = X[0] < X[1] ? (X[0] < X[2] ? X[0] : X[2]) : (X[1] < X[2] ? X[1] : X[2]);
+	int64_t bx1 = X[0] > X[1] ? (X[0] > X[2] ? X[0] : X[2]) : (X[1] > X[2] ? X[1] : X[2]);
+	int64_t by0 = Y[0] < Y[1] ? (Y[0] < Y[2] ? Y[0] : Y[2]) : (Y[1] < Y[2] ? Y[1] : Y[2]);
+	int64_t by1 = Y[0] > Y[1] ? (Y[0] > Y[2] ? Y[0] : Y[2]) : (Y[1] > Y[2] ? Y[1] : Y[2]);
+	int64_t px0 = bx0 >> subPixelBits, px1 = bx1 >> subPixelBits;
+	int64_t py0 = by0 >> subPixelBits, py1 = by1 >> subPixelBits;
+	if (px0 < minX) px0 = minX;
+	if (py0 < minY) py0 = minY;
+	if (px1 > maxX - 1) px1 = maxX - 1;
+	if (py1 > maxY - 1) py1 = maxY - 1;
+	if (px0 > px1 || py0 > py1)
+		return 0;
+
+	// Edge i runs from vertex (i + 1) to vertex (i + 2), so its function is zero there and equals
+	// the area at vertex i, which makes it the (unnormalized) barycentric weight of vertex i
+	int64_t stepX[3], stepY[3], row[3];
+	const int64_t half = subPixelScale / 2;
+	int64_t startX = (px0 << subPixelBits) + half;
+	int64_t startY = (py0 << subPixelBits) + half;
+	for (int i = 0; i < 3; i++) {
+		int a = (i + 1) % 3, b = (i + 2) % 3;
+		int64_t dx = X[b] - X[a];
+		int64_t dy = Y[b] - Y[a];
+		stepX[i] = -dy * subPixelScale;
+		stepY[i] = dx * subPixelScale;
+		row[i] = dx * (startY - Y[a]) - dy * (startX - X[a]);
+		// Top-left rule, a left edge goes up the screen and a top edge is flat with the inside below it
+		// Pixels exactly on any other edge are pushed out by one
+		bool topLeft = dy < 0 || (dy == 0 && dx > 0);
+		if (!topLeft)
+			row[i] -= 1;
+	}
+
+	// Depth as a plane z = zRow + dzdx * (x - px0), from the barycentric weights
+	float invArea = 1.0f / static_cast<float>(area);
+	float dzdx = (Z[0] * stepX[0] + Z[1] * stepX[1] + Z[2] * stepX[2]) * invArea;
+	float dzdy = (Z[0] * stepY[0] + Z[1] * stepY[1] + Z[2] * stepY[2]) * invArea;
+	float zRow = (Z[0] * row[0] + Z[1] * row[1] + Z[2] * row[2]) * invArea;
+
+	int plotted = 0;
+	for (int64_t py = py0; py <= py1; py++) {
+		int64_t e0 = row[0], e1 = row[1], e2 = row[2];
+		float zp = zRow;
+		float* depthRow = depth + py * stride;
+		for (int64_t px = px0; px <= px1; px++) {
+			// Inside when all three are non-negative, i.e. none has its sign bit set
+			if ((e0 | e1 | e2) >= 0) {
+				if (zp < depthRow[px]) {
+					depthRow[px] = zp;
+					plot(static_cast<int>(px), static_cast<int>(py));
+					plotted++;
+				}
+			}
+			e0 += stepX[0];
+			e1 += stepX[1];
+			e2 += stepX[2];
+			zp += dzdx;
+		}
+		row[0] += stepY[0];
+		row[1] += stepY[1];
+		row[2] += stepY[2];
+		zRow += dzdy;
+	}
+	return plotted;
+}
+
+/*
+* Liang-Barsky, cut the segment down to the part inside [minX, maxX] x [minY, maxY].
+* Returns false if no part of it is inside, the endpoints are left untouched in that case.
+*/
+inline bool clipSegment(float& x1, float& y1, float& x2, float& y2, float minX, float minY, float maxX, float maxY) {
+	const float dx = x2 - x1;
+	const float dy = y2 - y1;
+	// Distance to each side along the segment, p < 0 means the segment is entering through that side
+	const float p[4] = { -dx, dx, -dy, dy };
+	const float q[4] = { x1 - minX, maxX - x1, y1 - minY, maxY - y1 };
+	float t0 = 0.0f, t1 = 1.0f;
+	for (int i = 0; i < 4; i++) {
+		if (p[i] == 0.0f) {
+			// Parallel to this side, either fully inside or fully outside of it
+			if (q[i] < 0.0f)
+				return false;
+			continue;
+		}
+		float t = q[i] / p[i];
+		if (p[i] < 0.0f) {
+			if (t > t1)
+				return false;
+			if (t > t0)
+				t0 = t;
+		}
+		else {
+			if (t < t0)
+				return false;
+			if (t < t1)
+				t1 = t;
+		}
+	}
+	const float ox = x1, oy = y1;
+	x1 = ox + dx * t0;
+	y1 = oy + dy * t0;
+	x2 = ox + dx * t1;
+	y2 = oy + dy * t1;
+	return true;
+}
+
+/*
+* Draw the line between the pixels containing (x1, y1) and (x2, y2), both endpoints included,
+* clipped to [minX, maxX) x [minY, maxY).
+*
+* The line steps one pixel at a time along its major axis and the minor axis follows
+* floor((2 * i * dMinor + dMajor) / (2 * dMajor)), the closest pixel to the true line. Because that is
+* monotonic in i, the first and last step that land inside the clip rectangle are solved for directly
+* and only those steps are walked, so a clipped line draws exactly the pixels the unclipped line
+* would have drawn on screen.
+*
+* @param plot: Called as plot(x, y) for every pixel, always inside the clip rectangle.
+*
+* @return The number of pixels that were plotted.
+*/
+template <typename Plot>
+int drawLine(float x1, float y1, float x2, float y2, int minX, int minY, int maxX, int maxY, Plot&& plot) {
+	if (minX >= maxX || minY >= maxY)
+		return 0;
+	if (!(fabsf(x1) < guardBand && fabsf(y1) < guardBand && fabsf(x2) < guardBand && fabsf(y2) < guardBand)) {
+		// Too far out for the integer maths, cut it down to just past the clip rectangle first
+		if (std::isnan(x1) || std::isnan(y1) || std::isnan(x2) || std::isnan(y2))
+			return 0;
+		if (!clipSegment(x1, y1, x2, y2, float(minX - 1), float(minY - 1), float(maxX + 1), float(maxY + 1)))
+			return 0;
+		if (!(fabsf(x1) < guardBand && fabsf(y1) < guardBand && fabsf(x2) < guardBand && fabsf(y2) < guardBand))
+			return 0;
+	}
+
+	const int64_t ix1 = static_cast<int64_t>(floorf(x1));
+	const int64_t iy1 = static_cast<int64_t>(floorf(y1));
+	const int64_t dx = static_cast<int64_t>(floorf(x2)) - ix1;
+	const int64_t dy = static_cast<int64_t>(floorf(y2)) - iy1;
+
+	// Work along the major (a) and minor (b) axis so both octant families share one loop
+	const bool xMajor = (dx < 0 ? -dx : dx) >= (dy < 0 ? -dy : dy);
+	const int64_t a1 = xMajor ? ix1 : iy1;
+	const int64_t b1 = xMajor ? iy1 : ix1;
+	const int64_t da = xMajor ? dx : dy;
+	const int64_t db = xMajor ? dy : dx;
+	const int64_t sa = da < 0 ? -1 : 1;
+	const int64_t sb = db < 0 ? -1 : 1;
+	const int64_t dMajor = da * sa;
+	const int64_t dMinor = db * sb;
+	const int64_t aMin = xMajor ? minX : minY;
+	const int64_t aMax = (xMajor ? maxX : maxY) - 1;
+	const int64_t bMin = xMajor ? minY : minX;
+	const int64_t bMax = (xMajor ? maxY : maxX) - 1;
+
+	// Step i is at a = a1 + sa * i, b = b1 + sb * q(i), the steps inside the major axis bounds first
+	int64_t i0 = 0, i1 = dMajor;
+	if (sa > 0) {
+		i0 = std::max(i0, aMin - a1);
+		i1 = std::min(i1, aMax - a1);
+	}
+	else {
+		i0 = std::max(i0, a1 - aMax);
+		i1 = std::min(i1, a1 - aMin);
+	}
+	// Then the range of q(i) that is inside the minor axis bounds
+	const int64_t qMin = sb > 0 ? bMin - b1 : b1 - bMax;
+	const int64_t qMax = sb > 0 ? bMax - b1 : b1 - bMin;
+	if (qMax < 0)
+		return 0;
+	if (dMinor == 0) {
+		if (qMin > 0)
+			return 0;
+	}
+	else {
+		// First i with q(i) >= qMin and last i with q(i) <= qMax
+		if (qMin > 0)
+			i0 = std::max(i0, (2 * dMajor * qMin - dMajor + 2 * dMinor - 1) / (2 * dMinor));
+		i1 = std::min(i1, (2 * dMajor * (qMax + 1) - dMajor - 1) / (2 * dMinor));
+	}
+	if (i0 > i1)
+		return 0;
+
+	// A single pixel, dMajor is 0 so the error term below would divide by it
+	if (dMajor == 0) {
+		plot(static_cast<int>(ix1), static_cast<int>(iy1));
+		return 1;
+	}
+
+	const int64_t twoMajor = 2 * dMajor;
+	const int64_t twoMinor = 2 * dMinor;
+	int64_t numerator = 2 * i0 * dMinor + dMajor;
+	int64_t q = numerator / twoMajor;
+	int64_t error = numerator - q * twoMajor;
+
+	const int64_t a = a1 + sa * i0;
+	const int64_t b = b1 + sb * q;
+	int x = static_cast<int>(xMajor ? a : b);
+	int y = static_cast<int>(xMajor ? b : a);
+	const int majorX = xMajor ? static_cast<int>(sa) : 0;
+	const int majorY = xMajor ? 0 : static_cast<int>(sa);
+	const int minorX = xMajor ? 0 : static_cast<int>(sb);
+	const int minorY = xMajor ? static_cast<int>(sb) : 0;
+
+	int plotted = 0;
+	for (int64_t i = i0; i <= i1; i++) {
+		plot(x, y);
+		plotted++;
+		x += majorX;
+		y += majorY;
+		// dMinor <= dMajor, so the minor axis moves at most once per step
+		error += twoMinor;
+		if (error >= twoMajor) {
+			error -= twoMajor;
+			x += minorX;
+			y += minorY;
+		}
+	}
+	return plotted;
+}
+
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+/*
+* Thin wrapper over the widest SIMD instruction set enabled at compile time.
+* Kernels are written once against simd_float and run 8 lanes wide with AVX, 4 lanes wide with SSE,
+* and fall back to plain floats (1 lane) everywhere else. Define GAMEENGINE_NO_SIMD to force the scalar path.
+*
+* All loads and stores are unaligned, so callers can pass pointers straight out of std::vector.
+*/
+
+#if !defined(GAMEENGINE_NO_SIMD) && defined(__AVX__)
+
+#include <immintrin.h>
+#define SIMD_AVX 1
+#define SIMD_WIDTH 8
+
+typedef __m256 simd_float;
+typedef __m256 simd_mask;
+
+inline simd_float simd_load(const float* p) { return _mm256_loadu_ps(p); }
+inline void simd_store(float* p, simd_float v) { _mm256_storeu_ps(p, v); }
+inline simd_float simd_set1(float k) { return _mm256_set1_ps(k); }
+inline simd_float simd_add(simd_float a, simd_float b) { return _mm256_add_ps(a, b); }
+inline simd_float simd_sub(simd_float a, simd_float b) { return _mm256_sub_ps(a, b); }
+inline simd_float simd_mul(simd_float a, simd_float b) { return _mm256_mul_ps(a, b); }
+inline simd_float simd_div(simd_float a, simd_float b) { return _mm256_div_ps(a, b); }
+inline simd_float simd_min(simd_float a, simd_float b) { return _mm256_min_ps(a, b); }
+inline simd_float simd_max(simd_float a, simd_float b) { return _mm256_max_ps(a, b); }
+inline simd_float simd_sqrt(simd_float a) { return _mm256_sqrt_ps(a); }
+// About 12 bits, see simd_rsqrt_refined
+inline simd_float simd_rsqrt(simd_float a) { return _mm256_rsqrt_ps(a); }
+inline simd_mask simd_cmpeq(simd_float a, simd_float b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+inline simd_mask simd_cmplt(simd_float a, simd_float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline simd_mask simd_cmpgt(simd_float a, simd_float b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+inline simd_mask simd_cmple(simd_float a, simd_float b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline simd_mask simd_cmpge(simd_float a, simd_float b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+// One bit per lane, lane 0 in bit 0
+inline int simd_movemask(simd_mask m) { return _mm256_movemask_ps(m); }
+// Picks a where the mask is set and b elsewhere
+inline simd_float simd_select(simd_mask m, simd_float a, simd_float b) { return _mm256_blendv_ps(b, a, m); }
+
+#elif !defined(GAMEENGINE_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+
+#include <emmintrin.h>
+#define SIMD_SSE 1
+#define SIMD_WIDTH 4
+
+typedef __m128 simd_float;
+typedef __m128 simd_mask;
+
+inline simd_float simd_load(const float* p) { return _mm_loadu_ps(p); }
+inline void simd_store(float* p, simd_float v) { _mm_storeu_ps(p, v); }
+inline simd_float simd_set1(float k) { return _mm_set1_ps(k); }
+inline simd_float simd_add(simd_float a, simd_float b) { return _mm_add_ps(a, b); }
+inline simd_float simd_sub(simd_float a, simd_float b) { return _mm_sub_ps(a, b); }
+inline simd_float simd_mul(simd_float a, simd_float b) { return _mm_mul_ps(a, b); }
+inline simd_float simd_div(simd_float a, simd_float b) { return _mm_div_ps(a, b); }
+inline simd_float simd_min(simd_float a, simd_float b) { return _mm_min_ps(a, b); }
+inline simd_float simd_max(simd_float a, simd_float b) { return _mm_max_ps(a, b); }
+inline simd_float simd_sqrt(simd_float a) { return _mm_sqrt_ps(a); }
+inline simd_float simd_rsqrt(simd_float a) { return _mm_rsqrt_ps(a); }
+inline simd_mask simd_cmpeq(simd_float a, simd_float b) { return _mm_cmpeq_ps(a, b); }
+inline simd_mask simd_cmplt(simd_float a, simd_float b) { return _mm_cmplt_ps(a, b); }
+inline simd_mask simd_cmpgt(simd_float a, simd_float b) { return _mm_cmpgt_ps(a, b); }
+inline simd_mask simd_cmple(simd_float a, simd_float b) { return _mm_cmple_ps(a, b); }
+inline simd_mask simd_cmpge(simd_float a, simd_float b) { return _mm_cmpge_ps(a, b); }
+inline int simd_movemask(simd_mask m) { return _mm_movemask_ps(m); }
+// SSE2 has no blend instruction, so build it from and/andnot/or
+inline simd_float simd_select(simd_mask m, simd_float a, simd_float b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+
+#else
+
+#include <cmath>
+#define SIMD_SCALAR 1
+#define SIMD_WIDTH 1
+
+typedef float simd_float;
+typedef bool simd_mask;
+
+inline simd_float simd_load(const float* p) { return *p; }
+inline void simd_store(float* p, simd_float v) { *p = v; }
+inline simd_float simd_set1(float k) { return k; }
+inline simd_float simd_add(simd_float a, simd_float b) { return a + b; }
+inline simd_float simd_sub(simd_float a, simd_float b) { return a - b; }
+inline simd_float simd_mul(simd_float a, simd_float b) { return a * b; }
+inline simd_float simd_div(simd_float a, simd_float b) { return a / b; }
+inline simd_float simd_min(simd_float a, simd_float b) { return a < b ? a : b; }
+inline simd_float simd_max(simd_float a, simd_float b) { return a > b ? a : b; }
+inline simd_float simd_sqrt(simd_float a) { return sqrtf(a); }
+inline simd_float simd_rsqrt(simd_float a) { return 1.0f / sqrtf(a); }
+inline simd_mask simd_cmpeq(simd_float a, simd_float b) { return a == b; }
+inline simd_mask simd_cmplt(simd_float a, simd_float b) { return a < b; }
+inline simd_mask simd_cmpgt(simd_float a, simd_float b) { return a > b; }
+inline simd_mask simd_cmple(simd_float a, simd_float b) { return a <= b; }
+inline simd_mask simd_cmpge(simd_float a, simd_float b) { return a >= b; }
+inline int simd_movemask(simd_mask m) { return m ? 1 : 0; }
+inline simd_float simd_select(simd_mask m, simd_float a, simd_float b) { return m ? a : b; }
+
+#endif
+
+// a * b + c, kept as a separate multiply and add so every path rounds the same way
+inline simd_float simd_madd(simd_float a, simd_float b, simd_float c) { return simd_add(simd_mul(a, b), c); }
+
+// 1 / sqrt(a) to about 22 bits, the estimate refined by one Newton-Raphson step, much cheaper than a sqrt and a divide
+// A zero a gives NaN, callers mask those lanes out
+inline simd_float simd_rsqrt_refined(simd_float a) {
+	simd_float r = simd_rsqrt(a);
+	return simd_mul(simd_mul(simd_set1(0.5f), r), simd_sub(simd_set1(3.0f), simd_mul(simd_mul(a, r), r)));
+}
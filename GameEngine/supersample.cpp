@@ -0,0 +1,179 @@
+#include "supersample.h"
+#include "simd.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#if defined(SIMD_AVX) || defined(SIMD_SSE)
+#include <emmintrin.h>
+#define SUPERSAMPLE_SSE 1
+#endif
+
+namespace {
+
+/*
+* The darker colour drawn next to c and how bright it is next to c, in the palette framecapture uses.
+* The bright colours 9 to 14 pair with their dark versions at half, white with grey and grey with dark grey.
+* The dark colours have nothing darker but black and get -1.
+*/
+short darker(short c, float& brightness) {
+	if (c >= 9 && c <= 14) {
+		brightness = 0.5f;
+		return static_cast<short>(c - 8);
+	}
+	if (c == 15) {
+		brightness = 0.75f;
+		return 7;
+	}
+	if (c == 7) {
+		brightness = 2.0f / 3.0f;
+		return 8;
+	}
+	brightness = 0.0f;
+	return -1;
+}
+
+const short blocks[4] = { 0x2591, 0x2592, 0x2593, 0x2588 };
+
+}
+
+Shade shadeFor(uint8_t coverage, short colour) {
+	colour &= 0x0F;
+	float target = coverage / 255.0f;
+	// Leaving the cell empty is a candidate too
+	Shade best = { 0, 0 };
+	float bestError = target;
+	float dimBrightness;
+	short dim = darker(colour, dimBrightness);
+	for (int i = 0; i < 4; i++) {
+		float amount = (i + 1) / 4.0f;
+		float error = fabsf(amount - target);
+		// The bright colour wins ties, it is the colour the geometry was drawn in
+		if (error <= bestError) {
+			bestError = error;
+			best = { blocks[i], colour };
+		}
+		if (dim >= 0) {
+			error = fabsf(amount * dimBrightness - target);
+			if (error < bestError) {
+				bestError = error;
+				best = { blocks[i], dim };
+			}
+		}
+	}
+	return best;
+}
+
+SupersampleBuffer::SupersampleBuffer(int cellsWide, int cellsHigh, int factor) {
+	m_factor = factor;
+	m_cellsWide = cellsWide;
+	m_cellsHigh = cellsHigh;
+	m_width = cellsWide * factor;
+	m_height = cellsHigh * factor;
+	m_samples.assign(static_cast<size_t>(m_width) * m_height, 0);
+	m_depth.assign(static_cast<size_t>(m_width) * m_height, FLT_MAX);
+	m_row.resize(static_cast<size_t>(cellsWide));
+	m_tiles = TileRenderer(m_width, m_height);
+}
+
+void SupersampleBuffer::clearDepth() {
+	std::fill(m_depth.begin(), m_depth.end(), FLT_MAX);
+}
+
+void SupersampleBuffer::fillTriangles(const std::vector<ScreenTriangle>& triangles, ThreadPool& pool, bool shaded) {
+	if (m_samples.empty())
+		return;
+	// A cell covers [x, x + 1), its samples [x * factor, (x + 1) * factor), so scaling lines the sample centers up
+	// inside the cell the same way the cell centers are
+	const float scale = static_cast<float>(m_factor);
+	m_scaled.resize(triangles.size());
+	m_values.resize(triangles.size());
+	for (size_t i = 0; i < triangles.size(); i++) {
+		ScreenTriangle t = triangles[i];
+		for (int v = 0; v < 3; v++) {
+			t.x[v] *= scale;
+			t.y[v] *= scale;
+		}
+		m_scaled[i] = t;
+		float level = shaded ? (t.shade[0] + t.shade[1] + t.shade[2]) * (255.0f / 3.0f) : 255.0f;
+		m_values[i] = static_cast<uint8_t>(std::min(std::max(level + 0.5f, 0.0f), 255.0f));
+	}
+	m_tiles.bin(m_scaled);
+	uint8_t* samples = m_samples.data();
+	const uint8_t* values = m_values.data();
+	const int width = m_width;
+	m_tiles.rasterize(m_scaled, m_depth.data(), pool, [samples, values, width](int px, int py, uint32_t i) {
+		samples[py * width + px] = values[i];
+	});
+}
+
+void SupersampleBuffer::drawLines(const std::vector<ScreenLine>& lines) {
+	if (m_samples.empty())
+		return;
+	const float scale = static_cast<float>(m_factor);
+	uint8_t* samples = m_samples.data();
+	const int width = m_width;
+	auto plot = [samples, width](int px, int py) {
+		samples[py * width + px] = 255;
+	};
+	for (const ScreenLine& line : lines)
+		raster::drawLine(line.x[0] * scale, line.y[0] * scale, line.x[1] * scale, line.y[1] * scale, 0, 0, m_width, m_height, plot);
+}
+
+void SupersampleBuffer::downsampleRow(int cellY, uint8_t* out) {
+	const int f = m_factor;
+	// The sum of f x f bytes fits 16 bits, the average is the sum over f * f rounded
+	const int shift = f == 4 ? 4 : 2;
+	const int half = 1 << (shift - 1);
+	uint8_t* rows[4];
+	for (int r = 0; r < f; r++)
+		rows[r] = m_samples.data() + static_cast<size_t>(cellY * f + r) * m_width;
+
+	int x = 0;
+#ifdef SUPERSAMPLE_SSE
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi16(1);
+	const __m128i bias = _mm_set1_epi32(half);
+	// 16 samples of each row a step, 8 cells at 2x2 and 4 at 4x4. The rows are added as 16 bit lanes, then
+	// neighbouring lanes are summed pairwise with madd (twice at 4x4) to leave one sum per cell
+	const int cellsPerStep = 16 / f;
+	for (; x + cellsPerStep <= m_cellsWide; x += cellsPerStep) {
+		__m128i lo = zero, hi = zero;
+		for (int r = 0; r < f; r++) {
+			__m128i* p = reinterpret_cast<__m128i*>(rows[r] + x * f);
+			__m128i v = _mm_loadu_si128(p);
+			_mm_storeu_si128(p, zero);
+			lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+			hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+		}
+		__m128i sumLo = _mm_madd_epi16(lo, ones);
+		__m128i sumHi = _mm_madd_epi16(hi, ones);
+		if (f == 2) {
+			sumLo = _mm_srli_epi32(_mm_add_epi32(sumLo, bias), shift);
+			sumHi = _mm_srli_epi32(_mm_add_epi32(sumHi, bias), shift);
+			__m128i words = _mm_packs_epi32(sumLo, sumHi);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(words, zero));
+		}
+		else {
+			// Pair sums are at most 4 * 2 * 255, still fine as signed 16 bit
+			__m128i sums = _mm_madd_epi16(_mm_packs_epi32(sumLo, sumHi), ones);
+			sums = _mm_srli_epi32(_mm_add_epi32(sums, bias), shift);
+			__m128i bytes = _mm_packus_epi16(_mm_packs_epi32(sums, zero), zero);
+			int value = _mm_cvtsi128_si32(bytes);
+			memcpy(out + x, &value, 4);
+		}
+	}
+#endif
+	for (; x < m_cellsWide; x++) {
+		int sum = 0;
+		for (int r = 0; r < f; r++) {
+			uint8_t* p = rows[r] + x * f;
+			for (int s = 0; s < f; s++) {
+				sum += p[s];
+				p[s] = 0;
+			}
+		}
+		out[x] = static_cast<uint8_t>((sum + half) >> shift);
+	}
+}
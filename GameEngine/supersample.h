@@ -0,0 +1,112 @@
+#pragma once
+
+#include "clipper.h"
+#include "framebuffer.h"
+#include "tilerenderer.h"
+#include <cstdint>
+#include <vector>
+
+/*
+* Anti-aliased drawing at console resolution.
+*
+* A cell can only show one of four shade glyphs in one colour, so a triangle edge crossing a cell either covers it
+* or not and edges step. SupersampleBuffer holds factor x factor samples per cell (2x2 or 4x4), each a coverage
+* byte from 0 (empty) to 255 (covered) with its own depth. Geometry is rasterized into the samples with the usual
+* rasterizer at the finer resolution, then resolve averages every cell's samples with an SSE2 box filter and looks
+* the average up in a ShadeTable, a 256 entry table of the glyph and colour that best shows that much coverage.
+*
+* The resolve reads each sample once and writes each cell once, so its cost only depends on the screen size and
+* is a fixed, small part of a frame next to rasterizing four or sixteen times the pixels.
+*/
+
+/*
+* The glyph and colour closest in brightness to coverage (0 to 255) of a cell in colour, picked from the
+* quarter, half, three quarter and solid blocks in colour and in its darker counterpart, so 2x2 coverage has its
+* 5 levels and 4x4 coverage up to 9. Glyph 0 means the cell is better left as it is.
+*/
+Shade shadeFor(uint8_t coverage, short colour);
+
+template <typename Cell>
+struct ShadeTable
+{
+	Cell cells[256];
+	// Coverage below this leaves the cell as it is
+	int threshold = 256;
+	short colour = -1;
+
+	void build(short c) {
+		colour = c;
+		threshold = 256;
+		for (int i = 255; i >= 0; i--) {
+			Shade s = shadeFor(static_cast<uint8_t>(i), c);
+			cells[i] = Cell::make(s.glyph, s.attributes);
+			if (s.glyph != 0)
+				threshold = i;
+		}
+	}
+};
+
+class SupersampleBuffer
+{
+public:
+	SupersampleBuffer() = default;
+	// factor is 2 or 4 samples per cell along each axis
+	SupersampleBuffer(int cellsWide, int cellsHigh, int factor);
+
+	int factor() const { return m_factor; }
+	// In samples
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+	uint8_t* samples() { return m_samples.data(); }
+	float* depth() { return m_depth.data(); }
+
+	void clearDepth();
+
+	/*
+	* Rasterize triangles given in cell coordinates with a depth test, covered samples are set to 255, or with shaded
+	* to the triangle's average light level (ScreenTriangle::shade) times 255 so the resolve shows light and coverage
+	*/
+	void fillTriangles(const std::vector<ScreenTriangle>& triangles, ThreadPool& pool, bool shaded = false);
+	// Lines given in cell coordinates, one sample wide
+	void drawLines(const std::vector<ScreenLine>& lines);
+
+	/*
+	* The average coverage of every cell in row cellY, cellsWide bytes, and the row's samples cleared for the next frame.
+	* Averages are rounded, so a 2x2 cell with 3 covered samples gives 191.
+	*/
+	void downsampleRow(int cellY, uint8_t* out);
+
+	/*
+	* Resolve the samples into cells (cellsWide x cellsHigh, row by row): every cell whose average coverage reaches
+	* table.threshold is set to table.cells[coverage], the rest keep what was drawn into them. The samples are empty
+	* afterwards.
+	*/
+	template <typename Cell>
+	void resolve(Cell* cells, const ShadeTable<Cell>& table) {
+		for (int y = 0; y < m_cellsHigh; y++) {
+			downsampleRow(y, m_row.data());
+			Cell* row = cells + static_cast<size_t>(y) * m_cellsWide;
+			for (int x = 0; x < m_cellsWide; x++) {
+				uint8_t c = m_row[x];
+				if (c >= table.threshold)
+					row[x] = table.cells[c];
+			}
+		}
+	}
+
+private:
+	int m_factor = 1;
+	int m_cellsWide = 0;
+	int m_cellsHigh = 0;
+	int m_width = 0;
+	int m_height = 0;
+	std::vector<uint8_t> m_samples;
+	std::vector<float> m_depth;
+	// One row of averages for resolve
+	std::vector<uint8_t> m_row;
+	TileRenderer m_tiles{ 0, 0 };
+	// The triangles scaled to samples, kept so a frame does not allocate
+	std::vector<ScreenTriangle> m_scaled;
+	// What each of them writes into its samples
+	std::vector<uint8_t> m_values;
+};
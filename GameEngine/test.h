@@ -135,11 +135,15 @@ Character Set -> Use Unicode. Thanks! - Javidx9
 #include <iostream>
 #include <chrono>
 #include <vector>
-#include <list>
+#include <algorithm>
+#include <cstring>
 #include <thread>
 #include <atomic>
 #include <condition_variable>
 
+// Header only like this file, nothing else has to be compiled or linked for the sound
+#include "audiomixer.h"
+
 enum COLOUR
 {
 	FG_BLACK = 0x0000,
@@ -206,21 +210,62 @@ public:
 	int nWidth = 0;
 	int nHeight = 0;
 
+	// A run of opaque (not L' ') cells in one row, the transparent cells between runs are never looked at
+	struct sSpan
+	{
+		int x;
+		int nLength;
+	};
+
 private:
-	short* m_Glyphs = nullptr;
-	short* m_Colours = nullptr;
+	std::vector<short> m_Glyphs;
+	std::vector<short> m_Colours;
+
+	// The sprite as it is drawn, ready to be copied into the screen buffer a run at a time.
+	// Rebuilt from m_Glyphs and m_Colours the first time the sprite is drawn after it changed
+	std::vector<CHAR_INFO> m_vecCells;
+	std::vector<sSpan> m_vecSpans;
+	// Row y's runs are m_vecSpans[m_vecRowStart[y]] up to m_vecSpans[m_vecRowStart[y + 1]], left to right
+	std::vector<int> m_vecRowStart;
+	bool m_bDirty = true;
 
 	void Create(int w, int h)
 	{
 		nWidth = w;
 		nHeight = h;
-		m_Glyphs = new short[w * h];
-		m_Colours = new short[w * h];
-		for (int i = 0; i < w * h; i++)
+		m_Glyphs.assign(w * h, L' ');
+		m_Colours.assign(w * h, FG_BLACK);
+		m_bDirty = true;
+	}
+
+	void Encode()
+	{
+		m_vecCells.resize(nWidth * nHeight);
+		m_vecSpans.clear();
+		m_vecRowStart.resize(nHeight + 1);
+		for (int y = 0; y < nHeight; y++)
 		{
-			m_Glyphs[i] = L' ';
-			m_Colours[i] = FG_BLACK;
+			m_vecRowStart[y] = (int)m_vecSpans.size();
+			int nRun = -1;
+			for (int x = 0; x < nWidth; x++)
+			{
+				int i = y * nWidth + x;
+				m_vecCells[i].Char.UnicodeChar = m_Glyphs[i];
+				m_vecCells[i].Attributes = m_Colours[i];
+				bool bOpaque = m_Glyphs[i] != L' ';
+				if (bOpaque && nRun < 0)
+					nRun = x;
+				if (!bOpaque && nRun >= 0)
+				{
+					m_vecSpans.push_back({ nRun, x - nRun });
+					nRun = -1;
+				}
+			}
+			if (nRun >= 0)
+				m_vecSpans.push_back({ nRun, nWidth - nRun });
 		}
+		m_vecRowStart[nHeight] = (int)m_vecSpans.size();
+		m_bDirty = false;
 	}
 
 public:
@@ -229,7 +274,10 @@ public:
 		if (x < 0 || x >= nWidth || y < 0 || y >= nHeight)
 			return;
 		else
+		{
 			m_Glyphs[y * nWidth + x] = c;
+			m_bDirty = true;
+		}
 	}
 
 	void SetColour(int x, int y, short c)
@@ -237,7 +285,33 @@ public:
 		if (x < 0 || x >= nWidth || y < 0 || y >= nHeight)
 			return;
 		else
+		{
 			m_Colours[y * nWidth + x] = c;
+			m_bDirty = true;
+		}
+	}
+
+	// Every cell row by row, nWidth per row
+	const CHAR_INFO* GetCells()
+	{
+		if (m_bDirty)
+			Encode();
+		return m_vecCells.data();
+	}
+
+	// The opaque runs of row y, sorted by x
+	const sSpan* GetSpansBegin(int y)
+	{
+		if (m_bDirty)
+			Encode();
+		return m_vecSpans.data() + m_vecRowStart[y];
+	}
+
+	const sSpan* GetSpansEnd(int y)
+	{
+		if (m_bDirty)
+			Encode();
+		return m_vecSpans.data() + m_vecRowStart[y + 1];
 	}
 
 	short GetGlyph(int x, int y)
@@ -285,8 +359,8 @@ public:
 
 		fwrite(&nWidth, sizeof(int), 1, f);
 		fwrite(&nHeight, sizeof(int), 1, f);
-		fwrite(m_Colours, sizeof(short), nWidth * nHeight, f);
-		fwrite(m_Glyphs, sizeof(short), nWidth * nHeight, f);
+		fwrite(m_Colours.data(), sizeof(short), nWidth * nHeight, f);
+		fwrite(m_Glyphs.data(), sizeof(short), nWidth * nHeight, f);
 
 		fclose(f);
 
@@ -295,10 +369,11 @@ public:
 
 	bool Load(std::wstring sFile)
 	{
-		delete[] m_Glyphs;
-		delete[] m_Colours;
+		m_Glyphs.clear();
+		m_Colours.clear();
 		nWidth = 0;
 		nHeight = 0;
+		m_bDirty = true;
 
 		FILE* f = nullptr;
 		_wfopen_s(&f, sFile.c_str(), L"rb");
@@ -310,14 +385,99 @@ public:
 
 		Create(nWidth, nHeight);
 
-		std::fread(m_Colours, sizeof(short), nWidth * nHeight, f);
-		std::fread(m_Glyphs, sizeof(short), nWidth * nHeight, f);
+		std::fread(m_Colours.data(), sizeof(short), nWidth * nHeight, f);
+		std::fread(m_Glyphs.data(), sizeof(short), nWidth * nHeight, f);
 
 		std::fclose(f);
 		return true;
 	}
 };
 
+// Many small sprites packed into one, so they share one set of cells and spans. Add the sprites,
+// Build once, then draw each one by the handle Add gave it. The handles stay valid for the atlas's life,
+// so once it is built nothing more can be added and it cannot be built again
+class olcSpriteAtlas
+{
+public:
+	struct sRegion
+	{
+		int x;
+		int y;
+		int w;
+		int h;
+	};
+
+	// The atlas copies the sprite when it is built, it does not need to live longer than that
+	// Returns -1 once the atlas is built
+	int Add(olcSprite* sprite)
+	{
+		if (m_bBuilt)
+			return -1;
+		m_vecPending.push_back(sprite);
+		m_vecRegions.push_back({ 0, 0, sprite->nWidth, sprite->nHeight });
+		return (int)m_vecRegions.size() - 1;
+	}
+
+	// Pack every added sprite into rows (shelves) nWidth cells wide, tallest first so the rows waste little.
+	// Returns false if the atlas was already built
+	bool Build(int nWidth = 256)
+	{
+		if (m_bBuilt)
+			return false;
+
+		std::vector<int> vecOrder(m_vecPending.size());
+		for (size_t i = 0; i < vecOrder.size(); i++)
+		{
+			vecOrder[i] = (int)i;
+			if (m_vecRegions[i].w > nWidth)
+				nWidth = m_vecRegions[i].w;
+		}
+		std::stable_sort(vecOrder.begin(), vecOrder.end(), [&](int a, int b) { return m_vecRegions[a].h > m_vecRegions[b].h; });
+
+		int nShelfX = 0, nShelfY = 0, nShelfHeight = 0;
+		for (int i : vecOrder)
+		{
+			sRegion& r = m_vecRegions[i];
+			if (nShelfX + r.w > nWidth)
+			{
+				nShelfY += nShelfHeight;
+				nShelfX = 0;
+				nShelfHeight = 0;
+			}
+			r.x = nShelfX;
+			r.y = nShelfY;
+			nShelfX += r.w;
+			if (r.h > nShelfHeight)
+				nShelfHeight = r.h;
+		}
+
+		// Cells no sprite was packed into stay L' ', so they are never drawn
+		m_sprite = olcSprite(nWidth, nShelfY + nShelfHeight);
+		for (size_t i = 0; i < m_vecPending.size(); i++)
+		{
+			const sRegion& r = m_vecRegions[i];
+			for (int y = 0; y < r.h; y++)
+				for (int x = 0; x < r.w; x++)
+				{
+					m_sprite.SetGlyph(r.x + x, r.y + y, m_vecPending[i]->GetGlyph(x, y));
+					m_sprite.SetColour(r.x + x, r.y + y, m_vecPending[i]->GetColour(x, y));
+				}
+		}
+		m_vecPending.clear();
+		m_bBuilt = true;
+		return true;
+	}
+
+	olcSprite* GetSprite() { return &m_sprite; }
+	const sRegion& GetRegion(int nHandle) const { return m_vecRegions[nHandle]; }
+
+private:
+	olcSprite m_sprite;
+	std::vector<olcSprite*> m_vecPending;
+	std::vector<sRegion> m_vecRegions;
+	bool m_bBuilt = false;
+};
+
 class olcConsoleGameEngine
 {
 public:
@@ -734,31 +894,56 @@ public:
 		if (sprite == nullptr)
 			return;
 
-		for (int i = 0; i < sprite->nWidth; i++)
-		{
-			for (int j = 0; j < sprite->nHeight; j++)
-			{
-				if (sprite->GetGlyph(i, j) != L' ')
-					Draw(x + i, y + j, sprite->GetGlyph(i, j), sprite->GetColour(i, j));
-			}
-		}
+		DrawPartialSprite(x, y, sprite, 0, 0, sprite->nWidth, sprite->nHeight);
 	}
 
+	// Sprites are copied straight into the screen buffer a run of opaque cells at a time, so
+	// they do not go through Draw. The rectangle is clipped once up front, after that nothing
+	// is tested per cell and transparent cells are skipped a whole run at a time
 	void DrawPartialSprite(int x, int y, olcSprite* sprite, int ox, int oy, int w, int h)
 	{
 		if (sprite == nullptr)
 			return;
 
-		for (int i = 0; i < w; i++)
+		// Outside the sprite is transparent
+		if (ox < 0) { x -= ox; w += ox; ox = 0; }
+		if (oy < 0) { y -= oy; h += oy; oy = 0; }
+		if (ox + w > sprite->nWidth) w = sprite->nWidth - ox;
+		if (oy + h > sprite->nHeight) h = sprite->nHeight - oy;
+
+		// and so is outside the screen
+		if (x < 0) { ox -= x; w += x; x = 0; }
+		if (y < 0) { oy -= y; h += y; y = 0; }
+		if (x + w > m_nScreenWidth) w = m_nScreenWidth - x;
+		if (y + h > m_nScreenHeight) h = m_nScreenHeight - y;
+		if (w <= 0 || h <= 0)
+			return;
+
+		const CHAR_INFO* cells = sprite->GetCells();
+		int nRight = ox + w;
+		for (int j = 0; j < h; j++)
 		{
-			for (int j = 0; j < h; j++)
+			const CHAR_INFO* src = cells + (oy + j) * sprite->nWidth;
+			CHAR_INFO* dst = m_bufScreen + (y + j) * m_nScreenWidth + x - ox;
+			const olcSprite::sSpan* end = sprite->GetSpansEnd(oy + j);
+			// First run that reaches into the rectangle, runs are sorted so it is a binary search
+			const olcSprite::sSpan* span = std::lower_bound(sprite->GetSpansBegin(oy + j), end, ox,
+				[](const olcSprite::sSpan& s, int left) { return s.x + s.nLength <= left; });
+			for (; span != end && span->x < nRight; span++)
 			{
-				if (sprite->GetGlyph(i + ox, j + oy) != L' ')
-					Draw(x + i, y + j, sprite->GetGlyph(i + ox, j + oy), sprite->GetColour(i + ox, j + oy));
+				int nStart = span->x > ox ? span->x : ox;
+				int nEnd = span->x + span->nLength < nRight ? span->x + span->nLength : nRight;
+				memcpy(dst + nStart, src + nStart, sizeof(CHAR_INFO) * (nEnd - nStart));
 			}
 		}
 	}
 
+	void DrawSprite(int x, int y, olcSpriteAtlas& atlas, int nHandle)
+	{
+		const olcSpriteAtlas::sRegion& r = atlas.GetRegion(nHandle);
+		DrawPartialSprite(x, y, atlas.GetSprite(), r.x, r.y, r.w, r.h);
+	}
+
 	void DrawWireFrameModel(const std::vector<std::pair<float, float>>& vecModelCoordinates, float x, float y, float r = 0.0f, float s = 1.0f, short col = FG_WHITE, short c = PIXEL_SOLID)
 	{
 		// pair.first = x coordinate
@@ -1083,17 +1268,9 @@ protected: // Audio Engine =====================================================
 	// This vector holds all loaded sound samples in memory
 	std::vector<olcAudioSample> vecAudioSamples;
 
-	// This structure represents a sound that is currently playing. It only
-	// holds the sound ID and where this instance of it is up to for its
-	// current playback
-	struct sCurrentlyPlayingSample
-	{
-		int nAudioSampleID = 0;
-		long nSamplePosition = 0;
-		bool bFinished = false;
-		bool bLoop = false;
-	};
-	std::list<sCurrentlyPlayingSample> listActiveSamples;
+	// Plays the samples, see GetMixerOutput. Its voices belong to the audio thread,
+	// PlaySample and friends only send it commands
+	AudioMixer m_mixer;
 
 	// Load a 16-bit WAVE file @ 44100Hz ONLY into memory. A sample ID
 	// number is returned if successful, otherwise -1
@@ -1112,20 +1289,29 @@ protected: // Audio Engine =====================================================
 			return -1;
 	}
 
-	// Add sample 'id' to the mixers sounds to play list
-	void PlaySample(int id, bool bLoop = false)
+	// Start playing sample 'id'. Returns the voice playing it, for StopSample
+	// and SetSampleVolume, or 0 if it could not be started
+	int PlaySample(int id, bool bLoop = false, float fVolume = 1.0f)
 	{
-		sCurrentlyPlayingSample a;
-		a.nAudioSampleID = id;
-		a.nSamplePosition = 0;
-		a.bFinished = false;
-		a.bLoop = bLoop;
-		listActiveSamples.push_back(a);
+		if (id < 1 || id > (int)vecAudioSamples.size())
+			return 0;
+
+		const olcAudioSample& a = vecAudioSamples[id - 1];
+		AudioClip clip;
+		clip.samples = a.fSample;
+		clip.frames = (uint32_t)a.nSamples;
+		clip.channels = (uint32_t)a.nChannels;
+		return (int)m_mixer.play(clip, fVolume, bLoop);
 	}
 
-	void StopSample(int id)
+	void StopSample(int nVoice)
 	{
+		m_mixer.stop((uint32_t)nVoice);
+	}
 
+	void SetSampleVolume(int nVoice, float fVolume)
+	{
+		m_mixer.setGain((uint32_t)nVoice, fVolume);
 	}
 
 	// The audio system uses by default a specific wave format
@@ -1142,6 +1328,7 @@ protected: // Audio Engine =====================================================
 		m_nBlockCurrent = 0;
 		m_pBlockMemory = nullptr;
 		m_pWaveHeaders = nullptr;
+		m_vecMixBlock.assign(m_nBlockSamples, 0.0f);
 
 		// Device is available
 		WAVEFORMATEX waveFormat;
@@ -1215,11 +1402,6 @@ protected: // Audio Engine =====================================================
 		m_fGlobalTime = 0.0f;
 		float fTimeStep = 1.0f / (float)m_nSampleRate;
 
-		// Goofy hack to get maximum integer for a type at run-time
-		short nMaxSample = (short)pow(2, (sizeof(short) * 8) - 1) - 1;
-		float fMaxSample = (float)nMaxSample;
-		short nPreviousSample = 0;
-
 		while (m_bAudioThreadActive)
 		{
 			// Wait for block to become available
@@ -1237,29 +1419,11 @@ protected: // Audio Engine =====================================================
 			if (m_pWaveHeaders[m_nBlockCurrent].dwFlags & WHDR_PREPARED)
 				waveOutUnprepareHeader(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
 
-			short nNewSample = 0;
 			int nCurrentBlock = m_nBlockCurrent * m_nBlockSamples;
 
-			auto clip = [](float fSample, float fMax)
-				{
-					if (fSample >= 0.0)
-						return fmin(fSample, fMax);
-					else
-						return fmax(fSample, -fMax);
-				};
-
-			for (unsigned int n = 0; n < m_nBlockSamples; n += m_nChannels)
-			{
-				// User Process
-				for (unsigned int c = 0; c < m_nChannels; c++)
-				{
-					nNewSample = (short)(clip(GetMixerOutput(c, m_fGlobalTime, fTimeStep), 1.0) * fMaxSample);
-					m_pBlockMemory[nCurrentBlock + n + c] = nNewSample;
-					nPreviousSample = nNewSample;
-				}
-
-				m_fGlobalTime = m_fGlobalTime + fTimeStep;
-			}
+			// Mix the whole block, then clip it and convert it for the soundcard in one go
+			GetMixerOutput(m_vecMixBlock.data(), m_nBlockSamples / m_nChannels, fTimeStep);
+			clipToPcm16(m_vecMixBlock.data(), m_pBlockMemory + nCurrentBlock, m_nBlockSamples);
 
 			// Send block to sound device
 			waveOutPrepareHeader(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
@@ -1283,12 +1447,11 @@ protected: // Audio Engine =====================================================
 
 	// The Sound Mixer - If the user wants to play many sounds simultaneously, and
 	// perhaps the same sound overlapping itself, then you need a mixer, which
-	// takes input from all sound sources for that audio frame. This mixer maintains
-	// a list of sound locations for all concurrently playing audio samples. Instead
-	// of duplicating audio data, we simply store the fact that a sound sample is in
-	// use and an offset into its sample data. As time progresses we update this offset
-	// until it is beyound the length of the sound sample it is attached to. At this
-	// point we remove the playing souind from the list.
+	// takes input from all sound sources for that audio frame. The mixer keeps a
+	// voice for every concurrently playing audio sample. Instead of duplicating
+	// audio data, a voice just points at the sample's data and an offset into it,
+	// which moves on a block at a time until it is beyond the end of the sample
+	// (or wraps around for looping samples) and the voice is freed.
 	//
 	// Additionally, the users application may want to generate sound instead of just
 	// playing audio clips (think a synthesizer for example) in whcih case we also
@@ -1298,31 +1461,29 @@ protected: // Audio Engine =====================================================
 	// Finally, before the sound is issued to the operating system for performing, the
 	// user gets one final chance to "filter" the sound, perhaps changing the volume
 	// or adding funky effects
-	float GetMixerOutput(int nChannel, float fGlobalTime, float fTimeStep)
+	//
+	// Fills fBlock with nFrames frames of m_nChannels interleaved channels, unclipped
+	void GetMixerOutput(float* fBlock, unsigned int nFrames, float fTimeStep)
 	{
-		// Accumulate sample for this channel
-		float fMixerSample = 0.0f;
+		// Every playing sample, a block at a time
+		m_mixer.mix(fBlock, nFrames, m_nChannels);
 
-		for (auto& s : listActiveSamples)
+		float fGlobalTime = m_fGlobalTime;
+		for (unsigned int n = 0; n < nFrames; n++)
 		{
-			// Calculate sample position
-			s.nSamplePosition += (long)((float)vecAudioSamples[s.nAudioSampleID - 1].wavHeader.nSamplesPerSec * fTimeStep);
-
-			// If sample position is valid add to the mix
-			if (s.nSamplePosition < vecAudioSamples[s.nAudioSampleID - 1].nSamples)
-				fMixerSample += vecAudioSamples[s.nAudioSampleID - 1].fSample[(s.nSamplePosition * vecAudioSamples[s.nAudioSampleID - 1].nChannels) + nChannel];
-			else
-				s.bFinished = true; // Else sound has completed
-		}
-
-		// If sounds have completed then remove them
-		listActiveSamples.remove_if([](const sCurrentlyPlayingSample& s) {return s.bFinished; });
+			for (unsigned int c = 0; c < m_nChannels; c++)
+			{
+				float& fSample = fBlock[n * m_nChannels + c];
 
-		// The users application might be generating sound, so grab that if it exists
-		fMixerSample += onUserSoundSample(nChannel, fGlobalTime, fTimeStep);
+				// The users application might be generating sound, so grab that if it exists
+				fSample += onUserSoundSample(c, fGlobalTime, fTimeStep);
 
-		// Return the sample via an optional user override to filter the sound
-		return onUserSoundFilter(nChannel, fGlobalTime, fMixerSample);
+				// Pass the sample via an optional user override to filter the sound
+				fSample = onUserSoundFilter(c, fGlobalTime, fSample);
+			}
+			fGlobalTime += fTimeStep;
+		}
+		m_fGlobalTime = fGlobalTime;
 	}
 
 	unsigned int m_nSampleRate;
@@ -1332,6 +1493,8 @@ protected: // Audio Engine =====================================================
 	unsigned int m_nBlockCurrent;
 
 	short* m_pBlockMemory = nullptr;
+	// One block mixed as floats before it is clipped into m_pBlockMemory
+	std::vector<float> m_vecMixBlock;
 	WAVEHDR* m_pWaveHeaders = nullptr;
 	HWAVEOUT m_hwDevice = nullptr;
 
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+* A fixed set of worker threads for data parallel loops.
+* parallelFor hands out loop indices through an atomic counter, so workers that finish early simply take
+* more of the remaining items. The calling thread works too, a pool of size 1 has no workers and runs inline.
+* The mutex is only taken to start and finish a loop, never per item.
+*/
+class ThreadPool
+{
+public:
+	// threads is the total number of threads including the caller, 0 picks one per hardware thread
+	explicit ThreadPool(unsigned int threads = 0) {
+		if (threads == 0)
+			threads = std::thread::hardware_concurrency();
+		if (threads == 0)
+			threads = 1;
+		for (unsigned int i = 1; i < threads; i++) {
+			m_workers.emplace_back(&ThreadPool::workerThread, this);
+		}
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_quit = true;
+		}
+		m_wake.notify_all();
+		for (auto& w : m_workers) {
+			w.join();
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	unsigned int size() const { return static_cast<unsigned int>(m_workers.size()) + 1; }
+
+	// Run fn(i) for every i in [0, count) and return once all of them are done
+	void parallelFor(size_t count, const std::function<void(size_t)>& fn) {
+		if (count == 0)
+			return;
+		if (m_workers.empty() || count == 1) {
+			for (size_t i = 0; i < count; i++)
+				fn(i);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_job = &fn;
+			m_count = count;
+			m_next = 0;
+			m_busy = static_cast<unsigned int>(m_workers.size());
+			m_generation++;
+		}
+		m_wake.notify_all();
+		runItems(fn, count);
+
+		// Wait for the workers to run out of items, so fn can safely go out of scope
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait(lock, [this]() { return m_busy == 0; });
+		m_job = nullptr;
+	}
+
+private:
+	void runItems(const std::function<void(size_t)>& fn, size_t count) {
+		while (true) {
+			size_t i = m_next.fetch_add(1, std::memory_order_relaxed);
+			if (i >= count)
+				break;
+			fn(i);
+		}
+	}
+
+	void workerThread() {
+		unsigned long long seen = 0;
+		while (true) {
+			const std::function<void(size_t)>* job;
+			size_t count;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [&]() { return m_quit || m_generation != seen; });
+				if (m_quit)
+					return;
+				seen = m_generation;
+				job = m_job;
+				count = m_count;
+			}
+			runItems(*job, count);
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_busy--;
+			}
+			m_done.notify_one();
+		}
+	}
+
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	const std::function<void(size_t)>* m_job = nullptr;
+	size_t m_count = 0;
+	std::atomic<size_t> m_next{ 0 };
+	unsigned int m_busy = 0;
+	unsigned long long m_generation = 0;
+	bool m_quit = false;
+};
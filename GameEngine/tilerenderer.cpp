@@ -0,0 +1,41 @@
+#include "tilerenderer.h"
+
+TileRenderer::TileRenderer(int width, int height, int tileWidth, int tileHeight) {
+	m_width = width;
+	m_height = height;
+	m_tileWidth = tileWidth;
+	m_tileHeight = tileHeight;
+	m_tilesX = (width + tileWidth - 1) / tileWidth;
+	m_tilesY = (height + tileHeight - 1) / tileHeight;
+	m_bins.resize(static_cast<size_t>(m_tilesX) * m_tilesY);
+}
+
+void TileRenderer::bin(const std::vector<ScreenTriangle>& triangles) {
+	PROFILE_ZONE("bin");
+	// clear keeps the capacity, so after the first few frames binning never allocates
+	for (auto& b : m_bins) {
+		b.clear();
+	}
+
+	for (size_t i = 0; i < triangles.size(); i++) {
+		const ScreenTriangle& tri = triangles[i];
+		float minX = fminf(tri.x[0], fminf(tri.x[1], tri.x[2]));
+		float maxX = fmaxf(tri.x[0], fmaxf(tri.x[1], tri.x[2]));
+		float minY = fminf(tri.y[0], fminf(tri.y[1], tri.y[2]));
+		float maxY = fmaxf(tri.y[0], fmaxf(tri.y[1], tri.y[2]));
+		// Off screen or not a number, either way it covers no tile
+		if (!(maxX >= 0.0f && maxY >= 0.0f && minX < m_width && minY < m_height))
+			continue;
+
+		// Clamp to the screen first so the conversion to int cannot overflow
+		int tx0 = static_cast<int>(fmaxf(minX, 0.0f)) / m_tileWidth;
+		int ty0 = static_cast<int>(fmaxf(minY, 0.0f)) / m_tileHeight;
+		int tx1 = static_cast<int>(fminf(maxX, m_width - 1.0f)) / m_tileWidth;
+		int ty1 = static_cast<int>(fminf(maxY, m_height - 1.0f)) / m_tileHeight;
+		for (int ty = ty0; ty <= ty1; ty++) {
+			for (int tx = tx0; tx <= tx1; tx++) {
+				m_bins[ty * m_tilesX + tx].push_back(static_cast<uint32_t>(i));
+			}
+		}
+	}
+}
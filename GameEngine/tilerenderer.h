@@ -0,0 +1,73 @@
+#pragma once
+
+#include "clipper.h"
+#include "raster.h"
+#include "threadpool.h"
+#include "profiler.h"
+
+/*
+* Sort-middle tiled rasterization.
+*
+* The screen is split into fixed size tiles. After the clip stage every triangle is added to the bin of each
+* tile its bounding box touches, then the tiles are rasterized in parallel, each clipped to its own rectangle.
+* No two tiles share a pixel, so the pixel and depth writes need no locks, and because every bin keeps the
+* triangles in submission order each pixel sees exactly the same sequence of depth tests as a serial render.
+*/
+class TileRenderer
+{
+public:
+	TileRenderer(int width, int height, int tileWidth = 64, int tileHeight = 32);
+
+	int tileCount() const { return m_tilesX * m_tilesY; }
+	int getWidth() const { return m_width; }
+	int getHeight() const { return m_height; }
+
+	// Sort the triangles into the tile bins, replacing the previous frame's bins
+	void bin(const std::vector<ScreenTriangle>& triangles);
+
+	// The triangles (indices into the array given to bin) overlapping tile t, in submission order
+	const std::vector<uint32_t>& tileBin(int t) const { return m_bins[t]; }
+
+	/*
+	* Rasterize the binned triangles into depth (width x height, row stride width), one tile per task.
+	* plot(x, y, triangleIndex) is called for every pixel that passes the depth test, possibly from several
+	* threads at once but never for the same pixel from two threads.
+	*/
+	template <typename Plot>
+	void rasterize(const std::vector<ScreenTriangle>& triangles, float* depth, ThreadPool& pool, Plot plot) const {
+		pool.parallelFor(static_cast<size_t>(tileCount()), [&](size_t t) {
+			PROFILE_ZONE("tile");
+			rasterizeTile(static_cast<int>(t), triangles, depth, plot);
+		});
+	}
+
+	// The same on the calling thread only, the reference the parallel path must match
+	template <typename Plot>
+	void rasterizeSerial(const std::vector<ScreenTriangle>& triangles, float* depth, Plot plot) const {
+		for (int t = 0; t < tileCount(); t++) {
+			rasterizeTile(t, triangles, depth, plot);
+		}
+	}
+
+private:
+	template <typename Plot>
+	void rasterizeTile(int t, const std::vector<ScreenTriangle>& triangles, float* depth, Plot& plot) const {
+		int x0 = (t % m_tilesX) * m_tileWidth;
+		int y0 = (t / m_tilesX) * m_tileHeight;
+		int x1 = x0 + m_tileWidth < m_width ? x0 + m_tileWidth : m_width;
+		int y1 = y0 + m_tileHeight < m_height ? y0 + m_tileHeight : m_height;
+		for (uint32_t i : m_bins[t]) {
+			const ScreenTriangle& tri = triangles[i];
+			raster::fillTriangle(tri.x, tri.y, tri.z, x0, y0, x1, y1, depth, m_width,
+				[&plot, i](int x, int y) { plot(x, y, i); });
+		}
+	}
+
+	int m_width;
+	int m_height;
+	int m_tileWidth;
+	int m_tileHeight;
+	int m_tilesX;
+	int m_tilesY;
+	std::vector<std::vector<uint32_t>> m_bins;
+};
@@ -0,0 +1,193 @@
+#include "transform.h"
+#include "simd.h"
+#include <cmath>
+
+void transformVertices(const mat4x4& m, const VertexStream& in, VertexStream& out, float viewportWidth, float viewportHeight) {
+	out.resize(in.size());
+	transformVertices(m, in.x.data(), in.y.data(), in.z.data(), in.size(),
+		out.x.data(), out.y.data(), out.z.data(), viewportWidth, viewportHeight);
+}
+
+// Transforms a single vertex through the matrix with the viewport folded in, used for the tail that does not
+// fill a full SIMD register. The maths is exactly the same as the vector body so both produce identical results
+static inline void transformOne(const mat4x4& m, float x, float y, float z, float& outX, float& outY, float& outZ) {
+	float tx = x * m.m[0][0] + y * m.m[1][0] + z * m.m[2][0] + m.m[3][0];
+	float ty = x * m.m[0][1] + y * m.m[1][1] + z * m.m[2][1] + m.m[3][1];
+	float tz = x * m.m[0][2] + y * m.m[1][2] + z * m.m[2][2] + m.m[3][2];
+	float w = x * m.m[0][3] + y * m.m[1][3] + z * m.m[2][3] + m.m[3][3];
+	// Same rule as matrixMultiplyVector, a zero w leaves the point undivided
+	if (w == 0.0f)
+		w = 1.0f;
+	outX = tx / w;
+	outY = ty / w;
+	outZ = tz / w;
+}
+
+void transformVertices(const mat4x4& matrix, const float* inX, const float* inY, const float* inZ, size_t count,
+	float* outX, float* outY, float* outZ, float viewportWidth, float viewportHeight) {
+	// The viewport scale and offset ride along in the matrix, (x / w) * width / 2 + width / 2 is
+	// (x * width / 2 + w * width / 2) / w, so a vertex is a multiply and a divide with nothing after
+	const mat4x4 m = mat4x4::viewport(viewportWidth, viewportHeight) * matrix;
+
+	size_t i = 0;
+#if SIMD_WIDTH > 1
+	// Broadcast every matrix element once, they stay in registers for the whole loop
+	const simd_float m00 = simd_set1(m.m[0][0]), m01 = simd_set1(m.m[0][1]), m02 = simd_set1(m.m[0][2]), m03 = simd_set1(m.m[0][3]);
+	const simd_float m10 = simd_set1(m.m[1][0]), m11 = simd_set1(m.m[1][1]), m12 = simd_set1(m.m[1][2]), m13 = simd_set1(m.m[1][3]);
+	const simd_float m20 = simd_set1(m.m[2][0]), m21 = simd_set1(m.m[2][1]), m22 = simd_set1(m.m[2][2]), m23 = simd_set1(m.m[2][3]);
+	const simd_float m30 = simd_set1(m.m[3][0]), m31 = simd_set1(m.m[3][1]), m32 = simd_set1(m.m[3][2]), m33 = simd_set1(m.m[3][3]);
+	const simd_float zero = simd_set1(0.0f);
+	const simd_float one = simd_set1(1.0f);
+
+	for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH) {
+		simd_float x = simd_load(inX + i);
+		simd_float y = simd_load(inY + i);
+		simd_float z = simd_load(inZ + i);
+
+		simd_float tx = simd_add(simd_madd(z, m20, simd_madd(y, m10, simd_mul(x, m00))), m30);
+		simd_float ty = simd_add(simd_madd(z, m21, simd_madd(y, m11, simd_mul(x, m01))), m31);
+		simd_float tz = simd_add(simd_madd(z, m22, simd_madd(y, m12, simd_mul(x, m02))), m32);
+		simd_float w = simd_add(simd_madd(z, m23, simd_madd(y, m13, simd_mul(x, m03))), m33);
+		w = simd_select(simd_cmpeq(w, zero), one, w);
+
+		simd_store(outX + i, simd_div(tx, w));
+		simd_store(outY + i, simd_div(ty, w));
+		simd_store(outZ + i, simd_div(tz, w));
+	}
+#endif
+	for (; i < count; i++) {
+		transformOne(m, inX[i], inY[i], inZ[i], outX[i], outY[i], outZ[i]);
+	}
+}
+
+void transformVertices(const mat4x4& m, const VertexStream& in, ClipSpaceStream& clip, VertexStream& screen,
+	float viewportWidth, float viewportHeight) {
+	const size_t count = in.size();
+	clip.resize(count);
+	screen.resize(count);
+	const float halfWidth = 0.5f * viewportWidth;
+	const float halfHeight = 0.5f * viewportHeight;
+	const float* inX = in.x.data();
+	const float* inY = in.y.data();
+	const float* inZ = in.z.data();
+
+	size_t i = 0;
+#if SIMD_WIDTH > 1
+	const simd_float m00 = simd_set1(m.m[0][0]), m01 = simd_set1(m.m[0][1]), m02 = simd_set1(m.m[0][2]), m03 = simd_set1(m.m[0][3]);
+	const simd_float m10 = simd_set1(m.m[1][0]), m11 = simd_set1(m.m[1][1]), m12 = simd_set1(m.m[1][2]), m13 = simd_set1(m.m[1][3]);
+	const simd_float m20 = simd_set1(m.m[2][0]), m21 = simd_set1(m.m[2][1]), m22 = simd_set1(m.m[2][2]), m23 = simd_set1(m.m[2][3]);
+	const simd_float m30 = simd_set1(m.m[3][0]), m31 = simd_set1(m.m[3][1]), m32 = simd_set1(m.m[3][2]), m33 = simd_set1(m.m[3][3]);
+	const simd_float hw = simd_set1(halfWidth);
+	const simd_float hh = simd_set1(halfHeight);
+	const simd_float zero = simd_set1(0.0f);
+	const simd_float one = simd_set1(1.0f);
+
+	for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH) {
+		simd_float x = simd_load(inX + i);
+		simd_float y = simd_load(inY + i);
+		simd_float z = simd_load(inZ + i);
+
+		simd_float tx = simd_add(simd_madd(z, m20, simd_madd(y, m10, simd_mul(x, m00))), m30);
+		simd_float ty = simd_add(simd_madd(z, m21, simd_madd(y, m11, simd_mul(x, m01))), m31);
+		simd_float tz = simd_add(simd_madd(z, m22, simd_madd(y, m12, simd_mul(x, m02))), m32);
+		simd_float w = simd_add(simd_madd(z, m23, simd_madd(y, m13, simd_mul(x, m03))), m33);
+		simd_store(&clip.x[i], tx);
+		simd_store(&clip.y[i], ty);
+		simd_store(&clip.z[i], tz);
+		simd_store(&clip.w[i], w);
+
+		w = simd_select(simd_cmpeq(w, zero), one, w);
+		simd_store(&screen.x[i], simd_madd(simd_div(tx, w), hw, hw));
+		simd_store(&screen.y[i], simd_madd(simd_div(ty, w), hh, hh));
+		simd_store(&screen.z[i], simd_div(tz, w));
+	}
+#endif
+	for (; i < count; i++) {
+		float x = inX[i], y = inY[i], z = inZ[i];
+		clip.x[i] = x * m.m[0][0] + y * m.m[1][0] + z * m.m[2][0] + m.m[3][0];
+		clip.y[i] = x * m.m[0][1] + y * m.m[1][1] + z * m.m[2][1] + m.m[3][1];
+		clip.z[i] = x * m.m[0][2] + y * m.m[1][2] + z * m.m[2][2] + m.m[3][2];
+		clip.w[i] = x * m.m[0][3] + y * m.m[1][3] + z * m.m[2][3] + m.m[3][3];
+		float w = clip.w[i] == 0.0f ? 1.0f : clip.w[i];
+		screen.x[i] = (clip.x[i] / w) * halfWidth + halfWidth;
+		screen.y[i] = (clip.y[i] / w) * halfHeight + halfHeight;
+		screen.z[i] = clip.z[i] / w;
+	}
+}
+
+// Squared lengths of the rows of the upper 3x3, all 1 when the matrix only rotates
+static bool keepsUnitLength(const mat4x4& m) {
+	for (int i = 0; i < 3; i++) {
+		float l2 = m.m[i][0] * m.m[i][0] + m.m[i][1] * m.m[i][1] + m.m[i][2] * m.m[i][2];
+		if (fabsf(l2 - 1.0f) > 1e-5f)
+			return false;
+	}
+	return true;
+}
+
+void transformNormals(const mat4x4& m, const VertexStream& in, VertexStream& out) {
+	size_t count = in.size();
+	out.resize(count);
+	const float* inX = in.x.data();
+	const float* inY = in.y.data();
+	const float* inZ = in.z.data();
+	float* outX = out.x.data();
+	float* outY = out.y.data();
+	float* outZ = out.z.data();
+
+	size_t i = 0;
+#if SIMD_WIDTH > 1
+	const simd_float m00 = simd_set1(m.m[0][0]), m01 = simd_set1(m.m[0][1]), m02 = simd_set1(m.m[0][2]);
+	const simd_float m10 = simd_set1(m.m[1][0]), m11 = simd_set1(m.m[1][1]), m12 = simd_set1(m.m[1][2]);
+	const simd_float m20 = simd_set1(m.m[2][0]), m21 = simd_set1(m.m[2][1]), m22 = simd_set1(m.m[2][2]);
+	for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH) {
+		simd_float x = simd_load(inX + i);
+		simd_float y = simd_load(inY + i);
+		simd_float z = simd_load(inZ + i);
+		simd_store(outX + i, simd_madd(z, m20, simd_madd(y, m10, simd_mul(x, m00))));
+		simd_store(outY + i, simd_madd(z, m21, simd_madd(y, m11, simd_mul(x, m01))));
+		simd_store(outZ + i, simd_madd(z, m22, simd_madd(y, m12, simd_mul(x, m02))));
+	}
+#endif
+	for (; i < count; i++) {
+		float x = inX[i], y = inY[i], z = inZ[i];
+		outX[i] = x * m.m[0][0] + y * m.m[1][0] + z * m.m[2][0];
+		outY[i] = x * m.m[0][1] + y * m.m[1][1] + z * m.m[2][1];
+		outZ[i] = x * m.m[0][2] + y * m.m[1][2] + z * m.m[2][2];
+	}
+
+	// A scaled model matrix scales the normals too
+	if (!keepsUnitLength(m))
+		normalizeVectors(out);
+}
+
+void normalizeVectors(float* x, float* y, float* z, size_t count) {
+	size_t i = 0;
+#if SIMD_WIDTH > 1
+	const simd_float zero = simd_set1(0.0f);
+	for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH) {
+		simd_float vx = simd_load(x + i);
+		simd_float vy = simd_load(y + i);
+		simd_float vz = simd_load(z + i);
+		simd_float l2 = simd_madd(vz, vz, simd_madd(vy, vy, simd_mul(vx, vx)));
+		// Zero vectors stay zero instead of turning into NaN
+		simd_float inv = simd_select(simd_cmpeq(l2, zero), zero, simd_rsqrt_refined(l2));
+		simd_store(x + i, simd_mul(vx, inv));
+		simd_store(y + i, simd_mul(vy, inv));
+		simd_store(z + i, simd_mul(vz, inv));
+	}
+#endif
+	for (; i < count; i++) {
+		float l2 = x[i] * x[i] + y[i] * y[i] + z[i] * z[i];
+		if (l2 == 0.0f)
+			continue;
+		float inv = 1.0f / sqrtf(l2);
+		x[i] *= inv;
+		y[i] *= inv;
+		z[i] *= inv;
+	}
+}
+
+void normalizeVectors(VertexStream& v) {
+	normalizeVectors(v.x.data(), v.y.data(), v.z.data(), v.size());
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "geometry.h"
+
+/*
+* Batched vertex transform. Takes a whole VertexStream through a combined matrix in one call
+* instead of calling mat4x4::matrixMultiplyVector per corner per matrix.
+*
+* For every vertex this does the 4x4 multiply, the perspective divide by w and the viewport
+* scale from [-1, 1] to [0, width] x [0, height] in a single pass, SIMD_WIDTH vertices at a time.
+* The viewport is folded into the matrix first (see mat4x4::viewport), so per vertex it is only the
+* multiply and the divide.
+*
+* @param m: The combined matrix, for a view followed by a projection this is matProj * matView.
+*
+* @param in: The positions to transform.
+*
+* @param out: Receives screen space x, y and the projected z. Resized to match the input.
+*
+* @param viewportWidth, viewportHeight: The size of the screen in characters.
+*/
+void transformVertices(const mat4x4& m, const VertexStream& in, VertexStream& out, float viewportWidth, float viewportHeight);
+
+/*
+* Same as transformVertices but over raw arrays of count elements, so callers can transform
+* a slice of a stream. The output arrays may not alias the inputs.
+*/
+void transformVertices(const mat4x4& m, const float* inX, const float* inY, const float* inZ, size_t count,
+	float* outX, float* outY, float* outZ, float viewportWidth, float viewportHeight);
+
+/*
+* Homogeneous clip space positions, before the perspective divide.
+* A vertex is in front of the near plane when z >= 0 and inside the view when |x|, |y| <= w and z <= w.
+*/
+struct ClipSpaceStream
+{
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+	std::vector<float> w;
+	size_t size() const { return x.size(); }
+	void resize(size_t n) {
+		x.resize(n);
+		y.resize(n);
+		z.resize(n);
+		w.resize(n);
+	}
+};
+
+/*
+* Same as transformVertices but also keeps the clip space position of every vertex, which the clipper
+* needs for triangles that cross the near plane. screen is only meaningful for vertices with w > 0.
+*/
+void transformVertices(const mat4x4& m, const VertexStream& in, ClipSpaceStream& clip, VertexStream& screen,
+	float viewportWidth, float viewportHeight);
+
+/*
+* Rotates a stream of normals by the upper 3x3 part of a model matrix, no translation and no divide.
+* Only needs to run when the model matrix changes, the mesh normals themselves are computed once at load.
+* Assumes the matrix has no non-uniform scale. A uniformly scaled matrix gives scaled normals,
+* which are then brought back to unit length with normalizeVectors.
+*/
+void transformNormals(const mat4x4& m, const VertexStream& in, VertexStream& out);
+
+/*
+* Scales every vector of a stream to unit length, SIMD_WIDTH at a time with the refined reciprocal
+* square root (about 22 bits) instead of a square root and three divides each. Zero vectors stay zero.
+*/
+void normalizeVectors(VertexStream& v);
+void normalizeVectors(float* x, float* y, float* z, size_t count);
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "geometry.h"
+#include "simd.h"
+
+/*
+* 4 wide vector maths.
+*
+* vec4 is four floats aligned to 16 bytes, so with SSE (which every AVX build has as well) a vec4 is one register
+* and an add, a dot or a cross is a handful of instructions. Without SSE, or with GAMEENGINE_NO_SIMD, the same
+* functions are plain float code. mat4 is mat4x4 under a shorter name, its rows line up with vec4s, see
+* vec4_transform.
+*
+* vec3 and its free functions are unchanged and vec4 converts to and from it, so code can move over one call site
+* at a time. dot_product, cross_product and normalize are overloaded for vec4 and work on x, y and z only, like
+* their vec3 versions, so a vec3 that becomes a vec4 keeps compiling.
+*/
+
+#if defined(SIMD_AVX) || defined(SIMD_SSE)
+#include <emmintrin.h>
+#define VECMATH_SSE 1
+#endif
+
+typedef mat4x4 mat4;
+
+struct alignas(16) vec4
+{
+	float x = 0.0f;
+	float y = 0.0f;
+	float z = 0.0f;
+	float w = 0.0f;
+
+	constexpr vec4() = default;
+	constexpr vec4(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
+	// A point has w 1, a direction w 0
+	constexpr vec4(const vec3& v, float w) : x(v.x), y(v.y), z(v.z), w(w) {}
+	constexpr vec3 xyz() const { return { x, y, z }; }
+};
+
+#ifdef VECMATH_SSE
+
+inline __m128 vec4_load(const vec4& v) { return _mm_load_ps(&v.x); }
+inline vec4 vec4_store(__m128 r) {
+	vec4 v;
+	_mm_store_ps(&v.x, r);
+	return v;
+}
+// The sum of lanes 0, 1 and 2 in lane 0, SSE2 has no horizontal add
+inline __m128 vec4_hadd3(__m128 r) {
+	__m128 s = _mm_add_ss(r, _mm_shuffle_ps(r, r, _MM_SHUFFLE(1, 1, 1, 1)));
+	return _mm_add_ss(s, _mm_shuffle_ps(r, r, _MM_SHUFFLE(2, 2, 2, 2)));
+}
+// The SSE version of simd_rsqrt_refined, which is AVX wide in AVX builds
+inline __m128 vec4_rsqrt(__m128 a) {
+	__m128 r = _mm_rsqrt_ps(a);
+	return _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), r), _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_mul_ps(a, r), r)));
+}
+
+inline vec4 vec4_add(const vec4& a, const vec4& b) { return vec4_store(_mm_add_ps(vec4_load(a), vec4_load(b))); }
+inline vec4 vec4_sub(const vec4& a, const vec4& b) { return vec4_store(_mm_sub_ps(vec4_load(a), vec4_load(b))); }
+inline vec4 vec4_mul(const vec4& v, float k) { return vec4_store(_mm_mul_ps(vec4_load(v), _mm_set1_ps(k))); }
+inline vec4 vec4_div(const vec4& v, float k) { return vec4_store(_mm_div_ps(vec4_load(v), _mm_set1_ps(k))); }
+
+inline float dot_product(const vec4& a, const vec4& b) {
+	return _mm_cvtss_f32(vec4_hadd3(_mm_mul_ps(vec4_load(a), vec4_load(b))));
+}
+
+// All four components, for planes and homogeneous points
+inline float vec4_dot(const vec4& a, const vec4& b) {
+	__m128 p = _mm_mul_ps(vec4_load(a), vec4_load(b));
+	__m128 s = _mm_add_ps(p, _mm_movehl_ps(p, p));
+	return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1))));
+}
+
+// w is 0
+inline vec4 cross_product(const vec4& a, const vec4& b) {
+	__m128 ra = vec4_load(a), rb = vec4_load(b);
+	__m128 a_yzx = _mm_shuffle_ps(ra, ra, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 b_yzx = _mm_shuffle_ps(rb, rb, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 c = _mm_sub_ps(_mm_mul_ps(ra, b_yzx), _mm_mul_ps(a_yzx, rb));
+	return vec4_store(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+}
+
+// Scales x, y and z to unit length with the refined reciprocal square root, a zero vector is left as it is
+inline void normalize(vec4& v) {
+	__m128 r = vec4_load(v);
+	__m128 l2 = vec4_hadd3(_mm_mul_ps(r, r));
+	if (_mm_cvtss_f32(l2) == 0.0f)
+		return;
+	__m128 inv = vec4_rsqrt(_mm_shuffle_ps(l2, l2, 0));
+	float w = v.w;
+	v = vec4_store(_mm_mul_ps(r, inv));
+	v.w = w;
+}
+
+// Row vector times matrix, x * row 0 + y * row 1 + z * row 2 + w * row 3, no divide
+inline vec4 vec4_transform(const vec4& v, const mat4x4& m) {
+	__m128 r = vec4_load(v);
+	__m128 out = _mm_mul_ps(_mm_shuffle_ps(r, r, _MM_SHUFFLE(0, 0, 0, 0)), _mm_load_ps(m.m[0]));
+	out = _mm_add_ps(out, _mm_mul_ps(_mm_shuffle_ps(r, r, _MM_SHUFFLE(1, 1, 1, 1)), _mm_load_ps(m.m[1])));
+	out = _mm_add_ps(out, _mm_mul_ps(_mm_shuffle_ps(r, r, _MM_SHUFFLE(2, 2, 2, 2)), _mm_load_ps(m.m[2])));
+	out = _mm_add_ps(out, _mm_mul_ps(_mm_shuffle_ps(r, r, _MM_SHUFFLE(3, 3, 3, 3)), _mm_load_ps(m.m[3])));
+	return vec4_store(out);
+}
+
+#else
+
+inline vec4 vec4_add(const vec4& a, const vec4& b) { return { a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w }; }
+inline vec4 vec4_sub(const vec4& a, const vec4& b) { return { a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w }; }
+inline vec4 vec4_mul(const vec4& v, float k) { return { v.x * k, v.y * k, v.z * k, v.w * k }; }
+inline vec4 vec4_div(const vec4& v, float k) { return { v.x / k, v.y / k, v.z / k, v.w / k }; }
+inline float dot_product(const vec4& a, const vec4& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline float vec4_dot(const vec4& a, const vec4& b) { return (a.x * b.x + a.z * b.z) + (a.y * b.y + a.w * b.w); }
+inline vec4 cross_product(const vec4& a, const vec4& b) {
+	return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x, 0.0f };
+}
+inline void normalize(vec4& v) {
+	float l2 = v.x * v.x + v.y * v.y + v.z * v.z;
+	if (l2 == 0.0f)
+		return;
+	float inv = 1.0f / sqrtf(l2);
+	v.x *= inv;
+	v.y *= inv;
+	v.z *= inv;
+}
+inline vec4 vec4_transform(const vec4& v, const mat4x4& m) {
+	return {
+		v.x * m.m[0][0] + v.y * m.m[1][0] + v.z * m.m[2][0] + v.w * m.m[3][0],
+		v.x * m.m[0][1] + v.y * m.m[1][1] + v.z * m.m[2][1] + v.w * m.m[3][1],
+		v.x * m.m[0][2] + v.y * m.m[1][2] + v.z * m.m[2][2] + v.w * m.m[3][2],
+		v.x * m.m[0][3] + v.y * m.m[1][3] + v.z * m.m[2][3] + v.w * m.m[3][3],
+	};
+}
+
+#endif
+
+inline float vec4_length(const vec4& v) { return sqrtf(dot_product(v, v)); }